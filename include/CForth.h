@@ -9,8 +9,15 @@
 #include <cstring>
 #include <cmath>
 #include <cassert>
+#include <cstdint>
 
 namespace CForth {
+  // native integer cell width and double cell width (D+, U*, */MOD ...)
+  typedef int64_t     Integer;
+  typedef uint64_t    UInteger;
+  typedef __int128    DInteger;
+  typedef __uint128_t UDInteger;
+
   struct abortSignal : std::exception {
   };
 
@@ -19,37 +26,48 @@ namespace CForth {
 
   bool isBaseChar(int c, int base, int *value=nullptr);
 
-  // success/failure state
+  // success/failure state (error code only, message built on demand from the
+  // details of the last error so the success path does not allocate)
   class State {
    public:
-    bool valid() const { return valid_; }
+    enum Code {
+      OK,
+      ERROR,
+      UNKNOWN_WORD,
+      OPEN_FAILED
+    };
+
+   public:
+    Code code() const { return code_; }
+
+    bool valid() const { return (code_ == OK); }
 
-    const std::string &msg() const { return msg_; }
+    std::string msg() const;
 
-    operator bool() { return valid_; }
+    operator bool() const { return (code_ == OK); }
 
     static State success() {
-      return State(true);
+      return State(OK);
     }
 
-    static State error(const std::string &msg) {
-      lastError_ = State(false, msg);
+    // error with static message text
+    static State error(const char *msg);
 
-      return lastError_;
-    }
+    // word not found error
+    static State unknownWord(const std::string &word);
 
-    static State lastError() { return lastError_; }
+    // file open error
+    static State openFailed(const std::string &filename);
+
+    static State lastError();
 
    private:
-    State(bool valid=true, const std::string &msg="") :
-     valid_(valid), msg_(msg) {
+    explicit State(Code code) :
+     code_(code) {
     }
 
    private:
-    static State lastError_;
-
-    bool        valid_;
-    std::string msg_;
+    Code code_;
   };
 
   //------
@@ -185,6 +203,24 @@ namespace CForth {
       close();
     }
 
+    File(File &&file) :
+     filename_(std::move(file.filename_)), fp_(file.fp_) {
+      file.fp_ = nullptr;
+    }
+
+    File &operator=(File &&file) {
+      if (&file != this) {
+        close();
+
+        filename_ = std::move(file.filename_);
+        fp_       = file.fp_;
+
+        file.fp_ = nullptr;
+      }
+
+      return *this;
+    }
+
     bool isValid() const { return (fp_ != nullptr); }
 
     State open() {
@@ -193,7 +229,7 @@ namespace CForth {
       fp_ = fopen(filename_.c_str(), "r");
 
       if (! fp_)
-        return State::error("Failed to open'" + filename_ + "'");
+        return State::openFailed(filename_);
 
       return State::success();
     }
@@ -234,7 +270,7 @@ namespace CForth {
   class Number {
    public:
     static Number makeBoolean(bool   b) { return Number(b); }
-    static Number makeInteger(int    i) { return Number(i); }
+    static Number makeInteger(Integer i) { return Number(i); }
     static Number makeReal   (double r) { return Number(r); }
 
     static Number plus  (const Number &n1, const Number &n2) { return doOp(n1, n2, Plus  ()); }
@@ -260,11 +296,11 @@ namespace CForth {
     bool isReal   () const { return t_ == REAL_TYPE   ; }
 
     bool   boolean() const { return (! isReal() ? bool  (v_.i) : bool  (v_.r)); }
-    int    integer() const { return (! isReal() ? int   (v_.i) : int   (v_.r)); }
+    Integer integer() const { return (! isReal() ? v_.i : Integer(v_.r)); }
     double real   () const { return (! isReal() ? double(v_.i) : double(v_.r)); }
 
     void setBoolean(bool   b) { t_ = BOOLEAN_TYPE; v_.i = b; }
-    void setInteger(int    i) { t_ = INTEGER_TYPE; v_.i = i; }
+    void setInteger(Integer i) { t_ = INTEGER_TYPE; v_.i = i; }
     void setReal   (double r) { t_ = REAL_TYPE   ; v_.r = r; }
 
     Number abs() const { return (! isReal() ? makeInteger(std:: abs(integer())) :
@@ -295,10 +331,12 @@ namespace CForth {
     }
 
     void print(std::ostream &os) const {
-      if (isBoolean())
+      if      (isBoolean())
         os << (boolean() ? "TRUE" : "FALSE");
+      else if (isInteger())
+        os << integer();
       else
-        os << (isInteger() ? integer() : real());
+        os << real();
     }
 
    private:
@@ -325,7 +363,7 @@ namespace CForth {
       template<typename T> T exec(const T &a, const T &b) {
         assert(b != T(0));
 
-        int factor = int(a/b);
+        Integer factor = Integer(a/b);
 
         return a - (b*factor);
       }
@@ -334,13 +372,13 @@ namespace CForth {
     struct Min { template<typename T> T exec(const T &a, const T &b) { return std::min(a, b); } };
     struct Max { template<typename T> T exec(const T &a, const T &b) { return std::max(a, b); } };
 
-    struct doAnd { int exec(int a, int b) { return (a & b); } };
-    struct doOr  { int exec(int a, int b) { return (a | b); } };
-    struct doXor { int exec(int a, int b) { return (a ^ b); } };
+    struct doAnd { Integer exec(Integer a, Integer b) { return (a & b); } };
+    struct doOr  { Integer exec(Integer a, Integer b) { return (a | b); } };
+    struct doXor { Integer exec(Integer a, Integer b) { return (a ^ b); } };
 
    private:
     Number(bool   b) : t_(BOOLEAN_TYPE) { v_.i = b; }
-    Number(int    i) : t_(INTEGER_TYPE) { v_.i = i; }
+    Number(Integer i) : t_(INTEGER_TYPE) { v_.i = i; }
     Number(double r) : t_(REAL_TYPE   ) { v_.r = r; }
 
    private:
@@ -351,8 +389,8 @@ namespace CForth {
     };
 
     union Value {
-      int    i;
-      double r;
+      Integer i;
+      double  r;
     };
 
     Type  t_;
@@ -362,8 +400,276 @@ namespace CForth {
   //------
 
   class Token;
+  class Variable;
+
+  // intrusive reference counted pointer. Count lives in the object and is not
+  // atomic (tokens are only shared within one interpreter) so copies are cheap.
+  template<typename T>
+  class RefPtr {
+   public:
+    RefPtr() { }
+
+    RefPtr(std::nullptr_t) { }
+
+    explicit RefPtr(T *p) : p_(p) { ref(); }
+
+    RefPtr(const RefPtr &r) : p_(r.p_) { ref(); }
+
+    RefPtr(RefPtr &&r) noexcept : p_(r.p_) { r.p_ = nullptr; }
+
+    template<typename U>
+    RefPtr(const RefPtr<U> &r) : p_(r.get()) { ref(); }
+
+    template<typename U>
+    RefPtr(RefPtr<U> &&r) noexcept : p_(r.release()) { }
+
+   ~RefPtr() { unref(); }
+
+    RefPtr &operator=(RefPtr r) noexcept { std::swap(p_, r.p_); return *this; }
+
+    T *get() const { return p_; }
+
+    T *operator->() const { return p_; }
+    T &operator* () const { return *p_; }
+
+    explicit operator bool() const { return (p_ != nullptr); }
+
+    void reset() { unref(); p_ = nullptr; }
+
+    // give up ownership without changing count
+    T *release() { T *p = p_; p_ = nullptr; return p; }
+
+   private:
+    void ref() { if (p_) p_->incRef(); }
+
+    void unref() { if (p_) p_->decRef(); }
+
+   private:
+    T *p_ { nullptr };
+  };
+
+  template<typename T, typename U>
+  inline bool operator==(const RefPtr<T> &a, const RefPtr<U> &b) { return a.get() == b.get(); }
+  template<typename T, typename U>
+  inline bool operator!=(const RefPtr<T> &a, const RefPtr<U> &b) { return a.get() != b.get(); }
+
+  template<typename T>
+  inline bool operator==(const RefPtr<T> &a, std::nullptr_t) { return ! a; }
+  template<typename T>
+  inline bool operator!=(const RefPtr<T> &a, std::nullptr_t) { return !! a; }
+
+  template<typename T, typename... Args>
+  inline RefPtr<T> makeRef(Args &&...args) {
+    return RefPtr<T>(new T(std::forward<Args>(args)...));
+  }
+
+  template<typename T, typename U>
+  inline RefPtr<T> refCast(const RefPtr<U> &p) {
+    return RefPtr<T>(static_cast<T *>(p.get()));
+  }
+
+  typedef RefPtr<Token> TokenP;
+
+  // stack cell (inline boolean or number, otherwise heap token)
+  class Cell {
+   public:
+    enum Type {
+      NO_CELL,
+      BOOLEAN_CELL,
+      INTEGER_CELL,
+      REAL_CELL,
+      TOKEN_CELL
+    };
+
+   public:
+    static Cell makeBoolean(bool   b) { Cell c(BOOLEAN_CELL); c.v_.i = b; return c; }
+    static Cell makeInteger(Integer i) { Cell c(INTEGER_CELL); c.v_.i = i; return c; }
+    static Cell makeReal   (double r) { Cell c(REAL_CELL   ); c.v_.r = r; return c; }
+
+    static Cell makeNumber(const Number &n) {
+      if      (n.isBoolean()) return makeBoolean(n.boolean());
+      else if (n.isReal   ()) return makeReal   (n.real   ());
+      else                    return makeInteger(n.integer());
+    }
+
+    static Cell makeToken(Token *token) { Cell c(TOKEN_CELL); c.v_.p = token; return c; }
+
+    static Cell fromToken(const TokenP &token);
+
+    Cell() :
+     t_(NO_CELL) {
+      v_.i = 0;
+    }
+
+    Type type() const { return t_; }
+
+    bool isValid  () const { return t_ != NO_CELL     ; }
+    bool isBoolean() const { return t_ == BOOLEAN_CELL; }
+    bool isInteger() const { return t_ == INTEGER_CELL; }
+    bool isReal   () const { return t_ == REAL_CELL   ; }
+    bool isToken  () const { return t_ == TOKEN_CELL  ; }
+
+    bool isNumber() const { return (t_ == INTEGER_CELL || t_ == REAL_CELL); }
+
+    bool   boolean() const { return (! isReal() ? bool  (v_.i) : bool  (v_.r)); }
+    Integer integer() const { return (! isReal() ? v_.i : Integer(v_.r)); }
+    double real   () const { return (! isReal() ? double(v_.i) : double(v_.r)); }
+
+    Number number() const {
+      if      (isBoolean()) return Number::makeBoolean(boolean());
+      else if (isReal   ()) return Number::makeReal   (real   ());
+      else                  return Number::makeInteger(integer());
+    }
+
+    Token *token() const { return v_.p; }
+
+    // add to value of integer cell in place (loop counters)
+    void addInteger(Integer n) { v_.i += n; }
+
+    TokenP toToken() const;
+
+    static State cmp(const Cell &c1, const Cell &c2, int &res);
+
+    State inc(const Number &n);
+
+    void print(std::ostream &os) const;
+
+   private:
+    friend class Memory;
+
+    explicit Cell(Type t) :
+     t_(t) {
+      v_.i = 0;
+    }
+
+   private:
+    union Value {
+      Integer i;
+      double  r;
+      Token  *p;
+    };
+
+    Type  t_;
+    Value v_;
+  };
+
+  static_assert(sizeof(Cell) == 16, "Cell must fit in 16 bytes");
+
+  typedef std::vector<Cell> CellArray;
+
+  // float stack (raw doubles)
+  typedef std::vector<double> FloatArray;
+
+  //------
+
+  // linear data space of typed cells addressed by integer cell index (0 is invalid).
+  // VARIABLE, CREATE, ',' and ALLOT allocate at HERE.
+  // Cells are stored in fixed size pages shared by copies of the memory (instances
+  // made from a frozen base) and copied on first write.
+  class Memory {
+   public:
+    Memory() :
+     here_(1) {
+      grow(here_);
+    }
+
+    int here() const { return here_; }
+
+    int size() const { return size_; }
+
+    // addresses are integer cells, so range check at full width before
+    // indexing with int
+    bool isValid(Integer addr) const { return (addr > 0 && addr < size()); }
+
+    bool isValid(Integer addr, Integer n) const {
+      return (n >= 0 && addr > 0 && addr <= size() - n);
+    }
+
+    // allocate n cells at HERE (negative n releases)
+    bool allot(Integer n);
+
+    // make n cells beyond HERE addressable without allocating them
+    void reserve(int n) { grow(here_ + n); }
+
+    // set HERE without initializing cells (replay of recorded load)
+    void setHere(int here) { here_ = here; grow(here_); }
+
+    typedef std::vector<std::pair<int, int>> Ranges;
+
+    // address ranges (start, end) of cells which may differ from memory this is a
+    // copy of (pages no longer shared with it)
+    void changedRanges(const Memory &memory, Ranges &ranges) const;
+
+    Cell get(Integer addr) const {
+      if (! isValid(addr)) return Cell();
+
+      const Page &page = *pages_[addr >> PAGE_BITS];
+
+      int i = int(addr & PAGE_MASK);
+
+      Cell c(Cell::Type(page.types[i])); c.v_ = page.values[i]; return c;
+    }
+
+    bool set(Integer addr, const Cell &cell) {
+      if (! isValid(addr)) return false;
+
+      Page &page = writePage(int(addr >> PAGE_BITS));
+
+      int i = int(addr & PAGE_MASK);
+
+      page.types[i] = static_cast<unsigned char>(cell.t_); page.values[i] = cell.v_;
+
+      return true;
+    }
+
+    // bulk copy of n cells (overlap safe)
+    bool move(Integer src, Integer dst, Integer n);
+
+    // bulk copy of n cells as if copied one at a time from low (CMOVE) or high (CMOVE>)
+    // addresses, so overlapping ranges propagate
+    bool copyUp  (Integer src, Integer dst, Integer n);
+    bool copyDown(Integer src, Integer dst, Integer n);
+
+    // set n cells to value
+    bool fill(Integer addr, Integer n, const Cell &cell);
+
+   private:
+    enum {
+      PAGE_BITS = 10,
+      PAGE_SIZE = 1 << PAGE_BITS,
+      PAGE_MASK = PAGE_SIZE - 1
+    };
 
-  typedef std::shared_ptr<Token> TokenP;
+    // unused cells are integer zero
+    struct Page {
+      Page() { memset(types, Cell::INTEGER_CELL, sizeof(types)); }
+
+      Cell::Value   values[PAGE_SIZE] { };
+      unsigned char types [PAGE_SIZE];
+    };
+
+    typedef std::shared_ptr<Page> PageP;
+    typedef std::vector<PageP>    Pages;
+
+    // page i for write (copied if shared)
+    Page &writePage(int i) {
+      if (pages_[i].use_count() > 1)
+        pages_[i] = std::make_shared<Page>(*pages_[i]);
+
+      return *pages_[i];
+    }
+
+    void grow(int n);
+
+    void copy(int src, int dst, int n);
+
+   private:
+    int   here_;
+    int   size_ { 0 };
+    Pages pages_;
+  };
+
+  //------
 
   // token (boolean, number, builtin, variable, procedure)
   class Token {
@@ -394,8 +700,7 @@ namespace CForth {
     bool isVarBase  () const { return type() == VAR_BASE_TOKEN ; }
     bool isProcedure() const { return type() == PROCEDURE_TOKEN; }
 
-    bool isVariable() const;
-    bool isVarRef  () const;
+    bool isVariable() const { return isVarBase(); }
 
     virtual TokenP dup() const { assert(false); }
 
@@ -419,21 +724,201 @@ namespace CForth {
 
     virtual void print(std::ostream &os) const = 0;
 
+    // intrusive reference count (see RefPtr). Frozen tokens may be referenced
+    // from several threads so their count is updated atomically.
+    void incRef() const {
+      if (refCount_.frozen)
+        __atomic_add_fetch(&refCount_.n, 1, __ATOMIC_RELAXED);
+      else
+        ++refCount_.n;
+    }
+
+    void decRef() const {
+      if (refCount_.frozen) {
+        if (__atomic_sub_fetch(&refCount_.n, 1, __ATOMIC_ACQ_REL) == 0)
+          delete this;
+      }
+      else if (--refCount_.n == 0)
+        delete this;
+    }
+
+    // make token and the tokens it references immutable so it can be shared
+    // between interpreter instances (see Interpreter::freeze)
+    void freeze() {
+      if (refCount_.frozen) return;
+
+      refCount_.frozen = true;
+
+      freezeRefs();
+    }
+
+    bool isFrozen() const { return refCount_.frozen; }
+
    protected:
+    // freeze referenced tokens
+    virtual void freezeRefs() { }
+
     TokenType tokenType_;
+
+   private:
+    // count is not copied with the token
+    struct RefCount {
+      RefCount() { }
+      RefCount(const RefCount &) { }
+
+      RefCount &operator=(const RefCount &) { return *this; }
+
+      int  n      { 0 };
+      bool frozen { false };
+    };
+
+    mutable RefCount refCount_;
   };
 
   typedef std::vector<TokenP> TokenArray;
 
+  inline void freezeTokens(const TokenArray &tokens) {
+    for (const auto &token : tokens)
+      token->freeze();
+  }
+
+  //------
+
+  // function translated ahead of time from forth code (see CForthCompile)
+  typedef State (*CodeFn)();
+
+  // data stack effect ( in -- out ) : cells needed on entry and left on exit
+  struct StackEffect {
+    bool known { false };
+    int  in    { 0 };
+    int  out   { 0 };
+  };
+
+  // compiled (token threaded) code for a token array
+  class Code {
+   public:
+    // instruction
+    struct Instr {
+      enum Op {
+        LITERAL_OP,   // push cell
+        VARIABLE_OP,  // push variable address and run DOES> code
+        EXEC_OP,      // exec token
+        BUILTIN_OP,   // exec core builtin (type in arg) using switch dispatch
+        BRANCH_OP,    // jump to arg
+        ZBRANCH_OP,   // pop flag and jump to arg if false
+        NZBRANCH_OP,  // pop flag and jump to arg if true
+        DO_OP,        // move limit and index to return stack
+        LOOP_TEST_OP, // jump to arg if loop complete
+        LOOP_OP,      // increment loop index by one and jump to arg
+        PLOOP_OP,     // increment loop index by popped value and jump to arg
+        UNLOOP_OP,    // drop loop limit and index from return stack
+
+        // superinstructions (fused instruction pairs)
+        LIT_BUILTIN_OP, // push cell and exec core builtin (type in arg, builtin in token)
+        VAR_FETCH_OP,   // push value of variable
+        VAR_STORE_OP,   // pop value into variable
+        SQUARE_OP,      // DUP *
+
+        // type specialized binary builtins (type in arg, builtin in cell)
+        INT_OP,         // operands known to be integers
+        REAL_OP,        // at least one operand known to be real
+        LIT_INT_OP,     // INT_OP with literal operand (builtin in token)
+        LIT_REAL_OP     // REAL_OP with literal operand (builtin in token)
+      };
+
+      Op     op;
+      int    arg;
+      Cell   cell;
+      Token *token { nullptr };
+
+      Instr(Op op1, int arg1=0, const Cell &cell1=Cell(), Token *token1=nullptr) :
+       op(op1), arg(arg1), cell(cell1), token(token1) {
+      }
+    };
+
+    typedef std::vector<Instr> Instrs;
+
+    enum { MAX_LOOP_DEPTH = 32 };
+
+   public:
+    Code() { }
+
+    bool isValid() const { return valid_; }
+
+    const Instrs &instrs() const { return instrs_; }
+
+    bool compile(const TokenArray &tokens);
+
+    // compile instructions to native code (x86-64 only). Instructions become
+    // calls to their implementations; stack cells are not kept in registers.
+    bool jit();
+
+    bool isNative() const { return nativeCode() != nullptr; }
+
+    // run translated function instead of instructions
+    void setFunction(CodeFn fn) { fn_ = fn; valid_ = true; }
+
+    CodeFn function() const { return fn_; }
+
+    // stack effect inferred from instructions (unknown if depth depends on data)
+    const StackEffect &effect() const { return effect_; }
+
+    State exec() const;
+
+   private:
+    struct Native;
+
+    // native code is published atomically as shared (frozen) code may be compiled
+    // while other instances run it
+    const Native *nativeCode() const {
+      return __atomic_load_n(&nativeCode_, __ATOMIC_ACQUIRE);
+    }
+
+    State execNative(const Native *native) const;
+    template<bool CHECKED>
+    State execCached() const;
+
+    typedef std::shared_ptr<Native> NativeP;
+
+    struct Loop {
+      bool             isDo { false };
+      std::vector<int> leaves;
+    };
+
+    typedef std::vector<Loop> Loops;
+
+    bool compileTokens(const TokenArray &tokens);
+    bool compileToken(const TokenP &token);
+
+    int addInstr(const Instr &instr);
+
+    void optimizeInstrs();
+    void fuseInstrs();
+
+    void analyzeEffect();
+    bool simplifyInstrs();
+    void specializeTypes();
+
+   private:
+    Instrs      instrs_;
+    bool        valid_ { false };
+    Loops       loops_;
+    int         doDepth_ { 0 };
+    NativeP       native_;
+    const Native *nativeCode_ { nullptr };
+    CodeFn        fn_ { nullptr };
+    StackEffect   effect_;
+  };
+
   class BooleanToken;
 
-  typedef std::shared_ptr<BooleanToken> BooleanTokenP;
+  typedef RefPtr<BooleanToken> BooleanTokenP;
 
   // boolean token (needed ?)
   class BooleanToken : public Token {
    public:
-    static BooleanTokenP fromToken(TokenP token) {
-      return std::static_pointer_cast<BooleanToken>(token);
+    static BooleanTokenP fromToken(const TokenP &token) {
+      return refCast<BooleanToken>(token);
     }
 
     BooleanToken(bool b) :
@@ -450,43 +935,43 @@ namespace CForth {
 
   class NumberToken;
 
-  typedef std::shared_ptr<NumberToken> NumberTokenP;
+  typedef RefPtr<NumberToken> NumberTokenP;
 
   // number token
   class NumberToken : public Token {
    public:
-    static NumberTokenP fromToken(TokenP token) {
-      return std::static_pointer_cast<NumberToken>(token);
+    static NumberTokenP fromToken(const TokenP &token) {
+      return refCast<NumberToken>(token);
     }
 
     static NumberTokenP makeBoolean(int b) {
-      return std::make_shared<NumberToken>(Number::makeBoolean(b));
+      return makeRef<NumberToken>(Number::makeBoolean(b));
     }
 
-    static NumberTokenP makeInteger(int i) {
-      return std::make_shared<NumberToken>(Number::makeInteger(i));
+    static NumberTokenP makeInteger(Integer i) {
+      return makeRef<NumberToken>(Number::makeInteger(i));
     }
 
     static NumberTokenP makeReal(double r) {
-      return std::make_shared<NumberToken>(Number::makeReal(r));
+      return makeRef<NumberToken>(Number::makeReal(r));
     }
 
     static NumberTokenP makeNumber(const Number &n) {
-      return std::make_shared<NumberToken>(n);
+      return makeRef<NumberToken>(n);
     }
 
-    TokenP dup() const override { return std::make_shared<NumberToken>(number_); }
+    TokenP dup() const override { return makeRef<NumberToken>(number_); }
 
     const Number &number() const { return number_; }
 
     bool isInteger() const { return number_.isInteger(); }
     bool isReal   () const { return number_.isReal   (); }
 
-    int    integer() const { return number_.integer(); }
-    double real   () const { return number_.real   (); }
+    Integer integer() const { return number_.integer(); }
+    double  real   () const { return number_.real   (); }
 
-    void setInteger(int    i) { number_.setInteger(i); }
-    void setReal   (double r) { number_.setReal   (r); }
+    void setInteger(Integer i) { number_.setInteger(i); }
+    void setReal   (double  r) { number_.setReal   (r); }
 
     State cmp(const TokenP &token, int &res) const override {
       if (token->isNumber())
@@ -516,12 +1001,14 @@ namespace CForth {
 
   class Builtin;
 
-  typedef std::shared_ptr<Builtin> BuiltinP;
+  typedef RefPtr<Builtin> BuiltinP;
 
   // builtin token
   class Builtin : public Token {
    public:
     enum BuiltinType {
+      NO_BUILTIN=-1,
+
       // Stack manipulation
       DUP_BUILTIN,
       DROP_BUILTIN,
@@ -552,11 +1039,16 @@ namespace CForth {
       DMOD_BUILTIN,
       PLUS1_BUILTIN,
       PLUS2_BUILTIN,
+      DPLUS_BUILTIN,
       MULDIV_BUILTIN,
+      MULDMOD_BUILTIN,
+      UTIMES_BUILTIN,
+      UDMOD_BUILTIN,
       MAX_BUILTIN,
       MIN_BUILTIN,
       ABS_BUILTIN,
       NEGATE_BUILTIN,
+      DNEGATE_BUILTIN,
       AND_BUILTIN,
       OR_BUILTIN,
       XOR_BUILTIN,
@@ -567,7 +1059,26 @@ namespace CForth {
       PFETCH_BUILTIN,
       ADDSTORE_BUILTIN,
       MOVE_BUILTIN,
+      CMOVE_BUILTIN,
+      CMOVE_UP_BUILTIN,
       FILL_BUILTIN,
+      ERASE_BUILTIN,
+
+      // Floating point
+      FPLUS_BUILTIN,
+      FMINUS_BUILTIN,
+      FTIMES_BUILTIN,
+      FDIVIDE_BUILTIN,
+      FFETCH_BUILTIN,
+      FSTORE_BUILTIN,
+      FDUP_BUILTIN,
+      FDROP_BUILTIN,
+      FSWAP_BUILTIN,
+      FSQRT_BUILTIN,
+      FLESS_BUILTIN,
+      STOF_BUILTIN,
+      FTOS_BUILTIN,
+      FPRINT_BUILTIN,
 
       // Control structures
       DO_BUILTIN,
@@ -608,6 +1119,8 @@ namespace CForth {
       // Mass storgate input/output
       // LIST
       LOAD_BUILTIN,
+      SAVE_IMAGE_BUILTIN,
+      LOAD_IMAGE_BUILTIN,
       // SCR
       // BLOCK
       // UPDATE
@@ -651,13 +1164,14 @@ namespace CForth {
       QUIT_BUILTIN,
 
       DEBUG_BUILTIN,
+      EFFECT_BUILTIN,
 
       USER_BUILTIN=1000
     };
 
    public:
-    static BuiltinP fromToken(TokenP token) {
-      return std::static_pointer_cast<Builtin>(token);
+    static BuiltinP fromToken(const TokenP &token) {
+      return refCast<Builtin>(token);
     }
 
     Builtin(BuiltinType builtinType, const std::string &name) :
@@ -687,244 +1201,132 @@ namespace CForth {
 
   class VarBase;
 
-  typedef std::shared_ptr<VarBase> VarBaseP;
-
-  class VariableRef;
-
-  typedef std::shared_ptr<VariableRef> VariableRefP;
+  typedef RefPtr<VarBase> VarBaseP;
 
   // base class for variable type tokens
   class VarBase : public Token {
    public:
-    enum VarBaseType {
-      VARIABLE_TYPE,
-      VAR_REF_TYPE
-    };
-
-   public:
-    static VarBaseP fromToken(TokenP token) {
-      return std::static_pointer_cast<VarBase>(token);
+    static VarBaseP fromToken(const TokenP &token) {
+      return refCast<VarBase>(token);
     }
 
-    VarBase(VarBaseType varBaseType) :
-     Token(VAR_BASE_TOKEN), varBaseType_(varBaseType) {
+    VarBase() :
+     Token(VAR_BASE_TOKEN) {
     }
 
-    bool isVariable() const { return (varBaseType_ == VARIABLE_TYPE); }
-    bool isVarRef  () const { return (varBaseType_ == VAR_REF_TYPE ); }
-
     virtual const std::string &name() const = 0;
 
-    virtual int ind() const = 0;
-
-    virtual void setInd(int ind) = 0;
-
-    virtual TokenP value() const = 0;
-
-    virtual bool setValue(const TokenP &token) = 0;
-
-    virtual TokenP indValue(int ind) const = 0;
+    virtual Cell value() const = 0;
 
-    virtual bool setIndValue(int ind, TokenP value) = 0;
-
-    virtual int length() const = 0;
+    virtual bool setValue(const Cell &cell) = 0;
 
     virtual bool isConstant() const { return false; }
 
-    virtual long addr() const = 0;
-
-    virtual VariableRefP indexVar(VarBaseP var, int ind) = 0;
-
-    State cmp(const TokenP &token, int &res) const override {
-      if (token->isVarBase()) {
-        long p1 =                            addr();
-        long p2 = VarBase::fromToken(token)->addr();
-
-        if      (p1 > p2) res =  1;
-        else if (p1 < p2) res = -1;
-        else              res =  0;
-      }
-      else
-        return State::error("cmp not supported");
-
-      return State::success();
-    }
-
-    State inc(const Number &n) override {
-      setInd(ind() + n.integer());
-
-      return State::success();
-    }
-
-   private:
-    VarBaseType varBaseType_;
+    // stack cell for token (address or constant value)
+    virtual Cell cell() = 0;
   };
 
   //------
 
   class Variable;
 
-  typedef std::shared_ptr<Variable> VariableP;
+  typedef RefPtr<Variable> VariableP;
 
-  // variable token
+  // variable token (data space address or constant value)
   class Variable : public VarBase {
    public:
-    static VariableP fromToken(TokenP token) {
-      return std::static_pointer_cast<Variable>(token);
+    static VariableP fromToken(const TokenP &token) {
+      return refCast<Variable>(token);
     }
 
-    Variable(const std::string &name) :
-     VarBase(VARIABLE_TYPE), name_(name), ind_(0), constant_(false) {
+    Variable(const std::string &name, int addr) :
+     name_(name), addr_(addr), constant_(false) {
     }
 
     const std::string &name() const override { return name_; }
 
-    int ind() const override { return ind_; }
+    int addr() const { return addr_; }
 
-    void setInd(int ind) override { ind_ = ind; }
+    Cell value() const override;
 
-    TokenP value() const override {
-      return indValue(ind_);
-    }
+    bool setValue(const Cell &value) override;
 
-    virtual bool setValue(const TokenP &value) override {
-      return setIndValue(ind_, value);
-    }
+    void setInteger(Integer i);
 
-    TokenP indValue(int ind) const override {
-      if (ind >= 0 && ind < int(values_.size()))
-        return values_[ind];
-      else
-        return TokenP();
-    }
-
-    bool setIndValue(int ind, TokenP value) override {
-      if (ind < 0 || ind >= int(values_.size()))
-        return false;
+    bool getInteger(Integer &i) const;
 
-      values_[ind] = value;
+    bool isConstant() const override { return constant_; }
 
-      return true;
-    }
+    void setConstant(const Cell &value) { constant_ = true; constValue_ = value; }
 
-    int length() const override { return int(values_.size() - ind_); }
+    void setExecTokens(const TokenArray &execTokens) {
+      execTokens_ = execTokens;
 
-    void setInteger(int i);
+      execCode_.compile(execTokens_);
+    }
 
-    bool getInteger(int &i) const;
+    void setExecFunction(CodeFn fn) { execCode_.setFunction(fn); }
 
-    bool isConstant() const override { return constant_; }
+    bool hasExecTokens() const { return (! execTokens_.empty() || execCode_.function()); }
 
-    void setConstant(bool constant) { constant_ = constant; }
+    const TokenArray &execTokenArray() const { return execTokens_; }
 
-    void setExecTokens(const TokenArray &execTokens) { execTokens_ = execTokens; }
+    const Code &execCode() const { return execCode_; }
 
     State execTokens();
 
-    void allot(int n) {
-      for (int i = 0; i < n; ++i)
-        addValue(NumberToken::makeInteger(0));
-    }
-
-    void addValue(TokenP token) {
-      values_.push_back(token);
-    }
-
-    long addr() const override { return long(this) + ind_; }
-
-    VariableRefP indexVar(VarBaseP var, int ind) override {
-      return std::make_shared<VariableRef>(var, ind + ind_);
+    Cell cell() override {
+      return (isConstant() ? constValue_ : Cell::makeInteger(addr_));
     }
 
     void print(std::ostream &os) const override {
       if (isConstant())
-        value()->print(os);
+        constValue_.print(os);
       else
         os << "$" << name();
     }
 
+   protected:
+    void freezeRefs() override;
+
    protected:
     std::string name_;
-    TokenArray  values_;
-    int         ind_;
+    int         addr_;
     bool        constant_;
+    Cell        constValue_;
     TokenArray  execTokens_;
-  };
-
-  //------
-
-  // variable ref token
-  // TODO: better base class
-  class VariableRef : public VarBase {
-   public:
-    VariableRef(VarBaseP var, int ind) :
-     VarBase(VAR_REF_TYPE), var_(var), ind_(ind) {
-    }
-
-    TokenP dup() const override { return std::make_shared<VariableRef>(var_, ind_); }
-
-    const std::string &name() const override { return var_->name(); }
-
-    int ind() const override { return ind_; }
-
-    void setInd(int ind) override { ind_ = ind; }
-
-    TokenP value() const override {
-      return var_->indValue(ind_);
-    }
-
-    bool setValue(const TokenP &value) override {
-      return var_->setIndValue(ind_, value);
-    }
-
-    TokenP indValue(int ind) const override {
-      return var_->indValue(ind_ + ind);
-    }
-
-    bool setIndValue(int ind, TokenP value) override {
-      return var_->setIndValue(ind_ + ind, value);
-    }
-
-    int length() const override { return var_->length() - ind_; }
-
-    long addr() const override { return var_->addr() + ind_; }
-
-    VariableRefP indexVar(VarBaseP, int ind) override {
-      return var_->indexVar(var_, ind + ind_);
-    }
-
-    void print(std::ostream &os) const override {
-      var_->print(os);
-
-      os << "[" << ind_ << "]";
-    }
-
-   private:
-    VarBaseP var_;
-    int      ind_;
+    Code        execCode_;
   };
 
   //------
 
   class Procedure;
 
-  typedef std::shared_ptr<Procedure> ProcedureP;
+  typedef RefPtr<Procedure> ProcedureP;
 
   // procedure token
   class Procedure : public Token {
    public:
-    static ProcedureP fromToken(TokenP token) {
-      return std::static_pointer_cast<Procedure>(token);
+    static ProcedureP fromToken(const TokenP &token) {
+      return refCast<Procedure>(token);
     }
 
     Procedure(const std::string &name, const TokenArray &tokens) :
      Token(PROCEDURE_TOKEN), name_(name), tokens_(tokens) {
+      code_.compile(tokens_);
+    }
+
+    Procedure(const std::string &name, CodeFn fn) :
+     Token(PROCEDURE_TOKEN), name_(name) {
+      code_.setFunction(fn);
     }
 
     const std::string &name() const { return name_; }
 
     const TokenArray &tokens() { return tokens_; }
 
+    const Code &code() const { return code_; }
+
     bool isExecutable() const override { return true; }
 
     State exec() override;
@@ -932,7 +1334,7 @@ namespace CForth {
     void print(std::ostream &os) const override {
       os << ": " << name_ << " ";
 
-      for (auto token : tokens_) {
+      for (const auto &token : tokens_) {
         token->print(os);
 
         os << " ";
@@ -941,9 +1343,17 @@ namespace CForth {
       os << ";";
     }
 
+   protected:
+    void freezeRefs() override;
+
+   private:
+    int countCall();
+
    private:
     std::string name_;
     TokenArray  tokens_;
+    Code        code_;
+    int         numCalls_ { 0 };
   };
 
   //------
@@ -972,6 +1382,22 @@ namespace CForth {
     bool       leave;
   };
 
+  inline void freezeTokens(const std::string &) { }
+
+  inline void freezeTokens(const IfTokens &tokens) {
+    freezeTokens(tokens.ifTokens);
+    freezeTokens(tokens.elseTokens);
+  }
+
+  inline void freezeTokens(const DoTokens &tokens) {
+    freezeTokens(tokens.tokens);
+  }
+
+  inline void freezeTokens(const BeginTokens &tokens) {
+    freezeTokens(tokens.tokens);
+    freezeTokens(tokens.whileTokens);
+  }
+
   // builtin class builder
   #define BUILTIN_DEF(ID,N,STR) \
   class ID##Builtin : public Builtin { \
@@ -979,7 +1405,7 @@ namespace CForth {
     ID##Builtin() : Builtin(N##_BUILTIN,STR) { } \
     State exec() override; \
   }; \
-  typedef std::shared_ptr<ID##Builtin> ID##BuiltinP;
+  typedef RefPtr<ID##Builtin> ID##BuiltinP;
 
   // empty builtin class builder
   #define NULL_BUILTIN_DEF(ID,N,STR) \
@@ -988,14 +1414,14 @@ namespace CForth {
     ID##Builtin() : Builtin(N##_BUILTIN,STR) { } \
     State exec() override { return State::success(); } \
   }; \
-  typedef std::shared_ptr<ID##Builtin> ID##BuiltinP;
+  typedef RefPtr<ID##Builtin> ID##BuiltinP;
 
   // builtin class builder (with parsing support)
   #define MOD_BUILTIN_DEF(ID,N,STR,VALUE,VNAME,EXTRA) \
   class ID##Builtin : public Builtin { \
    public: \
     ID##Builtin(const VALUE &value=VALUE()) : Builtin(N##_BUILTIN,STR), VNAME(value) { } \
-    TokenP dup() const override { return std::make_shared<ID##Builtin>(VNAME); } \
+    TokenP dup() const override { return makeRef<ID##Builtin>(VNAME); } \
     bool hasModifier() const override { return true; } \
     const VALUE &getValue() const { return VNAME; } \
     VALUE &getValue() { return VNAME; } \
@@ -1003,12 +1429,14 @@ namespace CForth {
     void print(std::ostream &os) const override; \
     State exec() override; \
     EXTRA \
+   protected: \
+    void freezeRefs() override { freezeTokens(VNAME); } \
    private: \
     VALUE VNAME; \
   }; \
-  typedef std::shared_ptr<ID##Builtin> ID##BuiltinP;
+  typedef RefPtr<ID##Builtin> ID##BuiltinP;
 
-  #define DO_BLOCK bool isBlock() const override { return true; } State exec1(TokenP &, TokenP &);
+  #define DO_BLOCK bool isBlock() const override { return true; } State exec1(size_t pos);
   #define IS_BLOCK bool isBlock() const override { return true; }
   #define IS_NULL  bool isNull () const override { return true; }
   #define NO_DEF
@@ -1043,11 +1471,16 @@ namespace CForth {
   BUILTIN_DEF(DMod  , DMOD  , "/MOD"  )
   BUILTIN_DEF(Plus1 , PLUS1 , "1+"    )
   BUILTIN_DEF(Plus2 , PLUS2 , "2+"    )
-  BUILTIN_DEF(MulDiv, MULDIV, "*/"    )
+  BUILTIN_DEF(DPlus  , DPLUS  , "D+"     )
+  BUILTIN_DEF(MulDiv , MULDIV , "*/"     )
+  BUILTIN_DEF(MulDMod, MULDMOD, "*/MOD"  )
+  BUILTIN_DEF(UTimes , UTIMES , "U*"     )
+  BUILTIN_DEF(UDMod  , UDMOD  , "U/MOD"  )
   BUILTIN_DEF(Max   , MAX   , "MAX"   )
   BUILTIN_DEF(Min   , MIN   , "MIN"   )
   BUILTIN_DEF(Abs   , ABS   , "ABS"   )
   BUILTIN_DEF(Negate, NEGATE, "NEGATE")
+  BUILTIN_DEF(DNegate, DNEGATE, "DNEGATE")
   BUILTIN_DEF(And   , AND   , "AND"   )
   BUILTIN_DEF(Or    , OR    , "OR"    )
   BUILTIN_DEF(Xor   , XOR   , "XOR"   )
@@ -1057,8 +1490,27 @@ namespace CForth {
   BUILTIN_DEF(Store   , STORE   , "!")
   BUILTIN_DEF(PFetch  , PFETCH  , "?")
   BUILTIN_DEF(AddStore, ADDSTORE, "+!")
-  BUILTIN_DEF(Move    , MOVE    , "MOVE")
-  BUILTIN_DEF(Fill    , FILL    , "FILL")
+  BUILTIN_DEF(Move    , MOVE    , "MOVE"  )
+  BUILTIN_DEF(CMove   , CMOVE   , "CMOVE" )
+  BUILTIN_DEF(CMoveUp , CMOVE_UP, "CMOVE>")
+  BUILTIN_DEF(Fill    , FILL    , "FILL"  )
+  BUILTIN_DEF(Erase   , ERASE   , "ERASE" )
+
+  // Floating point
+  BUILTIN_DEF(FPlus  , FPLUS  , "F+"   )
+  BUILTIN_DEF(FMinus , FMINUS , "F-"   )
+  BUILTIN_DEF(FTimes , FTIMES , "F*"   )
+  BUILTIN_DEF(FDivide, FDIVIDE, "F/"   )
+  BUILTIN_DEF(FFetch , FFETCH , "F@"   )
+  BUILTIN_DEF(FStore , FSTORE , "F!"   )
+  BUILTIN_DEF(FDup   , FDUP   , "FDUP" )
+  BUILTIN_DEF(FDrop  , FDROP  , "FDROP")
+  BUILTIN_DEF(FSwap  , FSWAP  , "FSWAP")
+  BUILTIN_DEF(FSqrt  , FSQRT  , "FSQRT")
+  BUILTIN_DEF(FLess  , FLESS  , "F<"   )
+  BUILTIN_DEF(SToF   , STOF   , "S>F"  )
+  BUILTIN_DEF(FToS   , FTOS   , "F>S"  )
+  BUILTIN_DEF(FPrint , FPRINT , "F."   )
 
   // Control structures
   MOD_BUILTIN_DEF (Do    , DO    , "DO"    , DoTokens, tokens_, DO_BLOCK)
@@ -1092,7 +1544,9 @@ namespace CForth {
   BUILTIN_DEF(PStack , PSTACK , "PSTACK")
 
   // Mass storgate input/output
-  MOD_BUILTIN_DEF(Load, LOAD, "LOAD", std::string, filename_, NO_DEF)
+  MOD_BUILTIN_DEF(Load     , LOAD      , "LOAD"      , std::string, filename_, NO_DEF)
+  MOD_BUILTIN_DEF(SaveImage, SAVE_IMAGE, "SAVE-IMAGE", std::string, filename_, NO_DEF)
+  MOD_BUILTIN_DEF(LoadImage, LOAD_IMAGE, "LOAD-IMAGE", std::string, filename_, NO_DEF)
 
   // Defining Words
   BUILTIN_DEF    (Define  , DEFINE  , ":"       )
@@ -1112,18 +1566,132 @@ namespace CForth {
   BUILTIN_DEF    (Abort  , ABORT  , "ABORT")
   BUILTIN_DEF    (Quit   , QUIT   , "QUIT" )
   BUILTIN_DEF    (Debug  , DEBUG  , "DEBUG")
+  BUILTIN_DEF    (Effect , EFFECT , "EFFECT")
 
   //------
 
+  // interpreter instance (stacks, dictionary, memory, input, settings and last
+  // error). The free functions below work on the instance current on the calling
+  // thread, a shared default until another is made current, so separate instances
+  // can run on separate threads.
+  class Interpreter {
+   public:
+    struct Impl;
+
+    // frozen instance state shared read only by instances layered on it
+    typedef std::shared_ptr<const Impl> BaseP;
+
+    Interpreter();
+   ~Interpreter();
+
+    // new instance sharing the definitions of a frozen base. Own definitions
+    // hide base ones and the base data space is copied so base variables can
+    // be modified privately.
+    explicit Interpreter(const BaseP &base);
+
+    Interpreter(const Interpreter &) = delete;
+    Interpreter &operator=(const Interpreter &) = delete;
+
+    // make instance current on calling thread (nullptr selects default instance)
+    static void setCurrent(Interpreter *interp);
+
+    // make instance current and run
+    State init();
+
+    State parseFile(const char *filename);
+    State parseLine(const Line &line);
+
+    State loadFile(const char *filename);
+
+    State loadImage(const char *filename);
+
+    // make instance current and freeze its definitions into a base shareable
+    // with other instances (on any thread). Instance continues layered on it.
+    BaseP freeze();
+
+   private:
+    std::unique_ptr<Impl> impl_;
+  };
+
+  //------
+
+  // stream for printed output (default std::cout)
+  void setOutput(std::ostream &os);
+  std::ostream &output();
+
   void setDebug(bool debug=true);
 
+#ifdef CFORTH_TRACE
   bool isDebug();
+#else
+  // tracing is only compiled into the trace build (-DCFORTH_TRACE) so debug
+  // checks fold away in the default build
+  constexpr bool isDebug() { return false; }
+#endif
+
+  // builtin dispatch used by code compiled after mode is set
+  enum DispatchMode {
+    VIRTUAL_DISPATCH,
+    SWITCH_DISPATCH
+  };
+
+  void setDispatchMode(DispatchMode mode);
+
+  DispatchMode dispatchMode();
+
+  // procedures called this many times are compiled to native code (0 disables,
+  // the default)
+  void setJitThreshold(int n);
+  int  jitThreshold();
+
+  bool isJitSupported();
+
+  // fold constants and remove redundant instructions in code compiled after set
+  void setOptimize(bool b);
+  bool optimize();
+
+  // fuse common instruction pairs in code compiled after set
+  void setSuperInstructions(bool b);
+  bool superInstructions();
+
+  // keep top of stack in interpreter locals (instructions not compiled to native code)
+  void setStackCache(bool b);
+  bool stackCache();
+
+  // declared stack effect of word (false if not known)
+  bool tokenEffect(Token *token, StackEffect &effect);
+
+#ifdef CFORTH_TRACE
+  // count executed instructions and adjacent pairs (used to choose superinstructions)
+  void setProfile(bool profile=true);
+  bool isProfile();
+
+  void printProfile(std::ostream &os, int numPairs=20);
+#else
+  constexpr bool isProfile() { return false; }
+#endif
 
   State init();
 
   State parseFile(const char *filename);
   State parseLine(const Line &line);
 
+  // directory of cached LOAD results (empty disables)
+  void setLoadCache(const std::string &dir);
+  const std::string &loadCache();
+
+  // parse file (as LOAD), reusing its cached result when the file, the files it
+  // loads and all input read before it are unchanged
+  State loadFile(const char *filename);
+
+  // write definitions and data space to binary image file (same build only, and same
+  // base if on shared base)
+  State saveImage(const char *filename);
+
+  // replace definitions and data space with those of image file (only own definitions
+  // if image was saved on shared base)
+  State loadImage(const char *filename);
+
   State parseTokens();
   State parseToken(TokenP &token);
 
@@ -1137,22 +1705,37 @@ namespace CForth {
   State readNumberToken(std::string &word, NumberTokenP &number);
   State readNumberToken(Line &line, NumberTokenP &number);
 
+  bool lookupWord(const std::string &name, TokenP &token);
+
   bool lookupBuiltin(const std::string &str, BuiltinP &builtin);
 
   template<typename T>
   void defBuiltin() {
-    addBuiltin(std::make_shared<T>());
+    addBuiltin(makeRef<T>());
   }
 
   void addBuiltin(const BuiltinP &builtin);
 
+  void pushCell(const Cell &cell);
+
   void pushToken(const TokenP &token);
   void pushDupToken(const TokenP &token);
 
   void pushBoolean(bool b);
-  void pushInteger(int n);
+  void pushInteger(Integer n);
+  void pushDouble(DInteger d);
   void pushNumber(const Number &n);
 
+  State peekCell(Cell &cell);
+  State peekCell(Integer n, Cell &cell);
+
+  State popCell (Cell &cell);
+  State popCells(Cell &cell1, Cell &cell2);
+
+  void  pushFloat(double r);
+  State popFloat (double &r);
+  State popFloats(double &r1, double &r2);
+
   State peekToken(TokenP &token);
   State peekToken(int n, TokenP &token);
 
@@ -1166,44 +1749,64 @@ namespace CForth {
   State popNumber (Number &n);
   State popNumbers(Number &n1, Number &n2);
   State popNumbers(Number &n1, Number &n2, Number &n3);
+  State popDouble (DInteger &d);
 
   State popBoolOrNumber (Number &n);
   State popBoolOrNumbers(Number &n1, Number &n2);
 
-  State popVarBase (VarBaseP &var);
-  State popVarRef  (VarBaseP &var);
-  State popVariable(VariableP &var);
+  State popAddress(int &addr);
 
   State popProcedure(ProcedureP &var);
 
   void clearTokens();
   void clearRetTokens();
+  void clearFloats();
   void clearExecTokens();
 
   State execToken(const TokenP &token);
 
+  // runtime support for translated code
+  State execVariable(Variable *var);
+  State setDoesFunction(CodeFn fn);
+
+  State loopStart(bool &up);
+  State loopTest (bool up, bool &done);
+  State loopNext ();
+  State loopNextBy();
+  State loopEnd  ();
+
   State cmpOp (int &cmp);
   State ucmpOp(int &cmp);
 
-  VariableP defineVariable(const std::string &name, int i);
+  VariableP defineVariable(const std::string &name, Integer i);
   VariableP defineVariable(const std::string &name, TokenP token);
+  VariableP defineVariable(const std::string &name, const Cell &cell);
   VariableP defineVariable(const std::string &name);
+  VariableP defineConstant(const std::string &name, const Cell &cell);
   bool      forgetVariable(const std::string &name);
   bool      lookupVariable(const std::string &name, VariableP &var);
 
   ProcedureP defineProcedure(const std::string &name, const TokenArray &tokens);
+
+  // define word as token (any kind)
+  void defineToken(const std::string &name, const TokenP &token);
+
+  // all word definitions (oldest first for each name)
+  void definitions(TokenArray &tokens);
   bool       forgetProcedure(const std::string &name);
   bool       lookupProcedure(const std::string &name, ProcedureP &proc);
 
+  Memory &memory();
+
   void addBlockToken(TokenArray &tokens, const TokenP &token);
 
   int getBase();
 
   bool isBaseChar(int c, int base, int *value);
 
-  State toBaseInteger(const std::string &str, int base, long *integer);
+  State toBaseInteger(const std::string &str, int base, Integer *integer);
 
-  std::string toBaseString(int base, int integer);
+  std::string toBaseString(int base, Integer integer);
 
   std::string toUpper(const std::string &str);
 }
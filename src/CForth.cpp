@@ -1,9 +1,19 @@
 #include <CForth.h>
 #include <termios.h>
 #include <climits>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include <map>
+#if defined(__x86_64__) && defined(__linux__)
+#define CFORTH_JIT
+#endif
 
 namespace CForth {
 
@@ -14,1322 +24,6494 @@ enum ParseState {
   COMPILE_STATE
 };
 
-typedef std::vector<VariableP>           Variables;
-typedef std::vector<ProcedureP>          Procedures;
-typedef std::vector<ParseState>          ParseStateStack;
-typedef std::vector<Line>                Lines;
-typedef std::map<std::string,TokenP>     NameTokenMap;
-typedef std::map<std::string,Variables>  NameVariablesMap;
-typedef std::map<std::string,Procedures> NameProceduresMap;
-typedef std::map<std::string,BuiltinP>   NameBuiltinMap;
+typedef std::vector<VariableP>  Variables;
+typedef std::vector<ParseState> ParseStateStack;
+typedef std::vector<Line>       Lines;
 
-State State::lastError_ = State(false, "Unknown Error");
+// FNV-1a (input fingerprint and load cache keys)
+static const uint64_t hashInit = 14695981039346656037ull;
+
+static inline uint64_t
+hashBytes(uint64_t h, const char *data, size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    h ^= uint64_t(static_cast<unsigned char>(data[i]));
+    h *= 1099511628211ull;
+  }
 
-bool debug_       = false;
-bool ignore_base_ = false;
+  return h;
+}
 
-struct IgnoreBase {
-  IgnoreBase() { ignore_base_ = true ; }
- ~IgnoreBase() { ignore_base_ = false; }
+static inline uint64_t
+hashValue(uint64_t h, uint64_t value)
+{
+  return hashBytes(h, reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// file read by a load being recorded for the load cache
+struct LoadDep {
+  std::string filename;
+  uint64_t    hash;
 };
 
-File              file_;
-Lines             lines_;
-Line              line_;
-TokenArray        tokens_;
-TokenArray        execTokens_;
-TokenArray        retTokens_;
-NameVariablesMap  variables_;
-NameProceduresMap procedures_;
-NameBuiltinMap    builtins_;
-VariableP         currentVar_;
-VariableP         wordVar_;
-
-ParseState      parseState_ = INTERP_STATE;
-ParseStateStack parseStateStack_;
+typedef std::vector<LoadDep> LoadDeps;
 
-struct SetParseState {
-  SetParseState(ParseState state) {
-    parseStateStack_.push_back(parseState_);
+// definition or removal of a word by a load being recorded
+struct LoadOp {
+  enum Type {
+    DEFINE,
+    FORGET_VARIABLE,
+    FORGET_PROCEDURE
+  };
 
-    parseState_ = state;
-  }
+  Type        type;
+  std::string name;
+  TokenP      token; // defined token
+};
 
- ~SetParseState() {
-    parseState_ = parseStateStack_.back();
+typedef std::vector<LoadOp> LoadOps;
 
-    parseStateStack_.pop_back();
-  }
+// files read, whether result depends on anything else, and the words defined and
+// removed in order (see loadFile)
+struct LoadRecord {
+  LoadDeps                deps;
+  bool                    impure { false };
+  LoadOps                 ops;
+  std::set<const Token *> tokens; // tokens defined by load
 };
 
-int
-getch()
-{
-  struct termios oldt;
+// dictionary of words (variables, procedures and builtins) keyed by case folded name.
+// Open addressing hash table where each slot holds all definitions of its name (newest
+// last) so a word lookup is a single probe sequence with no allocation.
+// An optional (frozen) base dictionary is searched after own definitions.
+class Dictionary {
+ public:
+  Dictionary() {
+    slots_.resize(256);
+  }
 
-  tcgetattr(STDIN_FILENO, &oldt); /*store old settings */
+  void setBase(const Dictionary *base) { base_ = base; }
 
-  struct termios newt = oldt; /* copy old settings to new settings */
+  const Dictionary *base() const { return base_; }
 
-  newt.c_lflag &= ~(ICANON | ECHO); /* make one change to old settings in new settings */
+  void define(const std::string &name, const TokenP &token) {
+    slot(name, /*create*/true)->tokens.push_back(token);
+  }
 
-  tcsetattr(STDIN_FILENO, TCSANOW, &newt); /*apply the new settings immediatly */
+  // newest definition of name (any kind)
+  bool lookup(const std::string &name, TokenP &token) const {
+    const Slot *s = slot(name);
 
-  int ch = getchar(); /* standard getchar call */
+    if (! s || s->tokens.empty())
+      return (base_ && base_->lookup(name, token));
 
-  tcsetattr(STDIN_FILENO, TCSANOW, &oldt); /*reapply the old settings */
+    token = s->tokens.back();
 
-  return ch; /*return received char */
-}
+    return true;
+  }
 
-void
-setDebug(bool debug)
-{
-  debug_ = debug;
-}
+  // newest definition of name of specified kind
+  bool lookup(const std::string &name, Token::TokenType type, TokenP &token) const {
+    const Slot *s = slot(name);
 
-bool
-isDebug()
-{
-  return debug_;
-}
+    if (s) {
+      for (auto p = s->tokens.rbegin(); p != s->tokens.rend(); ++p) {
+        if ((*p)->type() == type) {
+          token = *p;
+          return true;
+        }
+      }
+    }
 
-State
-init()
-{
-  VariableP var = defineVariable("BASE", 10);
+    return (base_ && base_->lookup(name, type, token));
+  }
 
-  //----
+  // position of token in definitions of name (base first, oldest first)
+  bool definitionIndex(const std::string &name, const Token *token, int &index) const {
+    if (base_ && base_->definitionIndex(name, token, index))
+      return true;
 
-  const char *env = getenv("HOME");
+    const Slot *s = slot(name);
 
-  if (! env)
-    return State::success();
+    if (! s) return false;
 
-  std::string filename = std::string(env) + "/.CForth";
+    for (size_t i = 0; i < s->tokens.size(); ++i) {
+      if (s->tokens[i].get() == token) {
+        index = numDefinitions(name, /*own*/false) + int(i);
+        return true;
+      }
+    }
 
-  File file(filename.c_str());
+    return false;
+  }
 
-  if (! file.open())
-    return State::success();
+  // definition of name at position (see definitionIndex)
+  bool definitionAt(const std::string &name, int index, TokenP &token) const {
+    int numBase = numDefinitions(name, /*own*/false);
 
-  Line line;
+    if (index < numBase)
+      return (index >= 0 && base_->definitionAt(name, index, token));
 
-  while (file.readLine(line)) {
-    if (! parseLine(line))
-      return State::lastError();
-  }
+    const Slot *s = slot(name);
 
-  return State::success();
-}
+    if (! s || index - numBase >= int(s->tokens.size()))
+      return false;
 
-State
-parseFile(const char *filename)
-{
-  file_ = File(filename);
+    token = s->tokens[index - numBase];
 
-  if (! file_.open())
-    return State::lastError();
+    return true;
+  }
 
-  try {
-    if (! parseTokens())
-      return State::lastError();
+  // all definitions (base first, oldest first for each name)
+  void definitions(TokenArray &tokens, bool withBase=true) const {
+    if (base_ && withBase)
+      base_->definitions(tokens);
+
+    for (const auto &s : slots_)
+      for (const auto &token : s.tokens)
+        tokens.push_back(token);
   }
-  catch (...) {
+
+  typedef std::vector<std::pair<std::string, TokenP>> NamedTokens;
+
+  // all definitions with (upper case) name in same order as definitions()
+  void namedDefinitions(NamedTokens &namedTokens, bool withBase=true) const {
+    if (base_ && withBase)
+      base_->namedDefinitions(namedTokens);
+
+    for (const auto &s : slots_)
+      for (const auto &token : s.tokens)
+        namedTokens.push_back(std::make_pair(s.name, token));
   }
 
-  if (isDebug() && ! tokens_.empty()) {
-    IgnoreBase ib;
+  // number of definitions of name (including base or in base only)
+  int numDefinitions(const std::string &name, bool own=true) const {
+    int n = (base_ ? base_->numDefinitions(name) : 0);
 
-    for (auto token : tokens_) {
-      token->print(std::cout);
+    if (own) {
+      const Slot *s = slot(name);
 
-      std::cout << " ";
+      if (s) n += int(s->tokens.size());
     }
 
-    std::cout << std::endl;
+    return n;
   }
 
-  std::cout << "ok" << std::endl;
+  // remove newest own definition of name of specified kind
+  bool forget(const std::string &name, Token::TokenType type, TokenP &token) {
+    Slot *s = slot(name);
 
-  file_.close();
+    if (! s) return false;
 
-  return State::success();
-}
+    for (auto p = s->tokens.rbegin(); p != s->tokens.rend(); ++p) {
+      if ((*p)->type() == type) {
+        token = *p;
 
-State
-parseLine(const Line &line)
-{
-  lines_.push_back(line);
+        s->tokens.erase(std::next(p).base());
 
-  try {
-    if (! parseTokens())
-      return State::lastError();
-  }
-  catch (...) {
+        return true;
+      }
+    }
+
+    return false;
   }
 
-  if (isDebug() && ! tokens_.empty()) {
-    IgnoreBase ib;
+ private:
+  struct Slot {
+    std::string name; // interned upper case name (empty if unused)
+    uint        hash { 0 };
+    TokenArray  tokens;
+  };
+
+  typedef std::vector<Slot> Slots;
+
+  static char foldChar(char c) {
+    return (c >= 'a' && c <= 'z' ? char(c - 'a' + 'A') : c);
+  }
 
-    for (auto token : tokens_) {
-      token->print(std::cout);
+  static uint hashName(const std::string &name) {
+    // FNV-1a of folded chars
+    uint h = 2166136261u;
 
-      std::cout << " ";
+    for (auto c : name) {
+      h ^= uint(static_cast<unsigned char>(foldChar(c)));
+      h *= 16777619u;
     }
 
-    std::cout << std::endl;
+    return h;
   }
 
-  return State::success();
-}
-
-State
-parseTokens()
-{
-  for (;;) {
-    if (! fillBuffer())
-      break;
+  static bool matchName(const std::string &folded, const std::string &name) {
+    auto len = name.size();
 
-    TokenP token;
+    if (folded.size() != len)
+      return false;
 
-    if (! parseToken(token))
-      return State::lastError();
+    for (size_t i = 0; i < len; ++i)
+      if (folded[i] != foldChar(name[i]))
+        return false;
 
-    if (! token.get())
-      break;
+    return true;
+  }
 
-    if (! execToken(token))
-      return State::lastError();
+  const Slot *slot(const std::string &name) const {
+    return const_cast<Dictionary *>(this)->slot(name, false);
   }
 
-  return State::success();
-}
+  Slot *slot(const std::string &name, bool create=false) {
+    if (name.empty()) return nullptr;
 
-State
-parseToken(TokenP &token)
-{
-  Word word;
+    uint h    = hashName(name);
+    uint mask = uint(slots_.size() - 1);
 
-  if (! readWord(word))
-    return State::success();
+    for (uint i = h & mask; ; i = (i + 1) & mask) {
+      Slot &s = slots_[i];
 
-  if (! parseWord(word, token))
-    return State::lastError();
+      if (s.name.empty()) {
+        if (! create) return nullptr;
 
-  return State::success();
-}
+        // grow to keep load factor below 3/4
+        if (4*(numUsed_ + 1) > 3*slots_.size()) {
+          rehash(2*slots_.size());
 
-bool
-fillBuffer()
-{
-  if (line_.isValid())
-    line_.skipSpace();
+          return slot(name, create);
+        }
 
-  if (file_.isValid()) {
-    while (! line_.isValid()) {
-      if (! file_.readLine(line_))
-        return false;
+        s.name.resize(name.size());
+
+        for (size_t j = 0; j < name.size(); ++j)
+          s.name[j] = foldChar(name[j]);
+
+        s.hash = h;
 
-      line_.skipSpace();
+        ++numUsed_;
+
+        return &s;
+      }
+
+      if (s.hash == h && matchName(s.name, name))
+        return &s;
     }
   }
-  else {
-    while (! line_.isValid()) {
-      if (lines_.empty())
-        return false;
 
-      line_ = lines_.back();
+  void rehash(size_t n) {
+    Slots oldSlots;
+
+    std::swap(oldSlots, slots_);
+
+    slots_.resize(n);
+
+    uint mask = uint(n - 1);
 
-      lines_.pop_back();
+    for (auto &s : oldSlots) {
+      if (s.name.empty()) continue;
 
-      line_.skipSpace();
+      uint i = s.hash & mask;
+
+      while (! slots_[i].name.empty())
+        i = (i + 1) & mask;
+
+      slots_[i] = std::move(s);
     }
   }
 
-  return true;
-}
+ private:
+  Slots             slots_;
+  size_t            numUsed_ { 0 };
+  const Dictionary *base_ { nullptr };
+};
 
-State
-parseWord(const Word &word, TokenP &token)
+// interpreter state (see Interpreter)
+struct Interpreter::Impl {
+  Impl() { }
+
+  explicit Impl(const BaseP &base);
+
+  // details of last error (used to build message)
+  State::Code  lastErrorCode_ = State::ERROR;
+  const char  *lastErrorText_ = "Unknown Error";
+  std::string  lastErrorArg_;
+
+  bool debug_       = false;
+  bool ignore_base_ = false;
+
+  DispatchMode dispatchMode_ = SWITCH_DISPATCH;
+
+  // native code is off by default as it is slower than the cached stack paths of
+  // the interpreter (see Code::jit)
+  int jitThreshold_ = 0;
+
+  bool optimize_          = true;
+  bool superInstructions_ = true;
+  bool stackCache_        = true;
+
+#ifdef CFORTH_TRACE
+  bool                        profile_ = false;
+  long                        profileDispatches_ = 0;
+  std::map<std::string, long> profilePairs_;
+#endif
+
+  File              file_;
+  Lines             lines_;
+  Line              line_;
+  CellArray         stack_;
+  TokenArray        execTokens_;
+  CellArray         retStack_;
+  FloatArray        fstack_;
+  Dictionary        dictionary_;
+  bool              builtinsDefined_ = false;
+  Variables         forgotten_;
+  TokenArray        replaced_;
+  Variable         *currentVar_ = nullptr;
+  Variable         *baseVar_    = nullptr;
+  Memory            memory_;
+
+  ParseState      parseState_ = INTERP_STATE;
+  ParseStateStack parseStateStack_;
+  int             parseDepth_ = 0; // nesting of parseTokens (LOAD from running word)
+
+  std::ostream *os_ = &std::cout;
+
+  // load cache directory, fingerprint of all input read so far (determines state
+  // for load cache) and load being recorded
+  std::string  loadCacheDir_;
+  uint64_t     sourceHash_ = hashInit;
+  LoadRecord  *loadRecord_ = nullptr;
+
+  // frozen state shared with other instances (kept alive for dictionary base)
+  BaseP base_;
+};
+
+// layer on base: settings are copied, definitions and data space pages shared
+Interpreter::Impl::
+Impl(const BaseP &base) :
+ debug_(base->debug_), dispatchMode_(base->dispatchMode_),
+ jitThreshold_(base->jitThreshold_), optimize_(base->optimize_),
+ superInstructions_(base->superInstructions_), stackCache_(base->stackCache_),
+ builtinsDefined_(true), baseVar_(base->baseVar_), memory_(base->memory_),
+ os_(base->os_), loadCacheDir_(base->loadCacheDir_), sourceHash_(base->sourceHash_),
+ base_(base)
 {
-  std::string str = word.value();
+#ifdef CFORTH_TRACE
+  profile_ = base->profile_;
+#endif
 
-  VariableP    var;
-  ProcedureP   proc;
-  BuiltinP     builtin;
-  NumberTokenP number;
+  dictionary_.setBase(&base->dictionary_);
+}
 
-  if      (lookupVariable(str, var))
-    token = (var->isConstant() ? var->value() : var);
-  else if (lookupProcedure(str, proc))
-    token = proc;
-  else if (lookupBuiltin(str, builtin)) {
-    if (builtin->hasModifier()) {
-      builtin = std::static_pointer_cast<Builtin>(builtin->dup());
+// instance used when none made current
+Interpreter::Impl defaultInterp_;
 
-      if (! builtin->readModifier())
-        return State::lastError();
-    }
+// instance current on this thread (constant initialized so access is a plain load)
+thread_local Interpreter::Impl *interp_ = &defaultInterp_;
+
+struct IgnoreBase {
+  IgnoreBase() { interp_->ignore_base_ = true ; }
+ ~IgnoreBase() { interp_->ignore_base_ = false; }
+};
+
+struct ParseDepth {
+  ParseDepth() { ++interp_->parseDepth_; }
+ ~ParseDepth() { --interp_->parseDepth_; }
+};
+
+struct SetParseState {
+  SetParseState(ParseState state) {
+    interp_->parseStateStack_.push_back(interp_->parseState_);
 
-    token = builtin;
+    interp_->parseState_ = state;
   }
-  else if (readNumberToken(str, number))
-    token = number;
-  else
-    return State::error(str + " ?");
 
-  return State::success();
+ ~SetParseState() {
+    interp_->parseState_ = interp_->parseStateStack_.back();
+
+    interp_->parseStateStack_.pop_back();
+  }
+};
+
+// add input text to fingerprint
+static void
+foldSource(const std::string &str)
+{
+  interp_->sourceHash_ = hashBytes(interp_->sourceHash_, str.data(), str.size());
 }
 
-bool
-readWord(Word &word)
+// note input read from stdin or external effect (image save) for recorded load
+static void
+setLoadImpure()
 {
-  word.reset();
+  if (interp_->loadRecord_)
+    interp_->loadRecord_->impure = true;
+}
 
-  if (! fillBuffer())
-    return false;
+// note word defined by recorded load
+static void
+recordDefine(const std::string &name, const TokenP &token)
+{
+  LoadRecord *record = interp_->loadRecord_;
+
+  if (! record) return;
 
-  return readWord(line_, word);
+  record->ops.push_back(LoadOp { LoadOp::DEFINE, name, token });
+
+  record->tokens.insert(token.get());
 }
 
-bool
-readWord(Line &line, Word &word)
+// note word removed by recorded load. Replay refers to other words as they were
+// before the load, so only removal of words defined by the load can be replayed.
+static void
+recordForget(LoadOp::Type type, const std::string &name, const TokenP &token)
 {
-  word.reset();
+  LoadRecord *record = interp_->loadRecord_;
 
-  std::string str;
+  if (! record) return;
 
-  str += line.getChar();
+  if (record->tokens.count(token.get()))
+    record->ops.push_back(LoadOp { type, name, TokenP() });
+  else
+    record->impure = true;
+}
 
-  while (line.isValid() && ! line.isSpace())
-    str += line.getChar();
+// note change to existing word (DOES> code) by recorded load (only words
+// defined by the load are replayed)
+static void
+recordChange(const Token *token)
+{
+  if (interp_->loadRecord_ && ! interp_->loadRecord_->tokens.count(token))
+    interp_->loadRecord_->impure = true;
+}
 
-  word.setValue(str);
+//----------
 
-  while (line.isValid() && line.isSpace())
-    line.skipChar();
+Interpreter::
+Interpreter() :
+ impl_(new Impl)
+{
+}
 
-  return true;
+Interpreter::
+Interpreter(const BaseP &base) :
+ impl_(new Impl(base))
+{
+}
+
+Interpreter::
+~Interpreter()
+{
+  // calling thread falls back to default instance
+  if (interp_ == impl_.get())
+    interp_ = &defaultInterp_;
+}
+
+void
+Interpreter::
+setCurrent(Interpreter *interp)
+{
+  interp_ = (interp ? interp->impl_.get() : &defaultInterp_);
 }
 
 State
-readNumberToken(std::string &word, NumberTokenP &token)
+Interpreter::
+init()
 {
-  Line line(word);
+  setCurrent(this);
 
-  return readNumberToken(line, token);
+  return CForth::init();
 }
 
 State
-readNumberToken(Line &line, NumberTokenP &token)
+Interpreter::
+parseFile(const char *filename)
 {
-  int pos = line.pos();
+  setCurrent(this);
 
-  int base = getBase();
+  return CForth::parseFile(filename);
+}
 
-  std::string str;
+State
+Interpreter::
+parseLine(const Line &line)
+{
+  setCurrent(this);
 
-  int sign = 1;
+  return CForth::parseLine(line);
+}
 
-  if (line.isOneOf("+-"))
-    sign = (line.getChar() == '-' ? -1 : 1);
+State
+Interpreter::
+loadFile(const char *filename)
+{
+  setCurrent(this);
 
-  if (! line.isBaseChar(base)) {
-    line.setPos(pos);
-    return State::error("Not a number");
-  }
+  return CForth::loadFile(filename);
+}
 
-  while (line.isValid() && line.isBaseChar(base))
-    str += line.getChar();
+State
+Interpreter::
+loadImage(const char *filename)
+{
+  setCurrent(this);
 
-  bool real = false;
+  return CForth::loadImage(filename);
+}
 
-  if (line.isValid() && line.isChar('.')) {
-    real = true;
+Interpreter::BaseP
+Interpreter::
+freeze()
+{
+  setCurrent(this);
 
-    str += line.getChar();
+  TokenArray tokens;
 
-    while (line.isValid() && line.isBaseChar(base))
-      str += line.getChar();
-  }
+  CForth::definitions(tokens);
 
-  if (line.isValid() && line.isOneOf("Ee")) {
-    char c = line.lookNextChar();
+  for (const auto &token : tokens)
+    token->freeze();
 
-    if (isBaseChar(c, base)) {
-      real = true;
+  for (const auto &var : impl_->forgotten_)
+    var->freeze();
 
-      str += line.getChar();
+  // tokens stored in data space (copied to each instance)
+  const Memory &memory = impl_->memory_;
 
-      while (line.isValid() && line.isBaseChar(base))
-        str += line.getChar();
-    }
+  for (int addr = 1; addr < memory.here(); ++addr) {
+    Cell cell = memory.get(addr);
+
+    if (cell.isToken())
+      cell.token()->freeze();
   }
 
-  if (line.isValid() && ! line.isSpace()) {
-    line.setPos(pos);
-    return State::error("Not a number");
-  }
+  BaseP base(std::move(impl_));
 
-  if (! real) {
-    long il;
+  impl_.reset(new Impl(base));
 
-    if (! toBaseInteger(str, base, &il)) {
-      line.setPos(pos);
-      return State::lastError();
-    }
+  setCurrent(this);
 
-    token = NumberToken::makeInteger(int(sign*il));
-  }
-  else {
-    double r = atof(str.c_str());
+  return base;
+}
 
-    token = NumberToken::makeReal(sign*r);
-  }
+int
+getch()
+{
+  struct termios oldt;
 
-  return State::success();
+  tcgetattr(STDIN_FILENO, &oldt); /*store old settings */
+
+  struct termios newt = oldt; /* copy old settings to new settings */
+
+  newt.c_lflag &= ~(ICANON | ECHO); /* make one change to old settings in new settings */
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &newt); /*apply the new settings immediatly */
+
+  int ch = getchar(); /* standard getchar call */
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &oldt); /*reapply the old settings */
+
+  return ch; /*return received char */
 }
 
-bool
-lookupBuiltin(const std::string &str, BuiltinP &builtin)
+void
+setOutput(std::ostream &os)
 {
-  if (builtins_.empty()) {
-    // Stack manipulation
-    defBuiltin<DupBuiltin    >();
-    defBuiltin<DropBuiltin   >();
-    defBuiltin<SwapBuiltin   >();
-    defBuiltin<OverBuiltin   >();
-    defBuiltin<RotBuiltin    >();
-    defBuiltin<PickBuiltin   >();
-    defBuiltin<RollBuiltin   >();
-    defBuiltin<QDupBuiltin   >();
-    defBuiltin<DepthBuiltin  >();
-    defBuiltin<PopRetBuiltin >();
-    defBuiltin<PushRetBuiltin>();
-    defBuiltin<CopyRetBuiltin>();
+  interp_->os_ = &os;
+}
 
-    // Comparison
-    defBuiltin<LessBuiltin   >();
-    defBuiltin<EqualBuiltin  >();
-    defBuiltin<GreaterBuiltin>();
-    // D<
-    defBuiltin<ULessBuiltin  >();
-    defBuiltin<NotBuiltin    >();
+std::ostream &
+output()
+{
+  return *interp_->os_;
+}
 
-    // Arithmetic and Logical
-    defBuiltin<PlusBuiltin  >();
-    defBuiltin<MinusBuiltin >();
-    defBuiltin<TimesBuiltin >();
-    defBuiltin<DivideBuiltin>();
-    defBuiltin<ModBuiltin   >();
-    defBuiltin<DModBuiltin  >();
-    defBuiltin<Plus1Builtin >();
-    // 1-
-    defBuiltin<Plus2Builtin >();
-    // 2-
-    // D+
-    defBuiltin<MulDivBuiltin>();
-    // */MOD
-    // U*
-    // U/MOD
-    defBuiltin<MaxBuiltin   >();
-    defBuiltin<MinBuiltin   >();
-    defBuiltin<AbsBuiltin   >();
-    defBuiltin<NegateBuiltin>();
-    // DNEGATE
-    defBuiltin<AndBuiltin>();
-    defBuiltin<OrBuiltin >();
-    defBuiltin<XorBuiltin>();
+void
+setDebug(bool debug)
+{
+  interp_->debug_ = debug;
+}
 
-    // Memory
-    defBuiltin<FetchBuiltin   >();
-    defBuiltin<StoreBuiltin   >();
-    // C@
-    // C!
-    defBuiltin<PFetchBuiltin  >();
-    defBuiltin<AddStoreBuiltin>();
-    defBuiltin<MoveBuiltin    >();
-    // CMOVE
-    defBuiltin<FillBuiltin>();
+#ifdef CFORTH_TRACE
+bool
+isDebug()
+{
+  return interp_->debug_;
+}
+#endif
 
-    // Control structures
-    defBuiltin<DoBuiltin    >();
-    defBuiltin<LoopBuiltin  >();
-    defBuiltin<ILoopBuiltin >();
-    defBuiltin<IBuiltin     >();
-    defBuiltin<JBuiltin     >();
-    defBuiltin<LeaveBuiltin >();
-    defBuiltin<IfBuiltin    >();
-    defBuiltin<ElseBuiltin  >();
-    defBuiltin<ThenBuiltin  >();
-    defBuiltin<BeginBuiltin >();
-    defBuiltin<UntilBuiltin >();
-    defBuiltin<WhileBuiltin >();
-    defBuiltin<RepeatBuiltin>();
-    // EXIT
-    // EXECUTE
+void
+setDispatchMode(DispatchMode mode)
+{
+  interp_->dispatchMode_ = mode;
+}
 
-    // Input/Output
-    defBuiltin<EmitBuiltin    >();
-    defBuiltin<PrintToBuiltin >();
-    defBuiltin<TypeBuiltin    >();
-    defBuiltin<CountBuiltin   >();
-    defBuiltin<TrailingBuiltin>();
-    defBuiltin<KeyBuiltin     >();
-    defBuiltin<ExpectBuiltin  >();
-    defBuiltin<QueryBuiltin   >();
-    defBuiltin<WordBuiltin    >();
+DispatchMode
+dispatchMode()
+{
+  return interp_->dispatchMode_;
+}
 
-    // Number Input/Output
-    defBuiltin<DecimalBuiltin>();
-    defBuiltin<PrintBuiltin  >();
-    defBuiltin<PStackBuiltin >();
-    // U.
-    // CONVERT
-    // <#
+void
+setJitThreshold(int n)
+{
+  interp_->jitThreshold_ = n;
+}
 
-    // Mass storgate input/output
-    // LIST
-    defBuiltin<LoadBuiltin>();
-    // SCR
-    // BLOCK
-    // UPDATE
-    // BUFFER
-    // SAVE-BUFFERS
-    // EMPTY-BUFFERS
+int
+jitThreshold()
+{
+  return interp_->jitThreshold_;
+}
 
-    // Defining Words
-    defBuiltin<DefineBuiltin>  ();
-    defBuiltin<VariableBuiltin>();
-    defBuiltin<ConstantBuiltin>();
-    // VOCABULARY
-    defBuiltin<CreateBuiltin>();
-    defBuiltin<CommaBuiltin >();
-    defBuiltin<DoesBuiltin  >();
-    // CONTEXT
-    // CURRENT
-    // FORTH
-    // DEFINITIONS
-    // '
-    // FIND
-    defBuiltin<ForgetBuiltin>();
+bool
+isJitSupported()
+{
+#ifdef CFORTH_JIT
+  return true;
+#else
+  return false;
+#endif
+}
 
-    // Compiler
-    defBuiltin<AllotBuiltin>();
-    // IMMEDIATE
-    // LITERAL
-    // STATE
-    // [
-    // ]
-    // COMPILE
-    // [COMPILE]
+void
+setOptimize(bool b)
+{
+  interp_->optimize_ = b;
+}
 
-    // Misc
-    defBuiltin<CommentBuiltin>();
-    defBuiltin<HereBuiltin   >();
-    // PAD
-    // >IN
-    // BLk
-    defBuiltin<AbortBuiltin>();
-    defBuiltin<QuitBuiltin >();
-    defBuiltin<DebugBuiltin>();
-  }
+bool
+optimize()
+{
+  return interp_->optimize_;
+}
 
-  auto p = builtins_.find(toUpper(str));
+void
+setSuperInstructions(bool b)
+{
+  interp_->superInstructions_ = b;
+}
 
-  if (p == builtins_.end())
-    return false;
+bool
+superInstructions()
+{
+  return interp_->superInstructions_;
+}
 
-  builtin = (*p).second;
+void
+setStackCache(bool b)
+{
+  interp_->stackCache_ = b;
+}
 
-  return true;
+bool
+stackCache()
+{
+  return interp_->stackCache_;
 }
 
+#ifdef CFORTH_TRACE
 void
-addBuiltin(const BuiltinP &builtin)
+setProfile(bool profile)
+{
+  interp_->profile_ = profile;
+}
+
+bool
+isProfile()
 {
-  builtins_[builtin->name()] = builtin;
+  return interp_->profile_;
 }
 
 void
-pushToken(const TokenP &token)
+printProfile(std::ostream &os, int numPairs)
 {
-  if (isDebug()) {
-    IgnoreBase ib;
+  os << "Dispatches: " << interp_->profileDispatches_ << std::endl;
+
+  std::vector<std::pair<long, std::string>> pairs;
+
+  for (const auto &pair : interp_->profilePairs_)
+    pairs.emplace_back(pair.second, pair.first);
+
+  std::sort(pairs.rbegin(), pairs.rend());
+
+  int n = std::min(numPairs, int(pairs.size()));
+
+  for (int i = 0; i < n; ++i)
+    os << std::setw(10) << pairs[i].first << "  " << pairs[i].second << std::endl;
+}
+#endif
+
+State
+init()
+{
+  interp_->baseVar_ = defineVariable("BASE", 10).get();
+
+  //----
+
+  const char *env = getenv("HOME");
+
+  if (! env)
+    return State::success();
+
+  std::string filename = std::string(env) + "/.CForth";
+
+  File file(filename.c_str());
+
+  if (! file.open())
+    return State::success();
+
+  Line line;
 
-    std::cout << "Push: ";
-    token->print(std::cout);
-    std::cout << std::endl;
+  while (file.readLine(line)) {
+    if (! parseLine(line))
+      return State::lastError();
   }
 
-  tokens_.push_back(token);
+  return State::success();
 }
 
-void
-pushDupToken(const TokenP &token)
+State
+parseFile(const char *filename)
+{
+  // file loaded from another file or line resumes it when done
+  File outerFile = std::move(interp_->file_);
+  Line outerLine = interp_->line_;
+
+  interp_->file_ = File(filename);
+  interp_->line_ = Line();
+
+  auto restore = [&]() {
+    interp_->file_ = std::move(outerFile);
+    interp_->line_ = outerLine;
+  };
+
+  if (! interp_->file_.open()) {
+    restore();
+
+    return State::lastError();
+  }
+
+  try {
+    if (! parseTokens()) {
+      restore();
+
+      return State::lastError();
+    }
+  }
+  catch (...) {
+  }
+
+  if (isDebug() && ! interp_->stack_.empty()) {
+    IgnoreBase ib;
+
+    for (const auto &cell : interp_->stack_) {
+      cell.print(output());
+
+      output() << " ";
+    }
+
+    output() << std::endl;
+  }
+
+  output() << "ok" << std::endl;
+
+  restore();
+
+  return State::success();
+}
+
+State
+parseLine(const Line &line)
+{
+  foldSource(line.str());
+
+  interp_->lines_.push_back(line);
+
+  try {
+    if (! parseTokens())
+      return State::lastError();
+  }
+  catch (...) {
+  }
+
+  if (isDebug() && ! interp_->stack_.empty()) {
+    IgnoreBase ib;
+
+    for (const auto &cell : interp_->stack_) {
+      cell.print(output());
+
+      output() << " ";
+    }
+
+    output() << std::endl;
+  }
+
+  return State::success();
+}
+
+// release definitions replaced by loaded image when nothing can be running them,
+// except those still referenced from stack cells
+static void
+releaseReplaced()
+{
+  TokenArray &replaced = interp_->replaced_;
+
+  if (replaced.empty())
+    return;
+
+  std::set<const Token *> used;
+
+  for (const auto *stack : { &interp_->stack_, &interp_->retStack_ })
+    for (const auto &cell : *stack)
+      if (cell.isToken())
+        used.insert(cell.token());
+
+  TokenArray keep;
+
+  for (const auto &token : replaced)
+    if (used.count(token.get()))
+      keep.push_back(token);
+
+  replaced.swap(keep);
+}
+
+State
+parseTokens()
+{
+  ParseDepth parseDepth;
+
+  for (;;) {
+    if (! fillBuffer())
+      break;
+
+    TokenP token;
+
+    if (! parseToken(token))
+      return State::lastError();
+
+    if (! token.get())
+      break;
+
+    if (! execToken(token))
+      return State::lastError();
+
+    // no word running at outermost level
+    if (interp_->parseDepth_ == 1)
+      releaseReplaced();
+  }
+
+  return State::success();
+}
+
+State
+parseToken(TokenP &token)
+{
+  Word word;
+
+  if (! readWord(word))
+    return State::success();
+
+  if (! parseWord(word, token))
+    return State::lastError();
+
+  return State::success();
+}
+
+bool
+fillBuffer()
+{
+  if (interp_->line_.isValid())
+    interp_->line_.skipSpace();
+
+  if (interp_->file_.isValid()) {
+    while (! interp_->line_.isValid()) {
+      if (! interp_->file_.readLine(interp_->line_))
+        return false;
+
+      foldSource(interp_->line_.str());
+
+      interp_->line_.skipSpace();
+    }
+  }
+  else {
+    while (! interp_->line_.isValid()) {
+      if (interp_->lines_.empty())
+        return false;
+
+      interp_->line_ = interp_->lines_.back();
+
+      interp_->lines_.pop_back();
+
+      interp_->line_.skipSpace();
+    }
+  }
+
+  return true;
+}
+
+State
+parseWord(const Word &word, TokenP &token)
+{
+  std::string str = word.value();
+
+  TokenP       def;
+  NumberTokenP number;
+
+  if      (lookupWord(str, def)) {
+    if      (def->isVariable()) {
+      VariableP var = Variable::fromToken(def);
+
+      token = (var->isConstant() ? var->value().toToken() : def);
+    }
+    else if (def->isBuiltin()) {
+      BuiltinP builtin = Builtin::fromToken(def);
+
+      if (builtin->hasModifier()) {
+        builtin = refCast<Builtin>(builtin->dup());
+
+        if (! builtin->readModifier())
+          return State::lastError();
+      }
+
+      token = builtin;
+    }
+    else
+      token = def;
+  }
+  else if (readNumberToken(str, number))
+    token = number;
+  else
+    return State::unknownWord(str);
+
+  return State::success();
+}
+
+bool
+readWord(Word &word)
+{
+  word.reset();
+
+  if (! fillBuffer())
+    return false;
+
+  return readWord(interp_->line_, word);
+}
+
+bool
+readWord(Line &line, Word &word)
+{
+  word.reset();
+
+  std::string str;
+
+  str += line.getChar();
+
+  while (line.isValid() && ! line.isSpace())
+    str += line.getChar();
+
+  word.setValue(str);
+
+  while (line.isValid() && line.isSpace())
+    line.skipChar();
+
+  return true;
+}
+
+State
+readNumberToken(std::string &word, NumberTokenP &token)
+{
+  Line line(word);
+
+  return readNumberToken(line, token);
+}
+
+State
+readNumberToken(Line &line, NumberTokenP &token)
+{
+  int pos = line.pos();
+
+  int base = getBase();
+
+  std::string str;
+
+  int sign = 1;
+
+  if (line.isOneOf("+-"))
+    sign = (line.getChar() == '-' ? -1 : 1);
+
+  if (! line.isBaseChar(base)) {
+    line.setPos(pos);
+    return State::error("Not a number");
+  }
+
+  while (line.isValid() && line.isBaseChar(base))
+    str += line.getChar();
+
+  bool real = false;
+
+  if (line.isValid() && line.isChar('.')) {
+    real = true;
+
+    str += line.getChar();
+
+    while (line.isValid() && line.isBaseChar(base))
+      str += line.getChar();
+  }
+
+  if (line.isValid() && line.isOneOf("Ee")) {
+    char c = line.lookNextChar();
+
+    if (isBaseChar(c, base)) {
+      real = true;
+
+      str += line.getChar();
+
+      while (line.isValid() && line.isBaseChar(base))
+        str += line.getChar();
+    }
+  }
+
+  if (line.isValid() && ! line.isSpace()) {
+    line.setPos(pos);
+    return State::error("Not a number");
+  }
+
+  if (! real) {
+    Integer il;
+
+    if (! toBaseInteger(str, base, &il)) {
+      line.setPos(pos);
+      return State::lastError();
+    }
+
+    token = NumberToken::makeInteger(sign*il);
+  }
+  else {
+    double r = atof(str.c_str());
+
+    token = NumberToken::makeReal(sign*r);
+  }
+
+  return State::success();
+}
+
+Dictionary &
+dictionary()
+{
+  // builtins are always the oldest definitions
+  if (! interp_->builtinsDefined_) {
+    interp_->builtinsDefined_ = true;
+
+    // Stack manipulation
+    defBuiltin<DupBuiltin    >();
+    defBuiltin<DropBuiltin   >();
+    defBuiltin<SwapBuiltin   >();
+    defBuiltin<OverBuiltin   >();
+    defBuiltin<RotBuiltin    >();
+    defBuiltin<PickBuiltin   >();
+    defBuiltin<RollBuiltin   >();
+    defBuiltin<QDupBuiltin   >();
+    defBuiltin<DepthBuiltin  >();
+    defBuiltin<PopRetBuiltin >();
+    defBuiltin<PushRetBuiltin>();
+    defBuiltin<CopyRetBuiltin>();
+
+    // Comparison
+    defBuiltin<LessBuiltin   >();
+    defBuiltin<EqualBuiltin  >();
+    defBuiltin<GreaterBuiltin>();
+    // D<
+    defBuiltin<ULessBuiltin  >();
+    defBuiltin<NotBuiltin    >();
+
+    // Arithmetic and Logical
+    defBuiltin<PlusBuiltin  >();
+    defBuiltin<MinusBuiltin >();
+    defBuiltin<TimesBuiltin >();
+    defBuiltin<DivideBuiltin>();
+    defBuiltin<ModBuiltin   >();
+    defBuiltin<DModBuiltin  >();
+    defBuiltin<Plus1Builtin >();
+    // 1-
+    defBuiltin<Plus2Builtin >();
+    // 2-
+    defBuiltin<DPlusBuiltin  >();
+    defBuiltin<MulDivBuiltin >();
+    defBuiltin<MulDModBuiltin>();
+    defBuiltin<UTimesBuiltin >();
+    defBuiltin<UDModBuiltin  >();
+    defBuiltin<MaxBuiltin    >();
+    defBuiltin<MinBuiltin    >();
+    defBuiltin<AbsBuiltin    >();
+    defBuiltin<NegateBuiltin >();
+    defBuiltin<DNegateBuiltin>();
+    defBuiltin<AndBuiltin>();
+    defBuiltin<OrBuiltin >();
+    defBuiltin<XorBuiltin>();
+
+    // Memory
+    defBuiltin<FetchBuiltin   >();
+    defBuiltin<StoreBuiltin   >();
+    // C@
+    // C!
+    defBuiltin<PFetchBuiltin  >();
+    defBuiltin<AddStoreBuiltin>();
+    defBuiltin<MoveBuiltin    >();
+    defBuiltin<CMoveBuiltin   >();
+    defBuiltin<CMoveUpBuiltin >();
+    defBuiltin<FillBuiltin    >();
+    defBuiltin<EraseBuiltin   >();
+
+    // Floating point
+    defBuiltin<FPlusBuiltin  >();
+    defBuiltin<FMinusBuiltin >();
+    defBuiltin<FTimesBuiltin >();
+    defBuiltin<FDivideBuiltin>();
+    defBuiltin<FFetchBuiltin >();
+    defBuiltin<FStoreBuiltin >();
+    defBuiltin<FDupBuiltin   >();
+    defBuiltin<FDropBuiltin  >();
+    defBuiltin<FSwapBuiltin  >();
+    defBuiltin<FSqrtBuiltin  >();
+    defBuiltin<FLessBuiltin  >();
+    defBuiltin<SToFBuiltin   >();
+    defBuiltin<FToSBuiltin   >();
+    defBuiltin<FPrintBuiltin >();
+
+    // Control structures
+    defBuiltin<DoBuiltin    >();
+    // ?DO (DO already skips loop when start and limit are equal)
+    interp_->dictionary_.define("?DO", makeRef<DoBuiltin>());
+    defBuiltin<LoopBuiltin  >();
+    defBuiltin<ILoopBuiltin >();
+    defBuiltin<IBuiltin     >();
+    defBuiltin<JBuiltin     >();
+    defBuiltin<LeaveBuiltin >();
+    defBuiltin<IfBuiltin    >();
+    defBuiltin<ElseBuiltin  >();
+    defBuiltin<ThenBuiltin  >();
+    defBuiltin<BeginBuiltin >();
+    defBuiltin<UntilBuiltin >();
+    defBuiltin<WhileBuiltin >();
+    defBuiltin<RepeatBuiltin>();
+    // EXIT
+    // EXECUTE
+
+    // Input/Output
+    defBuiltin<EmitBuiltin    >();
+    defBuiltin<PrintToBuiltin >();
+    defBuiltin<TypeBuiltin    >();
+    defBuiltin<CountBuiltin   >();
+    defBuiltin<TrailingBuiltin>();
+    defBuiltin<KeyBuiltin     >();
+    defBuiltin<ExpectBuiltin  >();
+    defBuiltin<QueryBuiltin   >();
+    defBuiltin<WordBuiltin    >();
+
+    // Number Input/Output
+    defBuiltin<DecimalBuiltin>();
+    defBuiltin<PrintBuiltin  >();
+    defBuiltin<PStackBuiltin >();
+    // U.
+    // CONVERT
+    // <#
+
+    // Mass storgate input/output
+    // LIST
+    defBuiltin<LoadBuiltin>();
+    defBuiltin<SaveImageBuiltin>();
+    defBuiltin<LoadImageBuiltin>();
+    // SCR
+    // BLOCK
+    // UPDATE
+    // BUFFER
+    // SAVE-BUFFERS
+    // EMPTY-BUFFERS
+
+    // Defining Words
+    defBuiltin<DefineBuiltin>  ();
+    defBuiltin<VariableBuiltin>();
+    defBuiltin<ConstantBuiltin>();
+    // VOCABULARY
+    defBuiltin<CreateBuiltin>();
+    defBuiltin<CommaBuiltin >();
+    defBuiltin<DoesBuiltin  >();
+    // CONTEXT
+    // CURRENT
+    // FORTH
+    // DEFINITIONS
+    // '
+    // FIND
+    defBuiltin<ForgetBuiltin>();
+
+    // Compiler
+    defBuiltin<AllotBuiltin>();
+    // IMMEDIATE
+    // LITERAL
+    // STATE
+    // [
+    // ]
+    // COMPILE
+    // [COMPILE]
+
+    // Misc
+    defBuiltin<CommentBuiltin>();
+    defBuiltin<HereBuiltin   >();
+    // PAD
+    // >IN
+    // BLk
+    defBuiltin<AbortBuiltin>();
+    defBuiltin<QuitBuiltin >();
+    defBuiltin<DebugBuiltin>();
+    defBuiltin<EffectBuiltin>();
+  }
+
+  return interp_->dictionary_;
+}
+
+bool
+lookupWord(const std::string &name, TokenP &token)
+{
+  return dictionary().lookup(name, token);
+}
+
+bool
+lookupBuiltin(const std::string &str, BuiltinP &builtin)
+{
+  TokenP token;
+
+  if (! dictionary().lookup(str, Token::BUILTIN_TOKEN, token))
+    return false;
+
+  builtin = Builtin::fromToken(token);
+
+  return true;
+}
+
+void
+addBuiltin(const BuiltinP &builtin)
+{
+  dictionary().define(builtin->name(), builtin);
+}
+
+void
+pushCell(const Cell &cell)
+{
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Push: ";
+    cell.print(output());
+    output() << std::endl;
+  }
+
+  interp_->stack_.push_back(cell);
+}
+
+void
+pushToken(const TokenP &token)
+{
+  pushCell(Cell::fromToken(token));
+}
+
+void
+pushDupToken(const TokenP &token)
+{
+  // cells are values so no explicit copy needed
+  interp_->stack_.push_back(Cell::fromToken(token));
+}
+
+void
+pushBoolean(bool b)
+{
+  pushCell(Cell::makeBoolean(b));
+}
+
+void
+pushInteger(Integer i)
+{
+  pushCell(Cell::makeInteger(i));
+}
+
+void
+pushDouble(DInteger d)
+{
+  pushCell(Cell::makeInteger(Integer(UInteger(d))));
+  pushCell(Cell::makeInteger(Integer(d >> 64)));
+}
+
+void
+pushNumber(const Number &n)
+{
+  pushCell(Cell::makeNumber(n));
+}
+
+void
+pushFloat(double r)
+{
+  interp_->fstack_.push_back(r);
+}
+
+State
+popFloat(double &r)
+{
+  if (interp_->fstack_.empty())
+    return State::error("FLOAT STACK EMPTY");
+
+  r = interp_->fstack_.back();
+
+  interp_->fstack_.pop_back();
+
+  return State::success();
+}
+
+State
+popFloats(double &r1, double &r2)
+{
+  if (interp_->fstack_.size() < 2)
+    return State::error("FLOAT STACK EMPTY");
+
+  r2 = interp_->fstack_.back(); interp_->fstack_.pop_back();
+  r1 = interp_->fstack_.back(); interp_->fstack_.pop_back();
+
+  return State::success();
+}
+
+State
+peekCell(Cell &cell)
+{
+  if (interp_->stack_.empty())
+    return State::error("STACK EMPTY");
+
+  cell = interp_->stack_.back();
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Peek: ";
+    cell.print(output());
+    output() << std::endl;
+  }
+
+  return State::success();
+}
+
+State
+peekCell(Integer n, Cell &cell)
+{
+  auto nt = interp_->stack_.size();
+
+  if (n <= 0) return State::error("Invalid index");
+
+  if (n > Integer(nt)) return State::error("Stack too small");
+
+  cell = interp_->stack_[nt - n];
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Peek(" << n << ") : ";
+    cell.print(output());
+    output() << std::endl;
+  }
+
+  return State::success();
+}
+
+State
+popCell(Cell &cell)
+{
+  if (interp_->stack_.empty())
+    return State::error("STACK EMPTY");
+
+  cell = interp_->stack_.back();
+
+  interp_->stack_.pop_back();
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Pop: ";
+    cell.print(output());
+    output() << std::endl;
+  }
+
+  return State::success();
+}
+
+State
+popCells(Cell &cell1, Cell &cell2)
+{
+  if (! popCell(cell2)) return State::lastError();
+  if (! popCell(cell1)) return State::lastError();
+
+  return State::success();
+}
+
+State
+peekToken(TokenP &token)
+{
+  Cell cell;
+
+  if (! peekCell(cell)) return State::lastError();
+
+  token = cell.toToken();
+
+  return State::success();
+}
+
+State
+peekToken(int n, TokenP &token)
+{
+  Cell cell;
+
+  if (! peekCell(n, cell)) return State::lastError();
+
+  token = cell.toToken();
+
+  return State::success();
+}
+
+State
+popToken(TokenP &token)
+{
+  Cell cell;
+
+  if (! popCell(cell)) return State::lastError();
+
+  token = cell.toToken();
+
+  return State::success();
+}
+
+State
+popToken(int n, TokenP &token)
+{
+  auto nt = interp_->stack_.size();
+
+  if (n <= 0) return State::error("Invalid index");
+
+  if (n > int(nt)) return State::error("Stack too small");
+
+  Cell cell = interp_->stack_[nt - n];
+
+  interp_->stack_.erase(interp_->stack_.begin() + (nt - n));
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Pop(" << n << ") : ";
+    cell.print(output());
+    output() << std::endl;
+  }
+
+  token = cell.toToken();
+
+  return State::success();
+}
+
+State
+popTokens(TokenP &token1, TokenP &token2)
+{
+  if (! popToken(token2)) return State::lastError();
+  if (! popToken(token1)) return State::lastError();
+
+  return State::success();
+}
+
+State
+popTokens(TokenP &token1, TokenP &token2, TokenP &token3)
+{
+  if (! popToken(token3)) return State::lastError();
+  if (! popToken(token2)) return State::lastError();
+  if (! popToken(token1)) return State::lastError();
+
+  return State::success();
+}
+
+State
+popBoolean(bool &b)
+{
+  Cell cell;
+
+  if (! popCell(cell)) return State::lastError();
+
+  if      (cell.isNumber())
+    b = (cell.integer() != 0);
+  else if (cell.isBoolean())
+    b = cell.boolean();
+  else
+    return State::error("must be integer or boolean");
+
+  return State::success();
+}
+
+State
+popNumber(Number &n)
+{
+  Cell cell;
+
+  if (! popCell(cell)) return State::lastError();
+
+  if (! cell.isNumber() && ! cell.isBoolean())
+    return State::error("must be number");
+
+  n = cell.number();
+
+  return State::success();
+}
+
+State
+popBoolOrNumber(Number &n)
+{
+  Cell cell;
+
+  if (! popCell(cell)) return State::lastError();
+
+  if (! cell.isNumber() && ! cell.isBoolean())
+    return State::error("must be integer or boolean");
+
+  n = cell.number();
+
+  return State::success();
+}
+
+State
+popNumbers(Number &n1, Number &n2)
+{
+  if (! popNumber(n2)) return State::lastError();
+  if (! popNumber(n1)) return State::lastError();
+
+  return State::success();
+}
+
+State
+popBoolOrNumbers(Number &n1, Number &n2)
+{
+  if (! popBoolOrNumber(n2)) return State::lastError();
+  if (! popBoolOrNumber(n1)) return State::lastError();
+
+  return State::success();
+}
+
+State
+popNumbers(Number &n1, Number &n2, Number &n3)
+{
+  if (! popNumber(n3)) return State::lastError();
+  if (! popNumber(n2)) return State::lastError();
+  if (! popNumber(n1)) return State::lastError();
+
+  return State::success();
+}
+
+// double cell integer (low cell pushed first, high cell on top)
+State
+popDouble(DInteger &d)
+{
+  Number lo, hi;
+
+  if (! popNumbers(lo, hi)) return State::lastError();
+
+  if (! lo.isInteger() || ! hi.isInteger()) return State::error("Must be integer");
+
+  d = DInteger((UDInteger(UInteger(hi.integer())) << 64) | UInteger(lo.integer()));
+
+  return State::success();
+}
+
+State
+popAddress(int &addr)
+{
+  Cell cell;
+
+  if (! popCell(cell)) return State::lastError();
+
+  if (! cell.isInteger()) return State::error("must be address");
+
+  if (! interp_->memory_.isValid(cell.integer())) return State::error("invalid address");
+
+  addr = int(cell.integer());
+
+  return State::success();
+}
+
+State
+popProcedure(ProcedureP &var)
+{
+  TokenP token;
+
+  if (! popToken(token)) return State::lastError();
+
+  if (! token->isProcedure()) return State::error("must be procedure");
+
+  var = Procedure::fromToken(token);
+
+  return State::success();
+}
+
+void
+clearTokens()
+{
+  interp_->stack_.clear();
+}
+
+void
+clearRetTokens()
+{
+  interp_->retStack_.clear();
+}
+
+void
+clearFloats()
+{
+  interp_->fstack_.clear();
+}
+
+void
+clearExecTokens()
+{
+  interp_->execTokens_.clear();
+}
+
+State
+execToken(const TokenP &token)
+{
+  if (token->isExecutable()) {
+    if (isDebug()) {
+      IgnoreBase ib;
+
+      output() << "Exec: ";
+      token->print(output());
+      output() << std::endl;
+    }
+
+    if (token->isBlock()) {
+      interp_->execTokens_.push_back(token);
+
+      State state = token->exec();
+
+      interp_->execTokens_.pop_back();
+
+      return state;
+    }
+    else
+      return token->exec();
+  }
+  else {
+    pushCell(Cell::fromToken(token));
+
+    if (token->isVariable()) {
+      interp_->currentVar_ = Variable::fromToken(token).get();
+
+      if (! interp_->currentVar_->execTokens())
+        return State::lastError();
+    }
+
+    return State::success();
+  }
+}
+
+State
+cmpOp(int &cmp)
+{
+  Number n1, n2;
+
+  if (! popNumbers(n1, n2)) return State::lastError();
+
+  // integers compare exactly (difference may overflow), reals by truncated difference
+  if (! n1.isReal() && ! n2.isReal()) {
+    cmp = Number::cmp(n1, n2);
+  }
+  else {
+    Integer d = Number::minus(n1, n2).integer();
+
+    cmp = (d > 0 ? 1 : (d < 0 ? -1 : 0));
+  }
+
+  return State::success();
+}
+
+State
+ucmpOp(int &cmp)
+{
+  Number n1, n2;
+
+  if (! popNumbers(n1, n2)) return State::lastError();
+
+  UInteger i1 = UInteger(n1.integer());
+  UInteger i2 = UInteger(n2.integer());
+
+  if      (i1 > i2) cmp =  1;
+  else if (i1 < i2) cmp = -1;
+  else              cmp =  0;
+
+  return State::success();
+}
+
+VariableP
+defineVariable(const std::string &name, Integer i)
+{
+  return defineVariable(name, Cell::makeInteger(i));
+}
+
+VariableP
+defineVariable(const std::string &name, TokenP token)
+{
+  return defineVariable(name, Cell::fromToken(token));
+}
+
+VariableP
+defineVariable(const std::string &name, const Cell &cell)
+{
+  VariableP var = defineVariable(name);
+
+  interp_->memory_.allot(1);
+
+  var->setValue(cell);
+
+  return var;
+}
+
+VariableP
+defineVariable(const std::string &name)
+{
+  // data field starts at HERE (no space allocated)
+  VariableP var = makeRef<Variable>(name, interp_->memory_.here());
+
+  dictionary().define(name, var);
+
+  recordDefine(name, var);
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Define Var: " << name << std::endl;
+  }
+
+  return var;
+}
+
+VariableP
+defineConstant(const std::string &name, const Cell &cell)
+{
+  VariableP var = makeRef<Variable>(name, 0);
+
+  var->setConstant(cell);
+
+  dictionary().define(name, var);
+
+  recordDefine(name, var);
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Define Const: " << name << std::endl;
+  }
+
+  return var;
+}
+
+bool
+forgetVariable(const std::string &name)
+{
+  TokenP token;
+
+  if (! dictionary().forget(name, Token::VAR_BASE_TOKEN, token))
+    return false;
+
+  recordForget(LoadOp::FORGET_VARIABLE, name, token);
+
+  // keep variable alive as stack cells may still reference it
+  interp_->forgotten_.push_back(Variable::fromToken(token));
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Forget Var: " << name << std::endl;
+  }
+
+  return true;
+}
+
+bool
+lookupVariable(const std::string &name, VariableP &var)
+{
+  TokenP token;
+
+  if (! dictionary().lookup(name, Token::VAR_BASE_TOKEN, token))
+    return false;
+
+  var = Variable::fromToken(token);
+
+  return true;
+}
+
+ProcedureP
+defineProcedure(const std::string &name, const TokenArray &tokens)
+{
+  ProcedureP proc = makeRef<Procedure>(name, tokens);
+
+  dictionary().define(name, proc);
+
+  recordDefine(name, proc);
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Define Procedure ";
+    proc->print(output());
+    output() << std::endl;
+  }
+
+  return proc;
+}
+
+void
+defineToken(const std::string &name, const TokenP &token)
+{
+  dictionary().define(name, token);
+
+  recordDefine(name, token);
+}
+
+void
+definitions(TokenArray &tokens)
+{
+  dictionary().definitions(tokens);
+}
+
+bool
+forgetProcedure(const std::string &name)
+{
+  TokenP token;
+
+  if (! dictionary().forget(name, Token::PROCEDURE_TOKEN, token))
+    return false;
+
+  recordForget(LoadOp::FORGET_PROCEDURE, name, token);
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Forget Procedure" << name << std::endl;
+  }
+
+  return true;
+}
+
+//----------
+
+// cells have same type and value (bitwise for reals)
+static bool
+sameCell(const Cell &c1, const Cell &c2)
+{
+  if (c1.type() != c2.type())
+    return false;
+
+  if      (c1.isReal()) {
+    double r1 = c1.real(), r2 = c2.real();
+
+    return (memcmp(&r1, &r2, sizeof(r1)) == 0);
+  }
+  else if (c1.isToken())
+    return (c1.token() == c2.token());
+  else
+    return (c1.integer() == c2.integer());
+}
+
+//----------
+
+// Image file: header, token records, dictionary, forgotten variables and data space.
+// Each token is written once, after the tokens it references, and referred to by
+// its record index. Values are in native byte order so an image is only valid for
+// the build that wrote it. Code is recompiled from tokens on load.
+// An image saved by an instance on a shared base (see Interpreter::freeze) holds
+// only the instance's own definitions and refers to base words by position, so it
+// can only be loaded on the same base (identified by its fingerprint).
+
+static const char     imageMagic[8] = { 'C', 'F', 'O', 'R', 'T', 'H', 'I', 'M' };
+static const uint32_t imageVersion  = 2;
+
+enum ImageRecord {
+  IMAGE_BOOLEAN,
+  IMAGE_NUMBER,
+  IMAGE_BUILTIN,
+  IMAGE_VARIABLE,
+  IMAGE_PROCEDURE,
+  IMAGE_WORD,      // existing word (load cache entry or base word)
+  IMAGE_FORGOTTEN  // existing forgotten variable (load cache entry or base variable)
+};
+
+// shared base of current instance (null if none or replaced by loaded image)
+static const Interpreter::Impl *
+sharedBase()
+{
+  return (interp_->dictionary_.base() ? interp_->base_.get() : nullptr);
+}
+
+// position of forgotten variable (base ones first)
+static bool
+forgottenIndex(const Token *token, int &index)
+{
+  const Interpreter::Impl *base = sharedBase();
+
+  index = 0;
+
+  for (const auto *impl : { base, static_cast<const Interpreter::Impl *>(interp_) }) {
+    if (! impl) continue;
+
+    for (const auto &var : impl->forgotten_) {
+      if (var.get() == token)
+        return true;
+
+      ++index;
+    }
+  }
+
+  return false;
+}
+
+// forgotten variable at position (see forgottenIndex)
+static bool
+forgottenAt(int index, bool baseOnly, TokenP &token)
+{
+  const Interpreter::Impl *base = sharedBase();
+
+  int numBase = (base ? int(base->forgotten_.size()) : 0);
+
+  if (index < 0 || index >= numBase + (baseOnly ? 0 : int(interp_->forgotten_.size())))
+    return false;
+
+  if (index < numBase)
+    token = base->forgotten_[index];
+  else
+    token = interp_->forgotten_[index - numBase];
+
+  return true;
+}
+
+class ImageWriter {
+ public:
+  // image of current definitions and data space
+  State write(std::string &data);
+
+  // changes made by recorded load: new tokens, words defined and removed, and data
+  // space cells changed from memory before load. Words which existed before the load
+  // are referred to by name and position.
+  State writeLoad(const LoadRecord &record, const Memory &memory, std::string &data);
+
+  template<typename T>
+  static void put(std::string &buffer, const T &value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  static void putString(std::string &buffer, const std::string &str) {
+    put(buffer, uint32_t(str.size()));
+
+    buffer.append(str);
+  }
+
+  static void putIds(std::string &buffer, const std::vector<int64_t> &ids) {
+    put(buffer, uint32_t(ids.size()));
+
+    for (auto id : ids)
+      put(buffer, id);
+  }
+
+ private:
+  bool addToken(Token *token, int64_t &id);
+  bool addWord(Token *token, int64_t &id);
+  bool addTokens(const TokenArray &tokens, std::vector<int64_t> &ids);
+  bool addBuiltin(Builtin *builtin, std::string &buffer);
+  bool addCell(const Cell &cell, std::string &buffer);
+
+ private:
+  typedef std::map<const Token *, int64_t> TokenIds;
+
+  std::string       records_;
+  int64_t           numRecords_ { 0 };
+  TokenIds                 ids_;
+  const LoadRecord        *record_ { nullptr };
+  const Interpreter::Impl *base_   { nullptr };
+};
+
+State
+ImageWriter::
+write(std::string &data)
+{
+  base_ = sharedBase();
+
+  std::string tail;
+
+  // dictionary (builtins are defined by the loading interpreter, base words by base)
+  Dictionary::NamedTokens namedTokens;
+
+  dictionary().namedDefinitions(namedTokens, /*withBase*/! base_);
+
+  std::string entries;
+  uint32_t    numEntries = 0;
+
+  for (const auto &namedToken : namedTokens) {
+    if (namedToken.second->isBuiltin())
+      continue;
+
+    int64_t id;
+
+    if (! addToken(namedToken.second.get(), id))
+      return State::lastError();
+
+    putString(entries, namedToken.first);
+    put      (entries, id);
+
+    ++numEntries;
+  }
+
+  put(tail, numEntries);
+
+  tail += entries;
+
+  // BASE variable
+  int64_t baseId = -1;
+
+  if (interp_->baseVar_ && ! addToken(interp_->baseVar_, baseId))
+    return State::lastError();
+
+  put(tail, baseId);
+
+  // forgotten variables (may be referenced from data space)
+  std::vector<int64_t> forgottenIds;
+
+  for (const auto &var : interp_->forgotten_) {
+    int64_t id;
+
+    if (! addToken(var.get(), id))
+      return State::lastError();
+
+    forgottenIds.push_back(id);
+  }
+
+  putIds(tail, forgottenIds);
+
+  // data space
+  const Memory &memory = interp_->memory_;
+
+  put(tail, int32_t(memory.here()));
+  put(tail, int32_t(memory.size()));
+
+  for (int addr = 1; addr < memory.size(); ++addr) {
+    if (! addCell(memory.get(addr), tail))
+      return State::lastError();
+  }
+
+  //---
+
+  data.append(imageMagic, sizeof(imageMagic));
+
+  put(data, imageVersion);
+  put(data, uint8_t(base_ != nullptr));
+  put(data, base_ ? base_->sourceHash_ : uint64_t(0));
+  put(data, numRecords_);
+
+  data += records_;
+  data += tail;
+
+  return State::success();
+}
+
+State
+ImageWriter::
+writeLoad(const LoadRecord &record, const Memory &memory0, std::string &data)
+{
+  record_ = &record;
+
+  std::string tail;
+
+  // words defined and removed (in order)
+  put(tail, uint32_t(record.ops.size()));
+
+  for (const auto &op : record.ops) {
+    put      (tail, uint8_t(op.type));
+    putString(tail, op.name);
+
+    if (op.type == LoadOp::DEFINE) {
+      int64_t id;
+
+      if (! addToken(op.token.get(), id))
+        return State::lastError();
+
+      put(tail, id);
+    }
+  }
+
+  // data space: HERE, size and runs of changed cells (cells beyond old size were zero)
+  const Memory &memory = interp_->memory_;
+
+  put(tail, int32_t(memory.here()));
+  put(tail, int32_t(memory.size()));
+
+  Memory::Ranges ranges;
+
+  memory.changedRanges(memory0, ranges);
+
+  auto oldCell = [&](int addr) {
+    return (addr < memory0.size() ? memory0.get(addr) : Cell::makeInteger(0)); };
+
+  std::string runs;
+  uint32_t    numRuns = 0;
+
+  for (const auto &range : ranges) {
+    int addr = range.first;
+
+    while (addr < range.second) {
+      if (sameCell(memory.get(addr), oldCell(addr))) {
+        ++addr;
+        continue;
+      }
+
+      int start = addr;
+
+      std::string cells;
+
+      for ( ; addr < range.second && ! sameCell(memory.get(addr), oldCell(addr)); ++addr) {
+        if (! addCell(memory.get(addr), cells))
+          return State::lastError();
+      }
+
+      put(runs, int32_t(start));
+      put(runs, int32_t(addr - start));
+
+      runs += cells;
+
+      ++numRuns;
+    }
+  }
+
+  put(tail, numRuns);
+
+  tail += runs;
+
+  //---
+
+  put(data, numRecords_);
+
+  data += records_;
+  data += tail;
+
+  return State::success();
+}
+
+bool
+ImageWriter::
+addToken(Token *token, int64_t &id)
+{
+  auto p = ids_.find(token);
+
+  if (p != ids_.end()) {
+    // referenced before its record is complete
+    if (p->second < 0)
+      return State::error("Cyclic definition");
+
+    id = p->second;
+
+    return true;
+  }
+
+  // word existing before recorded load or base word
+  if ((token->isVariable() || token->isProcedure()) &&
+      (record_ ? ! record_->tokens.count(token) : (base_ && token->isFrozen())))
+    return addWord(token, id);
+
+  ids_[token] = -1;
+
+  std::string record;
+
+  if      (token->isBoolean()) {
+    put(record, uint8_t(IMAGE_BOOLEAN));
+    put(record, uint8_t(static_cast<BooleanToken *>(token)->value()));
+  }
+  else if (token->isNumber()) {
+    const Number &number = static_cast<NumberToken *>(token)->number();
+
+    put(record, uint8_t(IMAGE_NUMBER));
+
+    if (! addCell(Cell::makeNumber(number), record))
+      return false;
+  }
+  else if (token->isBuiltin()) {
+    put(record, uint8_t(IMAGE_BUILTIN));
+
+    if (! addBuiltin(static_cast<Builtin *>(token), record))
+      return false;
+  }
+  else if (token->isVariable()) {
+    Variable *var = static_cast<Variable *>(token);
+
+    if (var->execTokenArray().empty() && var->execCode().function())
+      return State::error("Can not save translated DOES> code");
+
+    std::vector<int64_t> execIds;
+
+    if (! addTokens(var->execTokenArray(), execIds))
+      return false;
+
+    put      (record, uint8_t(IMAGE_VARIABLE));
+    putString(record, var->name());
+    put      (record, int32_t(var->addr()));
+    put      (record, uint8_t(var->isConstant()));
+
+    if (var->isConstant() && ! addCell(var->cell(), record))
+      return false;
+
+    putIds(record, execIds);
+  }
+  else if (token->isProcedure()) {
+    Procedure *proc = static_cast<Procedure *>(token);
+
+    if (proc->tokens().empty() && proc->code().function())
+      return State::error("Can not save translated procedure");
+
+    std::vector<int64_t> ids;
+
+    if (! addTokens(proc->tokens(), ids))
+      return false;
+
+    put      (record, uint8_t(IMAGE_PROCEDURE));
+    putString(record, proc->name());
+    putIds   (record, ids);
+  }
+  else
+    return State::error("Unsupported token");
+
+  records_ += record;
+
+  id = numRecords_++;
+
+  ids_[token] = id;
+
+  return true;
+}
+
+// reference to word existing before recorded load or base word
+bool
+ImageWriter::
+addWord(Token *token, int64_t &id)
+{
+  std::string record;
+
+  const std::string &name = (token->isVariable() ? static_cast<Variable *>(token)->name() :
+                                                   static_cast<Procedure *>(token)->name());
+
+  int index;
+
+  if (dictionary().definitionIndex(name, token, index)) {
+    put      (record, uint8_t(IMAGE_WORD));
+    putString(record, name);
+    put      (record, int32_t(index));
+  }
+  else {
+    if (! forgottenIndex(token, index))
+      return State::error("Unsupported token");
+
+    put(record, uint8_t(IMAGE_FORGOTTEN));
+    put(record, int32_t(index));
+  }
+
+  records_ += record;
+
+  id = numRecords_++;
+
+  ids_[token] = id;
+
+  return true;
+}
+
+bool
+ImageWriter::
+addTokens(const TokenArray &tokens, std::vector<int64_t> &ids)
+{
+  for (const auto &token : tokens) {
+    int64_t id;
+
+    if (! addToken(token.get(), id))
+      return false;
+
+    ids.push_back(id);
+  }
+
+  return true;
+}
+
+bool
+ImageWriter::
+addBuiltin(Builtin *builtin, std::string &buffer)
+{
+  std::string data;
+
+  switch (builtin->builtinType()) {
+    case Builtin::DO_BUILTIN: {
+      const DoTokens &doTokens = static_cast<DoBuiltin *>(builtin)->getValue();
+
+      std::vector<int64_t> ids;
+
+      if (! addTokens(doTokens.tokens, ids))
+        return false;
+
+      put   (data, uint8_t(doTokens.incToken));
+      putIds(data, ids);
+
+      break;
+    }
+    case Builtin::IF_BUILTIN: {
+      const IfTokens &ifTokens = static_cast<IfBuiltin *>(builtin)->getValue();
+
+      std::vector<int64_t> ifIds, elseIds;
+
+      if (! addTokens(ifTokens.ifTokens, ifIds) || ! addTokens(ifTokens.elseTokens, elseIds))
+        return false;
+
+      putIds(data, ifIds);
+      putIds(data, elseIds);
+
+      break;
+    }
+    case Builtin::BEGIN_BUILTIN: {
+      const BeginTokens &beginTokens = static_cast<BeginBuiltin *>(builtin)->getValue();
+
+      std::vector<int64_t> ids, whileIds;
+
+      if (! addTokens(beginTokens.tokens, ids) || ! addTokens(beginTokens.whileTokens, whileIds))
+        return false;
+
+      put   (data, uint8_t(beginTokens.is_until));
+      put   (data, uint8_t(beginTokens.is_while));
+      putIds(data, ids);
+      putIds(data, whileIds);
+
+      break;
+    }
+    case Builtin::DOES_BUILTIN: {
+      std::vector<int64_t> ids;
+
+      if (! addTokens(static_cast<DoesBuiltin *>(builtin)->getValue(), ids))
+        return false;
+
+      putIds(data, ids);
+
+      break;
+    }
+    case Builtin::PRINTTO_BUILTIN:
+      putString(data, static_cast<PrintToBuiltin *>(builtin)->getValue());
+      break;
+    case Builtin::LOAD_BUILTIN:
+      putString(data, static_cast<LoadBuiltin *>(builtin)->getValue());
+      break;
+    case Builtin::SAVE_IMAGE_BUILTIN:
+      putString(data, static_cast<SaveImageBuiltin *>(builtin)->getValue());
+      break;
+    case Builtin::LOAD_IMAGE_BUILTIN:
+      putString(data, static_cast<LoadImageBuiltin *>(builtin)->getValue());
+      break;
+    case Builtin::COMMENT_BUILTIN:
+      putString(data, static_cast<CommentBuiltin *>(builtin)->getValue());
+      break;
+    default:
+      // other builtins are looked up by name when loaded
+      if (builtin->hasModifier())
+        return State::error("Unsupported word");
+
+      break;
+  }
+
+  put      (buffer, int32_t(builtin->builtinType()));
+  putString(buffer, builtin->name());
+
+  buffer += data;
+
+  return true;
+}
+
+bool
+ImageWriter::
+addCell(const Cell &cell, std::string &buffer)
+{
+  int64_t value = 0;
+
+  switch (cell.type()) {
+    case Cell::BOOLEAN_CELL: value = cell.boolean(); break;
+    case Cell::INTEGER_CELL: value = cell.integer(); break;
+    case Cell::REAL_CELL   : { double r = cell.real(); memcpy(&value, &r, sizeof(r)); break; }
+    case Cell::TOKEN_CELL  : {
+      if (! addToken(cell.token(), value))
+        return false;
+
+      break;
+    }
+    default: break;
+  }
+
+  put(buffer, uint8_t(cell.type()));
+  put(buffer, value);
+
+  return true;
+}
+
+//---
+
+class ImageReader {
+ public:
+  ImageReader(const char *data, size_t len) :
+   p_(data), end_(data + len) {
+  }
+
+  // replace definitions and data space with image at current position (state is
+  // unchanged if image is invalid)
+  State read();
+
+  // apply changes of recorded load (see ImageWriter::writeLoad) at current position
+  // (state is unchanged if invalid)
+  State readLoad();
+
+  template<typename T>
+  bool get(T &value) {
+    if (size_t(end_ - p_) < sizeof(T))
+      return false;
+
+    memcpy(&value, p_, sizeof(T));
+
+    p_ += sizeof(T);
+
+    return true;
+  }
+
+  bool readString(std::string &str);
+
+ private:
+  bool readToken(TokenP &token);
+  bool readBuiltin(TokenP &token);
+  bool readTokens(TokenArray &tokens);
+  bool lookupToken(int64_t id, TokenP &token);
+  bool readCell(Cell &cell);
+
+ private:
+  const char *p_;
+  const char *end_;
+  TokenArray               tokens_;
+  bool                     load_ { false };
+  const Interpreter::Impl *base_ { nullptr };
+};
+
+State
+ImageReader::
+read()
+{
+  char     magic[sizeof(imageMagic)];
+  uint32_t version;
+  uint8_t  hasBase;
+  uint64_t baseHash;
+  int64_t  numRecords;
+
+  if (! get(magic) || memcmp(magic, imageMagic, sizeof(imageMagic)) != 0 ||
+      ! get(version) || version != imageVersion || ! get(hasBase) || ! get(baseHash) ||
+      ! get(numRecords) || numRecords < 0)
+    return State::error("Invalid image");
+
+  if (hasBase) {
+    base_ = sharedBase();
+
+    if (! base_ || base_->sourceHash_ != baseHash)
+      return State::error("Image needs different base");
+  }
+
+  for (int64_t i = 0; i < numRecords; ++i) {
+    TokenP token;
+
+    if (! readToken(token))
+      return State::error("Invalid image");
+
+    tokens_.push_back(token);
+  }
+
+  // dictionary
+  uint32_t numEntries;
+
+  if (! get(numEntries))
+    return State::error("Invalid image");
+
+  Dictionary::NamedTokens namedTokens;
+
+  for (uint32_t i = 0; i < numEntries; ++i) {
+    std::string name;
+    int64_t     id;
+    TokenP      token;
+
+    if (! readString(name) || ! get(id) || ! lookupToken(id, token))
+      return State::error("Invalid image");
+
+    namedTokens.push_back(std::make_pair(name, token));
+  }
+
+  // BASE variable
+  int64_t baseId;
+  TokenP  baseToken;
+
+  if (! get(baseId) || (baseId >= 0 && (! lookupToken(baseId, baseToken) ||
+                                          ! baseToken->isVariable())))
+    return State::error("Invalid image");
+
+  // forgotten variables
+  TokenArray forgotten;
+
+  if (! readTokens(forgotten))
+    return State::error("Invalid image");
+
+  for (const auto &token : forgotten)
+    if (! token->isVariable())
+      return State::error("Invalid image");
+
+  // data space
+  int32_t here, size;
+
+  if (! get(here) || ! get(size) || here < 1 || size < here)
+    return State::error("Invalid image");
+
+  // (on base start from base pages so unchanged ones stay shared)
+  Memory memory;
+
+  if (base_ && size >= base_->memory_.size()) {
+    memory = base_->memory_;
+
+    memory.setHere(here);
+  }
+  else
+    memory.allot(here - 1);
+
+  memory.reserve(size - here);
+
+  for (int addr = 1; addr < size; ++addr) {
+    Cell cell;
+
+    if (! readCell(cell))
+      return State::error("Invalid image");
+
+    if (! sameCell(memory.get(addr), cell))
+      memory.set(addr, cell);
+  }
+
+  if (p_ != end_)
+    return State::error("Invalid image");
+
+  //---
+
+  // replace own definitions and forgotten variables (kept until nothing can still be
+  // running them, see releaseReplaced). Base is kept if image was saved on it.
+  interp_->dictionary_.definitions(interp_->replaced_, /*withBase*/false);
+
+  for (const auto &var : interp_->forgotten_)
+    interp_->replaced_.push_back(var);
+
+  interp_->forgotten_.clear();
+
+  interp_->dictionary_ = Dictionary();
+
+  interp_->dictionary_.setBase(base_ ? &base_->dictionary_ : nullptr);
+
+  interp_->builtinsDefined_ = (base_ != nullptr);
+
+  for (const auto &namedToken : namedTokens)
+    dictionary().define(namedToken.first, namedToken.second);
+
+  for (const auto &token : forgotten)
+    interp_->forgotten_.push_back(Variable::fromToken(token));
+
+  interp_->baseVar_    = (baseToken ? Variable::fromToken(baseToken).get() : nullptr);
+  interp_->currentVar_ = nullptr;
+
+  interp_->memory_ = std::move(memory);
+
+  return State::success();
+}
+
+State
+ImageReader::
+readLoad()
+{
+  load_ = true;
+
+  int64_t numRecords;
+
+  if (! get(numRecords) || numRecords < 0)
+    return State::error("Invalid load cache entry");
+
+  for (int64_t i = 0; i < numRecords; ++i) {
+    TokenP token;
+
+    if (! readToken(token))
+      return State::error("Invalid load cache entry");
+
+    tokens_.push_back(token);
+  }
+
+  // words defined and removed. Removals are of words defined earlier in entry
+  // (checked so replay can't fail part way)
+  uint32_t numOps;
+
+  if (! get(numOps))
+    return State::error("Invalid load cache entry");
+
+  LoadOps ops;
+
+  // number of (variable or procedure) definitions of case folded name in entry
+  std::map<std::pair<std::string, bool>, int> numDefined;
+
+  auto foldName = [](const std::string &name) {
+    std::string folded = name;
+
+    for (auto &c : folded)
+      c = char(toupper(static_cast<unsigned char>(c)));
+
+    return folded;
+  };
+
+  for (uint32_t i = 0; i < numOps; ++i) {
+    uint8_t type;
+    LoadOp  op;
+
+    if (! get(type) || ! readString(op.name))
+      return State::error("Invalid load cache entry");
+
+    op.type = LoadOp::Type(type);
+
+    if      (op.type == LoadOp::DEFINE) {
+      int64_t id;
+
+      if (! get(id) || ! lookupToken(id, op.token))
+        return State::error("Invalid load cache entry");
+
+      if (op.token->isVariable() || op.token->isProcedure())
+        ++numDefined[std::make_pair(foldName(op.name), op.token->isVariable())];
+    }
+    else if (op.type == LoadOp::FORGET_VARIABLE || op.type == LoadOp::FORGET_PROCEDURE) {
+      auto key = std::make_pair(foldName(op.name),
+                                op.type == LoadOp::FORGET_VARIABLE);
+
+      if (numDefined[key]-- <= 0)
+        return State::error("Invalid load cache entry");
+    }
+    else
+      return State::error("Invalid load cache entry");
+
+    ops.push_back(op);
+  }
+
+  // data space
+  int32_t here, size;
+  uint32_t numRuns;
+
+  if (! get(here) || ! get(size) || ! get(numRuns) || here < 1 || size < here)
+    return State::error("Invalid load cache entry");
+
+  std::vector<std::pair<int, Cell>> cells;
+
+  for (uint32_t i = 0; i < numRuns; ++i) {
+    int32_t start, n;
+
+    if (! get(start) || ! get(n) || start < 1 || n < 0 || start > size - n)
+      return State::error("Invalid load cache entry");
+
+    for (int32_t j = 0; j < n; ++j) {
+      Cell cell;
+
+      if (! readCell(cell))
+        return State::error("Invalid load cache entry");
+
+      cells.emplace_back(start + j, cell);
+    }
+  }
+
+  if (p_ != end_)
+    return State::error("Invalid load cache entry");
+
+  //---
+
+  // (output of load, including debug, is replayed separately)
+  for (const auto &op : ops) {
+    if (op.type == LoadOp::DEFINE) {
+      defineToken(op.name, op.token);
+      continue;
+    }
+
+    bool   isVar = (op.type == LoadOp::FORGET_VARIABLE);
+    TokenP token;
+
+    dictionary().forget(op.name, isVar ? Token::VAR_BASE_TOKEN : Token::PROCEDURE_TOKEN, token);
+
+    recordForget(op.type, op.name, token);
+
+    if (isVar)
+      interp_->forgotten_.push_back(Variable::fromToken(token));
+  }
+
+  Memory &memory = interp_->memory_;
+
+  memory.setHere(here);
+  memory.reserve(size - here);
+
+  for (const auto &cell : cells)
+    memory.set(cell.first, cell.second);
+
+  return State::success();
+}
+
+bool
+ImageReader::
+readToken(TokenP &token)
+{
+  uint8_t type;
+
+  if (! get(type))
+    return false;
+
+  switch (type) {
+    case IMAGE_BOOLEAN: {
+      uint8_t b;
+
+      if (! get(b)) return false;
+
+      token = makeRef<BooleanToken>(b != 0);
+
+      break;
+    }
+    case IMAGE_NUMBER: {
+      Cell cell;
+
+      if (! readCell(cell) || ! cell.isNumber())
+        return false;
+
+      token = NumberToken::makeNumber(cell.number());
+
+      break;
+    }
+    case IMAGE_BUILTIN:
+      return readBuiltin(token);
+    case IMAGE_VARIABLE: {
+      std::string name;
+      int32_t     addr;
+      uint8_t     constant;
+      Cell        value;
+      TokenArray  execTokens;
+
+      if (! readString(name) || ! get(addr) || ! get(constant))
+        return false;
+
+      if (constant && ! readCell(value))
+        return false;
+
+      if (! readTokens(execTokens))
+        return false;
+
+      VariableP var = makeRef<Variable>(name, addr);
+
+      if (constant)
+        var->setConstant(value);
+
+      if (! execTokens.empty())
+        var->setExecTokens(execTokens);
+
+      token = var;
+
+      break;
+    }
+    case IMAGE_PROCEDURE: {
+      std::string name;
+      TokenArray  tokens;
+
+      if (! readString(name) || ! readTokens(tokens))
+        return false;
+
+      token = makeRef<Procedure>(name, tokens);
+
+      break;
+    }
+    case IMAGE_WORD: {
+      std::string name;
+      int32_t     index;
+
+      if (! readString(name) || ! get(index))
+        return false;
+
+      if      (load_) {
+        if (! dictionary().definitionAt(name, index, token))
+          return false;
+      }
+      else if (! base_ || ! base_->dictionary_.definitionAt(name, index, token))
+        return false;
+
+      if (! token->isVariable() && ! token->isProcedure())
+        return false;
+
+      break;
+    }
+    case IMAGE_FORGOTTEN: {
+      int32_t index;
+
+      if ((! load_ && ! base_) || ! get(index) || ! forgottenAt(index, ! load_, token))
+        return false;
+
+      break;
+    }
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+bool
+ImageReader::
+readBuiltin(TokenP &token)
+{
+  int32_t     type;
+  std::string name;
+
+  if (! get(type) || ! readString(name))
+    return false;
+
+  switch (type) {
+    case Builtin::DO_BUILTIN: {
+      DoTokens doTokens;
+      uint8_t  incToken;
+
+      if (! get(incToken) || ! readTokens(doTokens.tokens))
+        return false;
+
+      doTokens.incToken = incToken;
+
+      token = makeRef<DoBuiltin>(doTokens);
+
+      break;
+    }
+    case Builtin::IF_BUILTIN: {
+      IfTokens ifTokens;
+
+      if (! readTokens(ifTokens.ifTokens) || ! readTokens(ifTokens.elseTokens))
+        return false;
+
+      token = makeRef<IfBuiltin>(ifTokens);
+
+      break;
+    }
+    case Builtin::BEGIN_BUILTIN: {
+      BeginTokens beginTokens;
+      uint8_t     isUntil, isWhile;
+
+      if (! get(isUntil) || ! get(isWhile) ||
+          ! readTokens(beginTokens.tokens) || ! readTokens(beginTokens.whileTokens))
+        return false;
+
+      beginTokens.is_until = isUntil;
+      beginTokens.is_while = isWhile;
+      beginTokens.leave    = false;
+
+      token = makeRef<BeginBuiltin>(beginTokens);
+
+      break;
+    }
+    case Builtin::DOES_BUILTIN: {
+      TokenArray tokens;
+
+      if (! readTokens(tokens))
+        return false;
+
+      token = makeRef<DoesBuiltin>(tokens);
+
+      break;
+    }
+    case Builtin::PRINTTO_BUILTIN:
+    case Builtin::LOAD_BUILTIN:
+    case Builtin::SAVE_IMAGE_BUILTIN:
+    case Builtin::LOAD_IMAGE_BUILTIN:
+    case Builtin::COMMENT_BUILTIN: {
+      std::string str;
+
+      if (! readString(str))
+        return false;
+
+      if      (type == Builtin::PRINTTO_BUILTIN)
+        token = makeRef<PrintToBuiltin>(str);
+      else if (type == Builtin::LOAD_BUILTIN)
+        token = makeRef<LoadBuiltin>(str);
+      else if (type == Builtin::SAVE_IMAGE_BUILTIN)
+        token = makeRef<SaveImageBuiltin>(str);
+      else if (type == Builtin::LOAD_IMAGE_BUILTIN)
+        token = makeRef<LoadImageBuiltin>(str);
+      else
+        token = makeRef<CommentBuiltin>(str);
+
+      break;
+    }
+    default: {
+      BuiltinP builtin;
+
+      if (! lookupBuiltin(name, builtin) || builtin->builtinType() != type)
+        return false;
+
+      token = builtin;
+
+      break;
+    }
+  }
+
+  return true;
+}
+
+bool
+ImageReader::
+readTokens(TokenArray &tokens)
+{
+  uint32_t n;
+
+  if (! get(n) || size_t(end_ - p_) < n*sizeof(int64_t))
+    return false;
+
+  tokens.reserve(tokens.size() + n);
+
+  for (uint32_t i = 0; i < n; ++i) {
+    int64_t id;
+    TokenP  token;
+
+    if (! get(id) || ! lookupToken(id, token))
+      return false;
+
+    tokens.push_back(token);
+  }
+
+  return true;
+}
+
+bool
+ImageReader::
+lookupToken(int64_t id, TokenP &token)
+{
+  // only tokens already read can be referenced
+  if (id < 0 || id >= int64_t(tokens_.size()))
+    return false;
+
+  token = tokens_[id];
+
+  return true;
+}
+
+bool
+ImageReader::
+readCell(Cell &cell)
+{
+  uint8_t type;
+  int64_t value;
+
+  if (! get(type) || ! get(value))
+    return false;
+
+  switch (type) {
+    case Cell::NO_CELL     : cell = Cell(); break;
+    case Cell::BOOLEAN_CELL: cell = Cell::makeBoolean(value != 0); break;
+    case Cell::INTEGER_CELL: cell = Cell::makeInteger(value); break;
+    case Cell::REAL_CELL   : {
+      double r;
+
+      memcpy(&r, &value, sizeof(r));
+
+      cell = Cell::makeReal(r);
+
+      break;
+    }
+    case Cell::TOKEN_CELL: {
+      TokenP token;
+
+      if (! lookupToken(value, token))
+        return false;
+
+      cell = Cell::makeToken(token.get());
+
+      break;
+    }
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+bool
+ImageReader::
+readString(std::string &str)
+{
+  uint32_t len;
+
+  if (! get(len) || size_t(end_ - p_) < len)
+    return false;
+
+  str.assign(p_, len);
+
+  p_ += len;
+
+  return true;
+}
+
+//---
+
+// read only mapping of whole file
+class MappedFile {
+ public:
+  MappedFile(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) return;
+
+    struct stat st;
+
+    if (fstat(fd, &st) == 0) {
+      size_ = size_t(st.st_size);
+
+      if (size_ == 0)
+        valid_ = true;
+      else {
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+          data_  = static_cast<const char *>(data);
+          valid_ = true;
+        }
+      }
+    }
+
+    close(fd);
+  }
+
+ ~MappedFile() {
+    if (data_)
+      munmap(const_cast<char *>(data_), size_);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool isValid() const { return valid_; }
+
+  const char *data() const { return data_; }
+  size_t      size() const { return size_; }
+
+ private:
+  const char *data_  { nullptr };
+  size_t      size_  { 0 };
+  bool        valid_ { false };
+};
+
+static bool
+writeFile(const char *filename, const std::string &data)
+{
+  FILE *fp = fopen(filename, "wb");
+
+  if (! fp)
+    return false;
+
+  bool rc = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+
+  if (fclose(fp) != 0)
+    rc = false;
+
+  return rc;
+}
+
+State
+saveImage(const char *filename)
+{
+  // file written is not replayed from load cache
+  setLoadImpure();
+
+  std::string data;
+
+  ImageWriter writer;
+
+  if (! writer.write(data))
+    return State::lastError();
+
+  if (! writeFile(filename, data))
+    return State::error("Image write failed");
+
+  return State::success();
+}
+
+State
+loadImage(const char *filename)
+{
+  // map file read only (tokens are built from the mapped records)
+  MappedFile file(filename);
+
+  if (! file.isValid())
+    return State::openFailed(filename);
+
+  ImageReader reader(file.data(), file.size());
+
+  if (! reader.read())
+    return State::lastError();
+
+  // loaded outside of any word
+  if (interp_->parseDepth_ == 0)
+    releaseReplaced();
+
+  // replaced definitions can't be replayed by load cache
+  setLoadImpure();
+
+  // image is input for fingerprint and recorded load
+  uint64_t hash = hashBytes(hashInit, file.data(), file.size());
+
+  interp_->sourceHash_ = hashValue(interp_->sourceHash_, hash);
+
+  if (interp_->loadRecord_)
+    interp_->loadRecord_->deps.push_back(LoadDep { filename, hash });
+
+  return State::success();
+}
+
+//----------
+
+// Load cache: the result of loading a file depends only on the file, the files it
+// loads and the interpreter state, and the state is determined by all input read
+// before it (sourceHash_). A load with no other input or effect is recorded as the
+// output, the files read (with hashes), the resulting fingerprint and the changes
+// it made (words defined and removed, changed data space cells), keyed by the file
+// and fingerprint. A later load with the same key whose files are unchanged replays
+// the changes on top of the current (identical) state instead of parsing.
+
+static const char     loadCacheMagic[8] = { 'C', 'F', 'O', 'R', 'T', 'H', 'L', 'C' };
+static const uint32_t loadCacheVersion  = 2;
+
+// output stream buffer passing output on and keeping a copy
+class RecordBuf : public std::streambuf {
+ public:
+  RecordBuf(std::ostream &os) :
+   os_(os) {
+  }
+
+  const std::string &str() const { return str_; }
+
+ protected:
+  int overflow(int c) override {
+    if (c != traits_type::eof()) {
+      str_ += char(c);
+
+      os_.put(char(c));
+    }
+
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    str_.append(s, size_t(n));
+
+    os_.write(s, n);
+
+    return n;
+  }
+
+  int sync() override {
+    os_.flush();
+
+    return 0;
+  }
+
+ private:
+  std::ostream &os_;
+  std::string   str_;
+};
+
+static bool
+hashFile(const char *filename, uint64_t &hash)
+{
+  MappedFile file(filename);
+
+  if (! file.isValid())
+    return false;
+
+  hash = hashBytes(hashInit, file.data(), file.size());
+
+  return true;
+}
+
+static bool
+sameCells(const CellArray &cells1, const CellArray &cells2)
+{
+  if (cells1.size() != cells2.size())
+    return false;
+
+  for (size_t i = 0; i < cells1.size(); ++i) {
+    if (! sameCell(cells1[i], cells2[i]))
+      return false;
+  }
+
+  return true;
+}
+
+// replay cache entry (false if missing, stale or invalid)
+static bool
+replayLoadCache(const std::string &filename)
+{
+  MappedFile file(filename.c_str());
+
+  if (! file.isValid() || file.size() == 0)
+    return false;
+
+  ImageReader reader(file.data(), file.size());
+
+  char     magic[sizeof(loadCacheMagic)];
+  uint32_t version;
+  uint64_t sourceHash;
+  uint32_t numDeps;
+
+  if (! reader.get(magic) || memcmp(magic, loadCacheMagic, sizeof(magic)) != 0 ||
+      ! reader.get(version) || version != loadCacheVersion ||
+      ! reader.get(sourceHash) || ! reader.get(numDeps))
+    return false;
+
+  LoadDeps deps;
+
+  for (uint32_t i = 0; i < numDeps; ++i) {
+    LoadDep  dep;
+    uint64_t hash;
+
+    if (! reader.readString(dep.filename) || ! reader.get(dep.hash))
+      return false;
+
+    if (! hashFile(dep.filename.c_str(), hash) || hash != dep.hash)
+      return false;
+
+    deps.push_back(dep);
+  }
+
+  std::string str;
+
+  if (! reader.readString(str) || ! reader.readLoad())
+    return false;
+
+  output() << str << std::flush;
+
+  interp_->sourceHash_ = sourceHash;
+
+  if (interp_->loadRecord_) {
+    auto &outerDeps = interp_->loadRecord_->deps;
+
+    outerDeps.insert(outerDeps.end(), deps.begin(), deps.end());
+  }
+
+  return true;
+}
+
+static void
+writeLoadCache(const std::string &filename, const LoadRecord &record, const Memory &memory0,
+               const std::string &str)
+{
+  std::string data(loadCacheMagic, sizeof(loadCacheMagic));
+
+  ImageWriter::put(data, loadCacheVersion);
+  ImageWriter::put(data, interp_->sourceHash_);
+  ImageWriter::put(data, uint32_t(record.deps.size()));
+
+  for (const auto &dep : record.deps) {
+    ImageWriter::putString(data, dep.filename);
+    ImageWriter::put      (data, dep.hash);
+  }
+
+  ImageWriter::putString(data, str);
+
+  ImageWriter writer;
+
+  // changes may not be saveable (translated code)
+  if (! writer.writeLoad(record, memory0, data))
+    return;
+
+  // write to unique file and rename so concurrent loads never see partial entry
+  std::string tmpFilename = filename + ".XXXXXX";
+
+  int fd = mkstemp(&tmpFilename[0]);
+
+  if (fd < 0) return;
+
+  close(fd);
+
+  if (! writeFile(tmpFilename.c_str(), data) ||
+      rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    unlink(tmpFilename.c_str());
+}
+
+void
+setLoadCache(const std::string &dir)
+{
+  interp_->loadCacheDir_ = dir;
+}
+
+const std::string &
+loadCache()
+{
+  return interp_->loadCacheDir_;
+}
+
+State
+loadFile(const char *filename)
+{
+  uint64_t fileHash;
+
+  if (interp_->loadCacheDir_.empty() || ! hashFile(filename, fileHash))
+    return parseFile(filename);
+
+  // key on file, input before it and settings changing output
+  uint64_t key = hashValue(hashInit, interp_->sourceHash_);
+
+  key = hashValue(key, fileHash);
+  key = hashBytes(key, filename, strlen(filename));
+  key = hashValue(key, uint64_t(isDebug()));
+
+  char keyStr[17];
+
+  snprintf(keyStr, sizeof(keyStr), "%016llx", static_cast<unsigned long long>(key));
+
+  std::string cacheFilename = interp_->loadCacheDir_ + "/" + keyStr + ".cfl";
+
+  if (replayLoadCache(cacheFilename))
+    return State::success();
+
+  //---
+
+  // record load
+  LoadRecord record;
+
+  record.deps.push_back(LoadDep { filename, fileHash });
+
+  LoadRecord   *outerRecord = interp_->loadRecord_;
+  std::ostream *os          = interp_->os_;
+
+  RecordBuf    buf(*os);
+  std::ostream recordOs(&buf);
+
+  interp_->loadRecord_ = &record;
+  interp_->os_         = &recordOs;
+
+  CellArray  stack    = interp_->stack_;
+  CellArray  retStack = interp_->retStack_;
+  FloatArray fstack   = interp_->fstack_;
+
+  // data space before load (shares pages so only changed pages are copied)
+  Memory memory0 = interp_->memory_;
+
+  State state = parseFile(filename);
+
+  recordOs.flush();
+
+  interp_->loadRecord_ = outerRecord;
+  interp_->os_         = os;
+
+  if (outerRecord) {
+    outerRecord->deps.insert(outerRecord->deps.end(), record.deps.begin(), record.deps.end());
+    outerRecord->ops .insert(outerRecord->ops .end(), record.ops .begin(), record.ops .end());
+
+    outerRecord->tokens.insert(record.tokens.begin(), record.tokens.end());
+
+    if (record.impure)
+      outerRecord->impure = true;
+  }
+
+  // stacks are not part of entry
+  if (state && ! record.impure && sameCells(stack, interp_->stack_) &&
+      sameCells(retStack, interp_->retStack_) && fstack == interp_->fstack_)
+    writeLoadCache(cacheFilename, record, memory0, buf.str());
+
+  // replayed state has no current variable
+  interp_->currentVar_ = nullptr;
+
+  return state;
+}
+
+//----------
+
+bool
+lookupProcedure(const std::string &name, ProcedureP &proc)
+{
+  TokenP token;
+
+  if (! dictionary().lookup(name, Token::PROCEDURE_TOKEN, token))
+    return false;
+
+  proc = Procedure::fromToken(token);
+
+  return true;
+}
+
+void
+addBlockToken(TokenArray &tokens, const TokenP &token)
+{
+  // auto expand procedure
+  // TODO: option
+  if (token->isProcedure()) {
+    for (const auto &ptoken : Procedure::fromToken(token)->tokens())
+      tokens.push_back(ptoken);
+  }
+  // add if not null token
+  else if (! token->isNull())
+    tokens.push_back(token);
+}
+
+Memory &
+memory()
+{
+  return interp_->memory_;
+}
+
+int
+getBase()
+{
+  if (interp_->ignore_base_ || ! interp_->baseVar_) return 10;
+
+  // read cached BASE variable cell directly (no dictionary lookup)
+  Cell cell = interp_->memory_.get(interp_->baseVar_->addr());
+
+  if (! cell.isNumber())
+    return 10;
+
+  return int(std::min(std::max(cell.integer(), Integer(2)), Integer(36)));
+}
+
+bool
+isBaseChar(int c, int base, int *value)
+{
+  if (base < 2 || base > int(base_chars.size()))
+    return false;
+
+  int c1 = c;
+
+  if (::islower(c1))
+    c1 = ::toupper(c1);
+
+  std::string::size_type pos = base_chars.find(char(c1));
+
+  if (pos == std::string::npos || int(pos) >= base)
+    return false;
+
+  if (value != NULL)
+    *value = int(pos);
+
+  return true;
+}
+
+State
+toBaseInteger(const std::string &str, int base, Integer *integer)
+{
+  *integer = 0;
+
+  if (base < 2 || base > int(base_chars.size()))
+    return State::error("Invalid Base");
+
+  uint i   = 0;
+  auto len = str.size();
+
+  while (i < len) {
+    int c = str[i];
+
+    int value;
+
+    if (! isBaseChar(c, base, &value))
+      return State::error("Invalid Char");
+
+    Integer integer1;
+
+    if (__builtin_mul_overflow(*integer, Integer(base), &integer1) ||
+        __builtin_add_overflow(integer1, Integer(value), &integer1))
+      return State::error("Overflow");
+
+    *integer = integer1;
+
+    ++i;
+  }
+
+  return State::success();
+}
+
+std::string
+toBaseString(int base, Integer integer)
+{
+  if (base < 2 || base > int(base_chars.size()))
+    return "";
+
+  std::string str;
+
+  // negate as unsigned so the most negative value does not overflow
+  UInteger uinteger = UInteger(integer);
+
+  if (integer < 0)
+    uinteger = -uinteger;
+
+  while (uinteger >= UInteger(base)) {
+    auto n = uinteger % UInteger(base);
+
+    str = base_chars[n] + str;
+
+    uinteger /= UInteger(base);
+  }
+
+  str = base_chars[uinteger] + str;
+
+  if (integer < 0)
+    str = '-' + str;
+
+  return str;
+}
+
+std::string
+toUpper(const std::string &str)
+{
+  std::string ustr = str;
+
+  auto len = ustr.size();
+
+  for (uint i = 0; i < len; ++i)
+    ustr[i] = char(toupper(ustr[i]));
+
+  return ustr;
+}
+
+//----------
+
+State
+Variable::
+execTokens()
+{
+  if (isDebug() && ! execTokens_.empty()) {
+    IgnoreBase ib;
+
+    output() << "DOES>";
+
+    for (const auto &token : execTokens_) {
+      output() << " ";
+
+      token->print(output());
+    }
+
+    output() << std::endl;
+  }
+
+  if (execCode_.isValid())
+    return execCode_.exec();
+
+  for (const auto &token : execTokens_) {
+    if (! execToken(token))
+      return State::lastError();
+  }
+
+  return State::success();
+}
+
+Cell
+Variable::
+value() const
+{
+  if (isConstant())
+    return constValue_;
+
+  return interp_->memory_.get(addr_);
+}
+
+bool
+Variable::
+setValue(const Cell &value)
+{
+  if (isConstant()) {
+    if (isFrozen())
+      return false;
+
+    constValue_ = value;
+
+    return true;
+  }
+
+  return interp_->memory_.set(addr_, value);
+}
+
+void
+Variable::
+freezeRefs()
+{
+  freezeTokens(execTokens_);
+
+  if (isConstant() && constValue_.isToken())
+    constValue_.token()->freeze();
+}
+
+void
+Variable::
+setInteger(Integer i)
+{
+  setValue(Cell::makeInteger(i));
+}
+
+bool
+Variable::
+getInteger(Integer &i) const
+{
+  i = 0;
+
+  Cell cell = value();
+
+  if (! cell.isNumber())
+    return false;
+
+  i = cell.integer();
+
+  return true;
+}
+
+//----------
+
+// core builtins which can be dispatched by builtin type
+#define CORE_BUILTINS(X) \
+  X(Dup     , DUP     ) X(Drop    , DROP    ) X(Swap    , SWAP    ) X(Over    , OVER    ) \
+  X(Rot     , ROT     ) X(Pick    , PICK    ) X(Roll    , ROLL    ) X(QDup    , QDUP    ) \
+  X(Depth   , DEPTH   ) X(PopRet  , POP_RET ) X(PushRet , PUSH_RET) X(CopyRet , COPY_RET) \
+  X(Less    , LESS    ) X(Equal   , EQUAL   ) X(Greater , GREATER ) X(ULess   , ULESS   ) \
+  X(Not     , NOT     ) X(Plus    , PLUS    ) X(Minus   , MINUS   ) X(Times   , TIMES   ) \
+  X(Divide  , DIVIDE  ) X(Mod     , MOD     ) X(DMod    , DMOD    ) X(Plus1   , PLUS1   ) \
+  X(Plus2   , PLUS2   ) X(MulDiv  , MULDIV  ) X(Max     , MAX     ) X(Min     , MIN     ) \
+  X(Abs     , ABS     ) X(Negate  , NEGATE  ) X(And     , AND     ) X(Or      , OR      ) \
+  X(DPlus   , DPLUS   ) X(MulDMod , MULDMOD ) X(UTimes  , UTIMES  ) X(UDMod   , UDMOD   ) \
+  X(DNegate , DNEGATE ) \
+  X(Xor     , XOR     ) X(Fetch   , FETCH   ) X(Store   , STORE   ) X(PFetch  , PFETCH  ) \
+  X(AddStore, ADDSTORE) X(Move    , MOVE    ) X(CMove   , CMOVE   ) X(CMoveUp , CMOVE_UP) \
+  X(Fill    , FILL    ) X(Erase   , ERASE   ) X(I       , I       ) X(J       , J       ) \
+  X(FPlus   , FPLUS   ) X(FMinus  , FMINUS  ) X(FTimes  , FTIMES  ) X(FDivide , FDIVIDE ) \
+  X(FFetch  , FFETCH  ) X(FStore  , FSTORE  ) X(FDup    , FDUP    ) X(FDrop   , FDROP   ) \
+  X(FSwap   , FSWAP   ) X(FSqrt   , FSQRT   ) X(FLess   , FLESS   ) X(SToF    , STOF    ) \
+  X(FToS    , FTOS    ) X(FPrint  , FPRINT  ) \
+  X(Emit    , EMIT    ) X(Type    , TYPE    ) X(Count   , COUNT   ) X(Trailing, TRAILING) \
+  X(Key     , KEY     ) X(Expect  , EXPECT  ) X(Query   , QUERY   ) X(Word    , WORD    ) \
+  X(Decimal , DECIMAL ) X(Print   , PRINT   ) X(PStack  , PSTACK  )
+
+// check builtin is core class for its type (so can be called without virtual dispatch)
+bool
+isCoreBuiltin(Builtin *builtin)
+{
+#define IS_CORE_BUILTIN(ID,N) \
+  case Builtin::N##_BUILTIN: return (dynamic_cast<ID##Builtin *>(builtin) != nullptr);
+
+  switch (builtin->builtinType()) {
+    CORE_BUILTINS(IS_CORE_BUILTIN)
+    default: return false;
+  }
+
+#undef IS_CORE_BUILTIN
+}
+
+// exec core builtin using dense switch on builtin type (non-virtual call)
+inline State
+execCoreBuiltin(Builtin *builtin, int type)
+{
+#define EXEC_CORE_BUILTIN(ID,N) \
+  case Builtin::N##_BUILTIN: return static_cast<ID##Builtin *>(builtin)->ID##Builtin::exec();
+
+  switch (type) {
+    CORE_BUILTINS(EXEC_CORE_BUILTIN)
+    default: return builtin->exec();
+  }
+
+#undef EXEC_CORE_BUILTIN
+}
+
+//----------
+
+bool
+Code::
+compile(const TokenArray &tokens)
+{
+  instrs_.clear();
+  loops_ .clear();
+
+  doDepth_ = 0;
+
+  native_.reset();
+
+  nativeCode_ = nullptr;
+
+  fn_ = nullptr;
+
+  valid_ = compileTokens(tokens);
+
+  if (! valid_)
+    instrs_.clear();
+
+  effect_ = StackEffect();
+
+  if (! valid_)
+    return false;
+
+  // debug trace shows the unoptimized builtins
+  bool optimize = (interp_->optimize_ && ! isDebug());
+
+  if (optimize)
+    optimizeInstrs();
+
+  // effect is same for simplified, specialized and fused instructions
+  analyzeEffect();
+
+  if (optimize && effect_.known) {
+    // removed instructions can expose more constant expressions
+    while (simplifyInstrs())
+      optimizeInstrs();
+
+    specializeTypes();
+  }
+
+  if (interp_->superInstructions_ && ! isDebug())
+    fuseInstrs();
+
+  return valid_;
+}
+
+bool
+Code::
+compileTokens(const TokenArray &tokens)
+{
+  for (const auto &token : tokens) {
+    if (! compileToken(token))
+      return false;
+  }
+
+  return true;
+}
+
+bool
+Code::
+compileToken(const TokenP &token)
+{
+  if      (token->isBuiltin()) {
+    BuiltinP builtin = Builtin::fromToken(token);
+
+    switch (builtin->builtinType()) {
+      case Builtin::IF_BUILTIN: {
+        const IfTokens &ifTokens = refCast<IfBuiltin>(builtin)->getValue();
+
+        int ifInstr = addInstr(Instr(Instr::ZBRANCH_OP));
+
+        if (! compileTokens(ifTokens.ifTokens)) return false;
+
+        if (! ifTokens.elseTokens.empty()) {
+          int elseInstr = addInstr(Instr(Instr::BRANCH_OP));
+
+          instrs_[ifInstr].arg = int(instrs_.size());
+
+          if (! compileTokens(ifTokens.elseTokens)) return false;
+
+          instrs_[elseInstr].arg = int(instrs_.size());
+        }
+        else
+          instrs_[ifInstr].arg = int(instrs_.size());
+
+        break;
+      }
+      case Builtin::DO_BUILTIN: {
+        const DoTokens &doTokens = refCast<DoBuiltin>(builtin)->getValue();
+
+        if (doDepth_ >= MAX_LOOP_DEPTH) return false;
+
+        Cell depth = Cell::makeInteger(doDepth_++);
+
+        addInstr(Instr(Instr::DO_OP, 0, depth));
+
+        int testInstr = addInstr(Instr(Instr::LOOP_TEST_OP, 0, depth));
+
+        loops_.push_back(Loop());
+
+        loops_.back().isDo = true;
+
+        if (! compileTokens(doTokens.tokens)) return false;
+
+        addInstr(Instr(doTokens.incToken ? Instr::PLOOP_OP : Instr::LOOP_OP, testInstr));
+
+        int exitInstr = addInstr(Instr(Instr::UNLOOP_OP));
+
+        instrs_[testInstr].arg = exitInstr;
+
+        for (auto leave : loops_.back().leaves)
+          instrs_[leave].arg = exitInstr;
+
+        loops_.pop_back();
+
+        --doDepth_;
+
+        break;
+      }
+      case Builtin::BEGIN_BUILTIN: {
+        const BeginTokens &beginTokens =
+          refCast<BeginBuiltin>(builtin)->getValue();
+
+        loops_.push_back(Loop());
+
+        int topInstr = int(instrs_.size());
+
+        if (beginTokens.is_until) {
+          if (! compileTokens(beginTokens.tokens)) return false;
+
+          addInstr(Instr(Instr::ZBRANCH_OP, topInstr));
+        }
+        else {
+          if (! compileTokens(beginTokens.whileTokens)) return false;
+
+          int whileInstr = addInstr(Instr(Instr::NZBRANCH_OP));
+
+          loops_.back().leaves.push_back(whileInstr);
+
+          if (! compileTokens(beginTokens.tokens)) return false;
+
+          addInstr(Instr(Instr::BRANCH_OP, topInstr));
+        }
+
+        int exitInstr = int(instrs_.size());
+
+        for (auto leave : loops_.back().leaves)
+          instrs_[leave].arg = exitInstr;
+
+        loops_.pop_back();
+
+        break;
+      }
+      case Builtin::LEAVE_BUILTIN: {
+        // leave outside compiled loop is handled dynamically by builtin
+        if (loops_.empty()) {
+          addInstr(Instr(Instr::EXEC_OP, 0, Cell::makeToken(token.get())));
+          break;
+        }
+
+        int leaveInstr = addInstr(Instr(Instr::BRANCH_OP));
+
+        loops_.back().leaves.push_back(leaveInstr);
+
+        break;
+      }
+      default: {
+        Builtin *builtin1 = builtin.get();
+
+        if (interp_->dispatchMode_ == SWITCH_DISPATCH && isCoreBuiltin(builtin1))
+          addInstr(Instr(Instr::BUILTIN_OP, int(builtin1->builtinType()),
+                         Cell::makeToken(builtin1)));
+        else
+          addInstr(Instr(Instr::EXEC_OP, 0, Cell::makeToken(builtin1)));
+
+        break;
+      }
+    }
+  }
+  else if (token->isVariable()) {
+    VariableP var = Variable::fromToken(token);
+
+    if (var->isConstant())
+      addInstr(Instr(Instr::LITERAL_OP, 0, var->value()));
+    else
+      addInstr(Instr(Instr::VARIABLE_OP, 0, Cell::makeToken(var.get())));
+  }
+  else if (token->isExecutable())
+    addInstr(Instr(Instr::EXEC_OP, 0, Cell::makeToken(token.get())));
+  else
+    addInstr(Instr(Instr::LITERAL_OP, 0, Cell::fromToken(token)));
+
+  return true;
+}
+
+int
+Code::
+addInstr(const Instr &instr)
+{
+  instrs_.push_back(instr);
+
+  return int(instrs_.size() - 1);
+}
+
+// check if instruction arg is jump target
+static bool
+isJumpInstr(const Code::Instr &instr)
+{
+  switch (instr.op) {
+    case Code::Instr::BRANCH_OP:
+    case Code::Instr::ZBRANCH_OP:
+    case Code::Instr::NZBRANCH_OP:
+    case Code::Instr::LOOP_TEST_OP:
+    case Code::Instr::LOOP_OP:
+    case Code::Instr::PLOOP_OP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// get superinstruction for instruction pair.
+// Pairs are the most frequent in the profile of the data/*.forth samples
+// (variable fetch/store, literal operand and DUP * for squares).
+static bool
+fuseInstrPair(const Code::Instr &instr1, const Code::Instr &instr2, Code::Instr &fused)
+{
+  typedef Code::Instr Instr;
+
+  if (instr2.op != Instr::BUILTIN_OP)
+    return false;
+
+  Token *builtin2 = instr2.cell.token();
+
+  switch (instr1.op) {
+    case Instr::LITERAL_OP:
+      fused = Instr(Instr::LIT_BUILTIN_OP, instr2.arg, instr1.cell, builtin2);
+      return true;
+    case Instr::VARIABLE_OP:
+      if      (instr2.arg == Builtin::FETCH_BUILTIN)
+        fused = Instr(Instr::VAR_FETCH_OP, 0, instr1.cell, builtin2);
+      else if (instr2.arg == Builtin::STORE_BUILTIN)
+        fused = Instr(Instr::VAR_STORE_OP, 0, instr1.cell, builtin2);
+      else
+        return false;
+      return true;
+    case Instr::BUILTIN_OP:
+      if (instr1.arg != Builtin::DUP_BUILTIN || instr2.arg != Builtin::TIMES_BUILTIN)
+        return false;
+      fused = Instr(Instr::SQUARE_OP, 0, instr1.cell, builtin2);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// get literal operand superinstruction for type specialized instruction
+static bool
+fuseTypedInstrPair(const Code::Instr &instr1, const Code::Instr &instr2, Code::Instr &fused)
+{
+  typedef Code::Instr Instr;
+
+  if (instr1.op != Instr::LITERAL_OP)
+    return false;
+
+  if      (instr2.op == Instr::INT_OP)
+    fused = Instr(Instr::LIT_INT_OP , instr2.arg, instr1.cell, instr2.cell.token());
+  else if (instr2.op == Instr::REAL_OP)
+    fused = Instr(Instr::LIT_REAL_OP, instr2.arg, instr1.cell, instr2.cell.token());
+  else
+    return false;
+
+  return true;
+}
+
+// rewrite instructions and remap jumps. The rewrite function is passed the number
+// of instructions from pc which aren't jump targets (can be replaced) and returns the
+// number it replaced with the instructions added to out (or 0 to keep instruction).
+template<typename REWRITE>
+static bool
+rewriteInstrs(Code::Instrs &instrs, REWRITE rewrite)
+{
+  int n = int(instrs.size());
+
+  std::vector<bool> targets(n + 1, false);
+
+  for (const auto &instr : instrs) {
+    if (isJumpInstr(instr))
+      targets[instr.arg] = true;
+  }
+
+  Code::Instrs     newInstrs;
+  std::vector<int> pcs(n + 1);
+
+  bool changed = false;
+
+  int i = 0;
+
+  while (i < n) {
+    int numFree = 1;
+
+    while (i + numFree < n && ! targets[i + numFree])
+      ++numFree;
+
+    int pc = int(newInstrs.size());
+
+    int numReplaced = rewrite(instrs, i, numFree, newInstrs);
+
+    if (numReplaced > 0)
+      changed = true;
+    else {
+      newInstrs.push_back(instrs[i]);
+
+      numReplaced = 1;
+    }
+
+    for (int j = 0; j < numReplaced; ++j)
+      pcs[i++] = pc;
+  }
+
+  if (! changed)
+    return false;
+
+  pcs[n] = int(newInstrs.size());
+
+  for (auto &instr : newInstrs) {
+    if (isJumpInstr(instr))
+      instr.arg = pcs[instr.arg];
+  }
+
+  instrs.swap(newInstrs);
+
+  return true;
+}
+
+// replace instruction pairs with superinstructions (one dispatch per pair)
+void
+Code::
+fuseInstrs()
+{
+  rewriteInstrs(instrs_, [](const Instrs &instrs, int pc, int numFree, Instrs &out) {
+    Instr fused(Instr::LITERAL_OP);
+
+    if (numFree < 2 || (! fuseInstrPair     (instrs[pc], instrs[pc + 1], fused) &&
+                        ! fuseTypedInstrPair(instrs[pc], instrs[pc + 1], fused)))
+      return 0;
+
+    out.push_back(fused);
+
+    return 2;
+  });
+}
+
+//----------
+
+// get builtin type of builtin instruction (or NO_BUILTIN)
+static Builtin::BuiltinType
+instrBuiltinType(const Code::Instr &instr)
+{
+  if (instr.op != Code::Instr::BUILTIN_OP && instr.op != Code::Instr::EXEC_OP)
+    return Builtin::NO_BUILTIN;
+
+  Token *token = instr.cell.token();
+
+  if (! token->isBuiltin())
+    return Builtin::NO_BUILTIN;
+
+  return static_cast<Builtin *>(token)->builtinType();
+}
+
+// check if instruction is literal number (of specified integer value if not null)
+static bool
+isNumberLiteral(const Code::Instr &instr, const Integer *value=nullptr)
+{
+  if (instr.op != Code::Instr::LITERAL_OP || ! instr.cell.isNumber())
+    return false;
+
+  if (value)
+    return (instr.cell.isInteger() && instr.cell.integer() == *value);
+
+  return true;
+}
+
+// number of literal arguments of builtin which can be evaluated at compile time
+static int
+foldArgs(Builtin::BuiltinType type)
+{
+  switch (type) {
+    case Builtin::PLUS_BUILTIN   : case Builtin::MINUS_BUILTIN  :
+    case Builtin::TIMES_BUILTIN  : case Builtin::DIVIDE_BUILTIN :
+    case Builtin::MOD_BUILTIN    : case Builtin::MAX_BUILTIN    :
+    case Builtin::MIN_BUILTIN    : case Builtin::AND_BUILTIN    :
+    case Builtin::OR_BUILTIN     : case Builtin::XOR_BUILTIN    :
+    case Builtin::LESS_BUILTIN   : case Builtin::EQUAL_BUILTIN  :
+    case Builtin::GREATER_BUILTIN:
+      return 2;
+    case Builtin::NOT_BUILTIN    : case Builtin::PLUS1_BUILTIN  :
+    case Builtin::PLUS2_BUILTIN  : case Builtin::ABS_BUILTIN    :
+    case Builtin::NEGATE_BUILTIN :
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// evaluate builtin on literal instruction values (on top of data stack)
+static bool
+foldInstrs(const Code::Instr *args, int numArgs, const Code::Instr &op, Cell &result)
+{
+  Builtin::BuiltinType type = instrBuiltinType(op);
+
+  // leave divide by zero to run time
+  if ((type == Builtin::DIVIDE_BUILTIN || type == Builtin::MOD_BUILTIN) &&
+      args[1].cell.number().real() == 0.0)
+    return false;
+
+  auto depth = interp_->stack_.size();
+
+  for (int i = 0; i < numArgs; ++i)
+    interp_->stack_.push_back(args[i].cell);
+
+  bool rc = (static_cast<Builtin *>(op.cell.token())->exec() && interp_->stack_.size() == depth + 1);
+
+  if (rc)
+    result = interp_->stack_.back();
+
+  interp_->stack_.resize(depth);
+
+  return rc;
+}
+
+// fold constant expression at instruction (return number of instructions replaced)
+static int
+optimizeInstr(const Code::Instrs &instrs, int pc, int numFree, Code::Instrs &out)
+{
+  typedef Code::Instr Instr;
+
+  const Instr &instr = instrs[pc];
+
+  if (numFree < 2 || ! isNumberLiteral(instr))
+    return 0;
+
+  Builtin::BuiltinType type2 = instrBuiltinType(instrs[pc + 1]);
+
+  Cell result;
+
+  if (foldArgs(type2) == 1 && foldInstrs(&instr, 1, instrs[pc + 1], result)) {
+    out.push_back(Instr(Instr::LITERAL_OP, 0, result));
+    return 2;
+  }
+
+  if (numFree >= 3 && isNumberLiteral(instrs[pc + 1]) &&
+      foldArgs(instrBuiltinType(instrs[pc + 2])) == 2 &&
+      foldInstrs(&instr, 2, instrs[pc + 2], result)) {
+    out.push_back(Instr(Instr::LITERAL_OP, 0, result));
+    return 3;
+  }
+
+  return 0;
+}
+
+// fold constant expressions (repeated until no change so folded results can be
+// folded again)
+void
+Code::
+optimizeInstrs()
+{
+  while (rewriteInstrs(instrs_, optimizeInstr))
+    ;
+}
+
+//----------
+
+// declared stack effect of core builtins
+static bool
+builtinEffect(Builtin::BuiltinType type, StackEffect &effect)
+{
+  auto set = [&](int in, int out) { effect.known = true; effect.in = in; effect.out = out; };
+
+  switch (type) {
+    case Builtin::DUP_BUILTIN     : set(1, 2); break;
+    case Builtin::DROP_BUILTIN    : set(1, 0); break;
+    case Builtin::SWAP_BUILTIN    : set(2, 2); break;
+    case Builtin::OVER_BUILTIN    : set(2, 3); break;
+    case Builtin::ROT_BUILTIN     : set(3, 3); break;
+    case Builtin::DEPTH_BUILTIN   : set(0, 1); break;
+    case Builtin::POP_RET_BUILTIN : set(1, 0); break; // >R
+    case Builtin::PUSH_RET_BUILTIN: set(0, 1); break; // R>
+    case Builtin::COPY_RET_BUILTIN: set(0, 1); break;
+
+    case Builtin::LESS_BUILTIN    : case Builtin::EQUAL_BUILTIN   :
+    case Builtin::GREATER_BUILTIN : case Builtin::ULESS_BUILTIN   :
+    case Builtin::PLUS_BUILTIN    : case Builtin::MINUS_BUILTIN   :
+    case Builtin::TIMES_BUILTIN   : case Builtin::DIVIDE_BUILTIN  :
+    case Builtin::MOD_BUILTIN     : case Builtin::MAX_BUILTIN     :
+    case Builtin::MIN_BUILTIN     : case Builtin::AND_BUILTIN     :
+    case Builtin::OR_BUILTIN      : case Builtin::XOR_BUILTIN     : set(2, 1); break;
+
+    case Builtin::NOT_BUILTIN     : case Builtin::PLUS1_BUILTIN   :
+    case Builtin::PLUS2_BUILTIN   : case Builtin::ABS_BUILTIN     :
+    case Builtin::NEGATE_BUILTIN  : case Builtin::FETCH_BUILTIN   :
+    case Builtin::WORD_BUILTIN    : set(1, 1); break;
+
+    case Builtin::DMOD_BUILTIN    : set(2, 2); break;
+    case Builtin::MULDIV_BUILTIN  : set(3, 1); break;
+    case Builtin::DPLUS_BUILTIN   : set(4, 2); break;
+    case Builtin::DNEGATE_BUILTIN : set(2, 2); break;
+    case Builtin::UTIMES_BUILTIN  : set(2, 2); break;
+    case Builtin::UDMOD_BUILTIN   : set(3, 2); break;
+    case Builtin::MULDMOD_BUILTIN : set(3, 2); break;
+    case Builtin::STORE_BUILTIN   : set(2, 0); break;
+    case Builtin::PFETCH_BUILTIN  : set(1, 0); break;
+    case Builtin::ADDSTORE_BUILTIN: set(2, 0); break;
+
+    case Builtin::MOVE_BUILTIN    : case Builtin::CMOVE_BUILTIN   :
+    case Builtin::CMOVE_UP_BUILTIN: case Builtin::FILL_BUILTIN    : set(3, 0); break;
+
+    case Builtin::ERASE_BUILTIN   : set(2, 0); break;
+    case Builtin::I_BUILTIN       : set(0, 1); break;
+    case Builtin::J_BUILTIN       : set(0, 1); break;
+    case Builtin::EMIT_BUILTIN    : set(1, 0); break;
+    case Builtin::TYPE_BUILTIN    : set(2, 0); break;
+    case Builtin::COUNT_BUILTIN   : set(1, 2); break;
+    case Builtin::TRAILING_BUILTIN: set(2, 2); break;
+    case Builtin::KEY_BUILTIN     : set(0, 1); break;
+    case Builtin::EXPECT_BUILTIN  : set(2, 0); break;
+    case Builtin::QUERY_BUILTIN   : set(0, 0); break;
+    case Builtin::DECIMAL_BUILTIN : set(0, 0); break;
+    case Builtin::PRINT_BUILTIN   : set(1, 0); break;
+    case Builtin::PSTACK_BUILTIN  : set(0, 0); break;
+    case Builtin::COMMA_BUILTIN   : set(1, 0); break;
+    case Builtin::ALLOT_BUILTIN   : set(1, 0); break;
+    case Builtin::HERE_BUILTIN    : set(0, 1); break;
+
+    // data stack effect of float words
+    case Builtin::FPLUS_BUILTIN   : case Builtin::FMINUS_BUILTIN  :
+    case Builtin::FTIMES_BUILTIN  : case Builtin::FDIVIDE_BUILTIN :
+    case Builtin::FDUP_BUILTIN    : case Builtin::FDROP_BUILTIN   :
+    case Builtin::FSWAP_BUILTIN   : case Builtin::FSQRT_BUILTIN   :
+    case Builtin::FPRINT_BUILTIN  : set(0, 0); break;
+    case Builtin::FFETCH_BUILTIN  : set(1, 0); break;
+    case Builtin::FSTORE_BUILTIN  : set(1, 0); break;
+    case Builtin::FLESS_BUILTIN   : set(0, 1); break;
+    case Builtin::STOF_BUILTIN    : set(1, 0); break;
+    case Builtin::FTOS_BUILTIN    : set(0, 1); break;
+
+    // PICK, ROLL, ?DUP depend on data, defining words on input
+    default: return false;
+  }
+
+  return true;
+}
+
+// variable only pushes its address and always will. DOES> code can be added to any
+// variable that is not frozen (see setDoesFunction) which would leave the effect and
+// types inferred for already compiled callers stale.
+static bool
+isFixedVariable(const Variable *var)
+{
+  return (var->isFrozen() && ! var->hasExecTokens());
+}
+
+bool
+tokenEffect(Token *token, StackEffect &effect)
+{
+  effect = StackEffect();
+
+  if      (token->isBuiltin()) {
+    Builtin *builtin = static_cast<Builtin *>(token);
+
+    // user builtins can reuse core types
+    if (builtin->builtinType() >= Builtin::USER_BUILTIN)
+      return false;
+
+    return builtinEffect(builtin->builtinType(), effect);
+  }
+  else if (token->isProcedure()) {
+    effect = static_cast<Procedure *>(token)->code().effect();
+  }
+  else if (token->isVariable()) {
+    if (! isFixedVariable(static_cast<Variable *>(token)))
+      return false;
+
+    effect.known = true; effect.in = 0; effect.out = 1;
+  }
+
+  return effect.known;
+}
+
+// combined effect of effect1 followed by effect2
+static StackEffect
+composeEffect(const StackEffect &effect1, const StackEffect &effect2)
+{
+  StackEffect effect;
+
+  effect.known = (effect1.known && effect2.known);
+  effect.in    = effect1.in + std::max(0, effect2.in - effect1.out);
+  effect.out   = effect.in - effect1.in + effect1.out - effect2.in + effect2.out;
+
+  return effect;
+}
+
+static bool
+instrEffect(const Code::Instr &instr, StackEffect &effect)
+{
+  typedef Code::Instr Instr;
+
+  StackEffect push; push.known = true; push.out = 1;
+  StackEffect pop ; pop .known = true; pop .in  = 1;
+
+  effect = StackEffect();
+
+  switch (instr.op) {
+    case Instr::LITERAL_OP:
+      effect = push;
+      break;
+    case Instr::VARIABLE_OP:
+    case Instr::EXEC_OP:
+    case Instr::BUILTIN_OP:
+      tokenEffect(instr.cell.token(), effect);
+      break;
+    case Instr::BRANCH_OP:
+    case Instr::LOOP_TEST_OP:
+    case Instr::LOOP_OP:
+    case Instr::UNLOOP_OP:
+      effect.known = true;
+      break;
+    case Instr::ZBRANCH_OP:
+    case Instr::NZBRANCH_OP:
+    case Instr::PLOOP_OP:
+      effect = pop;
+      break;
+    case Instr::DO_OP:
+      effect.known = true; effect.in = 2;
+      break;
+    case Instr::LIT_BUILTIN_OP: {
+      StackEffect effect2;
+
+      tokenEffect(instr.token, effect2);
+
+      effect = composeEffect(push, effect2);
+
+      break;
+    }
+    case Instr::VAR_FETCH_OP:
+    case Instr::VAR_STORE_OP:
+      if (! isFixedVariable(static_cast<Variable *>(instr.cell.token())))
+        break;
+
+      effect = (instr.op == Instr::VAR_FETCH_OP ? push : pop);
+
+      break;
+    case Instr::SQUARE_OP:
+    case Instr::LIT_INT_OP:
+    case Instr::LIT_REAL_OP:
+      effect.known = true; effect.in = 1; effect.out = 1;
+      break;
+    case Instr::INT_OP:
+    case Instr::REAL_OP:
+      effect.known = true; effect.in = 2; effect.out = 1;
+      break;
+    default:
+      break;
+  }
+
+  return effect.known;
+}
+
+// infer stack effect by tracking depth (relative to entry) along all paths.
+// Unknown if any instruction effect is unknown or paths join with different depths.
+void
+Code::
+analyzeEffect()
+{
+  const int UNSET = INT_MIN;
+
+  int n = int(instrs_.size());
+
+  std::vector<int> depths(n + 1, UNSET);
+  std::vector<int> todo;
+
+  auto reach = [&](int pc, int depth) {
+    if (depths[pc] == UNSET) {
+      depths[pc] = depth;
+
+      todo.push_back(pc);
+    }
+
+    return (depths[pc] == depth);
+  };
+
+  reach(0, 0);
+
+  int low = 0;
+
+  while (! todo.empty()) {
+    int pc = todo.back(); todo.pop_back();
+
+    if (pc == n) continue;
+
+    const Instr &instr = instrs_[pc];
+
+    StackEffect effect;
+
+    if (! instrEffect(instr, effect))
+      return;
+
+    int depth = depths[pc];
+
+    low = std::min(low, depth - effect.in);
+
+    depth += effect.out - effect.in;
+
+    bool ok;
+
+    switch (instr.op) {
+      case Instr::BRANCH_OP:
+      case Instr::LOOP_OP:
+      case Instr::PLOOP_OP:
+        ok = reach(instr.arg, depth);
+        break;
+      case Instr::ZBRANCH_OP:
+      case Instr::NZBRANCH_OP:
+      case Instr::LOOP_TEST_OP:
+        ok = (reach(instr.arg, depth) && reach(pc + 1, depth));
+        break;
+      default:
+        ok = reach(pc + 1, depth);
+        break;
+    }
+
+    if (! ok)
+      return;
+  }
+
+  // no exit
+  if (depths[n] == UNSET)
+    return;
+
+  effect_.known = true;
+  effect_.in    = -low;
+  effect_.out   = -low + depths[n];
+}
+
+//----------
+
+// inferred types of stack cells (NO_CELL if unknown)
+typedef std::vector<Cell::Type> CellTypes;
+
+// inferred types of data stack cells and of active DO loop indices (innermost last)
+struct TypeState {
+  CellTypes cells;
+  CellTypes loops;
+};
+
+// check builtin can be type specialized
+static bool
+isTypedBuiltin(int type)
+{
+  switch (type) {
+    case Builtin::PLUS_BUILTIN: case Builtin::MINUS_BUILTIN: case Builtin::TIMES_BUILTIN:
+    case Builtin::LESS_BUILTIN: case Builtin::EQUAL_BUILTIN: case Builtin::GREATER_BUILTIN:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// result type of arithmetic (Number::doOp) on operand types
+static Cell::Type
+arithType(Cell::Type t1, Cell::Type t2)
+{
+  if (t1 == Cell::REAL_CELL || t2 == Cell::REAL_CELL)
+    return Cell::REAL_CELL;
+
+  auto isInt = [](Cell::Type t) {
+    return (t == Cell::INTEGER_CELL || t == Cell::BOOLEAN_CELL); };
+
+  if (isInt(t1) && isInt(t2))
+    return Cell::INTEGER_CELL;
+
+  return Cell::NO_CELL;
+}
+
+// update cell types for instruction (assumes instruction succeeds)
+static void
+instrTypes(const Code::Instr &instr, TypeState &state)
+{
+  typedef Code::Instr Instr;
+
+  CellTypes &types = state.cells;
+  CellTypes &loops = state.loops;
+
+  auto pop  = [&]() { Cell::Type t = types.back(); types.pop_back(); return t; };
+  auto push = [&](Cell::Type t) { types.push_back(t); };
+
+  // loop index (0 innermost) is unknown if not in a DO of this code
+  auto loopType = [&](size_t i) {
+    return (i < loops.size() ? loops[loops.size() - 1 - i] : Cell::NO_CELL); };
+
+  auto n = types.size();
+
+  switch (instr.op) {
+    case Instr::DO_OP: {
+      // index stays an integer only if start and limit are integers (DO accepts reals)
+      Cell::Type t2 = pop(), t1 = pop();
+
+      bool isInt = (t1 == Cell::INTEGER_CELL && t2 == Cell::INTEGER_CELL);
+
+      loops.push_back(isInt ? Cell::INTEGER_CELL : Cell::NO_CELL);
+
+      return;
+    }
+    case Instr::PLOOP_OP: {
+      if (pop() != Cell::INTEGER_CELL && ! loops.empty())
+        loops.back() = Cell::NO_CELL;
+
+      return;
+    }
+    case Instr::UNLOOP_OP:
+      if (! loops.empty())
+        loops.pop_back();
+
+      return;
+    case Instr::LITERAL_OP:
+      push(instr.cell.isToken() ? Cell::NO_CELL : instr.cell.type());
+      return;
+    case Instr::VARIABLE_OP:
+      if (! isFixedVariable(static_cast<Variable *>(instr.cell.token())))
+        break;
+
+      push(Cell::INTEGER_CELL);
+      return;
+    case Instr::BUILTIN_OP:
+    case Instr::EXEC_OP: {
+      if (! instr.cell.token()->isBuiltin()) break;
+
+      switch (static_cast<Builtin *>(instr.cell.token())->builtinType()) {
+        case Builtin::DUP_BUILTIN : push(types[n - 1]); return;
+        case Builtin::DROP_BUILTIN: pop(); return;
+        case Builtin::SWAP_BUILTIN: std::swap(types[n - 2], types[n - 1]); return;
+        case Builtin::OVER_BUILTIN: push(types[n - 2]); return;
+        case Builtin::ROT_BUILTIN : std::rotate(&types[n - 3], &types[n - 2], &types[n]); return;
+
+        case Builtin::I_BUILTIN: push(loopType(0)); return;
+        case Builtin::J_BUILTIN: push(loopType(1)); return;
+
+        case Builtin::DEPTH_BUILTIN: case Builtin::HERE_BUILTIN:
+        case Builtin::KEY_BUILTIN  :
+          push(Cell::INTEGER_CELL); return;
+
+        case Builtin::PLUS_BUILTIN  : case Builtin::MINUS_BUILTIN :
+        case Builtin::TIMES_BUILTIN : case Builtin::DIVIDE_BUILTIN:
+        case Builtin::MAX_BUILTIN   : case Builtin::MIN_BUILTIN   : {
+          Cell::Type t2 = pop(), t1 = pop(); push(arithType(t1, t2)); return;
+        }
+        case Builtin::PLUS1_BUILTIN: case Builtin::PLUS2_BUILTIN :
+        case Builtin::ABS_BUILTIN  : case Builtin::NEGATE_BUILTIN: {
+          Cell::Type t = pop(); push(arithType(t, Cell::INTEGER_CELL)); return;
+        }
+        case Builtin::LESS_BUILTIN   : case Builtin::EQUAL_BUILTIN:
+        case Builtin::GREATER_BUILTIN: case Builtin::ULESS_BUILTIN:
+          pop(); pop(); push(Cell::BOOLEAN_CELL); return;
+        case Builtin::FLESS_BUILTIN:
+          push(Cell::BOOLEAN_CELL); return;
+        case Builtin::FTOS_BUILTIN:
+          push(Cell::INTEGER_CELL); return;
+        default:
+          break;
+      }
+
+      break;
+    }
+    default:
+      break;
+  }
+
+  // other instructions produce unknown types
+  StackEffect effect;
+
+  instrEffect(instr, effect);
+
+  types.resize(n - effect.in);
+  types.resize(n - effect.in + effect.out, Cell::NO_CELL);
+}
+
+// infer cell types at each instruction along all paths (types unknown at entry and
+// where paths join with different types). seen is false for unreachable instructions.
+static void
+inferTypes(const Code::Instrs &instrs, int numIn, std::vector<TypeState> &states,
+           std::vector<bool> &seen)
+{
+  typedef Code::Instr Instr;
+
+  int n = int(instrs.size());
+
+  states.assign(n + 1, TypeState());
+  seen  .assign(n + 1, false);
+
+  std::vector<int> todo;
+
+  // set differing types to unknown (paths joining at same pc have same depths)
+  auto merge = [](CellTypes &types1, const CellTypes &types2) {
+    bool changed = false;
+
+    for (size_t i = 0; i < types2.size(); ++i) {
+      if (types1[i] != types2[i] && types1[i] != Cell::NO_CELL) {
+        types1[i] = Cell::NO_CELL;
+
+        changed = true;
+      }
+    }
+
+    return changed;
+  };
+
+  auto reach = [&](int pc, const TypeState &types) {
+    if (! seen[pc]) {
+      seen  [pc] = true;
+      states[pc] = types;
+    }
+    else {
+      bool changed1 = merge(states[pc].cells, types.cells);
+      bool changed2 = merge(states[pc].loops, types.loops);
+
+      if (! changed1 && ! changed2)
+        return;
+    }
+
+    todo.push_back(pc);
+  };
+
+  // entry cells (effect in) and loop indices of caller are unknown
+  TypeState entry;
+
+  entry.cells = CellTypes(numIn, Cell::NO_CELL);
+
+  reach(0, entry);
+
+  while (! todo.empty()) {
+    int pc = todo.back(); todo.pop_back();
+
+    if (pc == n) continue;
+
+    const Instr &instr = instrs[pc];
+
+    TypeState types = states[pc];
+
+    instrTypes(instr, types);
+
+    switch (instr.op) {
+      case Instr::BRANCH_OP:
+      case Instr::LOOP_OP:
+      case Instr::PLOOP_OP:
+        reach(instr.arg, types);
+        break;
+      case Instr::ZBRANCH_OP:
+      case Instr::NZBRANCH_OP:
+      case Instr::LOOP_TEST_OP:
+        reach(instr.arg, types);
+        reach(pc + 1   , types);
+        break;
+      default:
+        reach(pc + 1, types);
+        break;
+    }
+  }
+}
+
+// replace arithmetic on known types with INT_OP/REAL_OP. Real ops are also used
+// when only one operand is known to be real (doOp uses real arithmetic if either
+// is real) with the other checked at run time.
+void
+Code::
+specializeTypes()
+{
+  int n = int(instrs_.size());
+
+  std::vector<TypeState> states;
+  std::vector<bool>      seen;
+
+  inferTypes(instrs_, effect_.in, states, seen);
+
+  for (int pc = 0; pc < n; ++pc) {
+    Instr &instr = instrs_[pc];
+
+    if (! seen[pc] || instr.op != Instr::BUILTIN_OP || ! isTypedBuiltin(instr.arg))
+      continue;
+
+    const CellTypes &types = states[pc].cells;
+
+    Cell::Type t1 = types[types.size() - 2];
+    Cell::Type t2 = types[types.size() - 1];
+
+    if      (t1 == Cell::INTEGER_CELL && t2 == Cell::INTEGER_CELL)
+      instr.op = Instr::INT_OP;
+    else if (t1 == Cell::REAL_CELL || t2 == Cell::REAL_CELL)
+      instr.op = Instr::REAL_OP;
+  }
+}
+
+// remove instructions with no effect (SWAP SWAP, DUP DROP, 0 +, 0 -, 1 *, 1 /).
+// They are only removed if their operands are pushed by this code (so removal
+// can't hide a stack underflow or change the stack effect) and arithmetic is
+// only removed for numbers (it converts a boolean to an integer).
+// Returns true if any removed.
+bool
+Code::
+simplifyInstrs()
+{
+  static const Integer zero = 0, one = 1;
+
+  std::vector<TypeState> states;
+  std::vector<bool>      seen;
+
+  inferTypes(instrs_, effect_.in, states, seen);
+
+  int numIn = effect_.in;
+
+  auto rewrite = [&](const Instrs &instrs, int pc, int numFree, Instrs &) {
+    if (numFree < 2 || ! seen[pc])
+      return 0;
+
+    const Instr     &instr = instrs[pc];
+    const CellTypes &types = states[pc].cells;
+
+    // number of cells pushed by this code
+    int numPushed = int(types.size()) - numIn;
+
+    Builtin::BuiltinType type1 = instrBuiltinType(instr);
+    Builtin::BuiltinType type2 = instrBuiltinType(instrs[pc + 1]);
+
+    // SWAP SWAP, DUP DROP
+    if ((type1 == Builtin::SWAP_BUILTIN && type2 == Builtin::SWAP_BUILTIN && numPushed >= 2) ||
+        (type1 == Builtin::DUP_BUILTIN  && type2 == Builtin::DROP_BUILTIN && numPushed >= 1))
+      return 2;
+
+    // 0 +, 0 -, 1 *, 1 /
+    if (numPushed < 1 || (types.back() != Cell::INTEGER_CELL && types.back() != Cell::REAL_CELL))
+      return 0;
+
+    if ((isNumberLiteral(instr, &zero) &&
+         (type2 == Builtin::PLUS_BUILTIN  || type2 == Builtin::MINUS_BUILTIN)) ||
+        (isNumberLiteral(instr, &one) &&
+         (type2 == Builtin::TIMES_BUILTIN || type2 == Builtin::DIVIDE_BUILTIN)))
+      return 2;
+
+    return 0;
+  };
+
+  return rewriteInstrs(instrs_, rewrite);
+}
+
+// instruction implementations shared by Code::exec and native code
+
+State
+execVariable(Variable *var)
+{
+  interp_->currentVar_ = var;
+
+  pushCell(Cell::makeInteger(var->addr()));
+
+  if (var->hasExecTokens() && ! var->execTokens())
+    return State::lastError();
+
+  return State::success();
+}
+
+inline State
+execVariableInstr(const Code::Instr &instr)
+{
+  return execVariable(static_cast<Variable *>(instr.cell.token()));
+}
+
+inline State
+execTokenInstr(const Code::Instr &instr)
+{
+  Token *token = instr.cell.token();
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Exec: ";
+    token->print(output());
+    output() << std::endl;
+  }
+
+  return token->exec();
+}
+
+inline State
+execBuiltinInstr(const Code::Instr &instr)
+{
+  Builtin *builtin = static_cast<Builtin *>(instr.cell.token());
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Exec: ";
+    builtin->print(output());
+    output() << std::endl;
+  }
+
+  return execCoreBuiltin(builtin, instr.arg);
+}
+
+inline State
+execLitBuiltinInstr(const Code::Instr &instr)
+{
+  pushCell(instr.cell);
+
+  return execCoreBuiltin(static_cast<Builtin *>(instr.token), instr.arg);
+}
+
+// integer arithmetic and compare on cells known to be integers (same results as
+// Number::doOp and cmpOp)
+static inline Cell
+intBinaryOp(int type, const Cell &c1, const Cell &c2)
+{
+  Integer i1 = c1.integer(), i2 = c2.integer();
+
+  switch (type) {
+    case Builtin::PLUS_BUILTIN   : return Cell::makeInteger(i1 + i2);
+    case Builtin::MINUS_BUILTIN  : return Cell::makeInteger(i1 - i2);
+    case Builtin::TIMES_BUILTIN  : return Cell::makeInteger(i1 * i2);
+    case Builtin::LESS_BUILTIN   : return Cell::makeBoolean(i1 < i2);
+    case Builtin::EQUAL_BUILTIN  : return Cell::makeBoolean(i1 == i2);
+    case Builtin::GREATER_BUILTIN: return Cell::makeBoolean(i1 > i2);
+    default                      : assert(false); return Cell();
+  }
+}
+
+// real arithmetic and compare when either cell is real (false if not numbers).
+// Compare matches cmpOp which truncates the difference to an integer.
+static inline bool
+realBinaryOp(int type, const Cell &c1, const Cell &c2, Cell &res)
+{
+  if ((! c1.isNumber() && ! c1.isBoolean()) || (! c2.isNumber() && ! c2.isBoolean()))
+    return false;
+
+  double r1 = c1.real(), r2 = c2.real();
+
+  switch (type) {
+    case Builtin::PLUS_BUILTIN   : res = Cell::makeReal(r1 + r2); break;
+    case Builtin::MINUS_BUILTIN  : res = Cell::makeReal(r1 - r2); break;
+    case Builtin::TIMES_BUILTIN  : res = Cell::makeReal(r1 * r2); break;
+    case Builtin::LESS_BUILTIN   : res = Cell::makeBoolean(r1 - r2 <= -1.0); break;
+    case Builtin::EQUAL_BUILTIN  : res = Cell::makeBoolean(std::fabs(r1 - r2) < 1.0); break;
+    case Builtin::GREATER_BUILTIN: res = Cell::makeBoolean(r1 - r2 >= 1.0); break;
+    default                      : assert(false); return false;
+  }
+
+  return true;
+}
+
+inline State
+execIntInstr(const Code::Instr &instr)
+{
+  auto nt = interp_->stack_.size();
+
+  if (nt < 2)
+    return execCoreBuiltin(static_cast<Builtin *>(instr.cell.token()), instr.arg);
+
+  interp_->stack_[nt - 2] = intBinaryOp(instr.arg, interp_->stack_[nt - 2], interp_->stack_[nt - 1]);
+
+  interp_->stack_.pop_back();
+
+  return State::success();
+}
+
+inline State
+execRealInstr(const Code::Instr &instr)
+{
+  auto nt = interp_->stack_.size();
+
+  Cell res;
+
+  if (nt < 2 || ! realBinaryOp(instr.arg, interp_->stack_[nt - 2], interp_->stack_[nt - 1], res))
+    return execCoreBuiltin(static_cast<Builtin *>(instr.cell.token()), instr.arg);
+
+  interp_->stack_[nt - 2] = res;
+
+  interp_->stack_.pop_back();
+
+  return State::success();
+}
+
+inline State
+execLitIntInstr(const Code::Instr &instr)
+{
+  if (interp_->stack_.empty())
+    return execLitBuiltinInstr(instr);
+
+  interp_->stack_.back() = intBinaryOp(instr.arg, interp_->stack_.back(), instr.cell);
+
+  return State::success();
+}
+
+inline State
+execLitRealInstr(const Code::Instr &instr)
+{
+  Cell res;
+
+  if (interp_->stack_.empty() || ! realBinaryOp(instr.arg, interp_->stack_.back(), instr.cell, res))
+    return execLitBuiltinInstr(instr);
+
+  interp_->stack_.back() = res;
+
+  return State::success();
+}
+
+
+inline State
+execVarFetchInstr(const Code::Instr &instr)
+{
+  Variable *var = static_cast<Variable *>(instr.cell.token());
+
+  // DOES> code runs between push of address and fetch
+  if (var->hasExecTokens()) {
+    if (! execVariable(var)) return State::lastError();
+
+    return static_cast<FetchBuiltin *>(instr.token)->FetchBuiltin::exec();
+  }
+
+  interp_->currentVar_ = var;
+
+  Cell value = interp_->memory_.get(var->addr());
+
+  if (! value.isValid()) return State::error("invalid variable");
+
+  interp_->stack_.push_back(value);
+
+  return State::success();
+}
+
+inline State
+execVarStoreInstr(const Code::Instr &instr)
+{
+  Variable *var = static_cast<Variable *>(instr.cell.token());
+
+  if (var->hasExecTokens()) {
+    if (! execVariable(var)) return State::lastError();
+
+    return static_cast<StoreBuiltin *>(instr.token)->StoreBuiltin::exec();
+  }
+
+  interp_->currentVar_ = var;
+
+  if (interp_->stack_.empty()) return State::error("STACK UNDERFLOW");
+
+  if (! interp_->memory_.set(var->addr(), interp_->stack_.back())) return State::error("invalid variable");
+
+  interp_->stack_.pop_back();
+
+  return State::success();
+}
+
+inline State
+execSquareInstr(const Code::Instr &instr)
+{
+  if (! interp_->stack_.empty() && interp_->stack_.back().isNumber()) {
+    Cell &cell = interp_->stack_.back();
+
+    Number n = cell.number();
+
+    cell = Cell::makeNumber(Number::times(n, n));
+
+    return State::success();
+  }
+
+  // errors and booleans handled by builtins
+  if (! static_cast<DupBuiltin *>(instr.cell.token())->DupBuiltin::exec())
+    return State::lastError();
+
+  return static_cast<TimesBuiltin *>(instr.token)->TimesBuiltin::exec();
+}
+
+#ifdef CFORTH_TRACE
+// name of instruction for profile
+static std::string
+instrName(const Code::Instr &instr)
+{
+  typedef Code::Instr Instr;
+
+  auto tokenName = [](Token *token) {
+    if (token->isProcedure())
+      return static_cast<Procedure *>(token)->name();
+
+    std::ostringstream ss; token->print(ss); return ss.str();
+  };
+
+  switch (instr.op) {
+    case Instr::LITERAL_OP    : return "<literal>";
+    case Instr::VARIABLE_OP   : return "<variable>";
+    case Instr::EXEC_OP       : return tokenName(instr.cell.token());
+    case Instr::BUILTIN_OP    : return tokenName(instr.cell.token());
+    case Instr::BRANCH_OP     : return "<branch>";
+    case Instr::ZBRANCH_OP    : return "<0branch>";
+    case Instr::NZBRANCH_OP   : return "<branch0>";
+    case Instr::DO_OP         : return "<do>";
+    case Instr::LOOP_TEST_OP  : return "<loop_test>";
+    case Instr::LOOP_OP       : return "<loop>";
+    case Instr::PLOOP_OP      : return "<+loop>";
+    case Instr::UNLOOP_OP     : return "<unloop>";
+    case Instr::LIT_BUILTIN_OP: return "<literal>" + tokenName(instr.token);
+    case Instr::VAR_FETCH_OP  : return "<variable>@";
+    case Instr::VAR_STORE_OP  : return "<variable>!";
+    case Instr::SQUARE_OP     : return "DUP*";
+    case Instr::INT_OP        : return "int:" + tokenName(instr.cell.token());
+    case Instr::REAL_OP       : return "real:" + tokenName(instr.cell.token());
+    case Instr::LIT_INT_OP    : return "<literal>int:" + tokenName(instr.token);
+    case Instr::LIT_REAL_OP   : return "<literal>real:" + tokenName(instr.token);
+    default                   : return "<unknown>";
+  }
+}
+
+// count dispatch of instruction and pair with previous (if adjacent)
+static void
+profileInstr(const Code::Instr *prev, const Code::Instr *instr)
+{
+  ++interp_->profileDispatches_;
+
+  if (prev && prev + 1 == instr)
+    ++interp_->profilePairs_[instrName(*prev) + " " + instrName(*instr)];
+}
+#endif
+
+State
+loopStart(bool &up)
+{
+  Cell startCell, endCell;
+
+  if (! popCells(endCell, startCell)) return State::lastError();
+
+  if (startCell.isInteger() && endCell.isInteger())
+    up = (endCell.integer() > startCell.integer());
+  else {
+    int cmp;
+
+    if (! Cell::cmp(endCell, startCell, cmp)) return State::lastError();
+
+    up = (cmp > 0);
+  }
+
+  // push start (loop index) and end on return stack
+  interp_->retStack_.push_back(startCell);
+  interp_->retStack_.push_back(endCell  );
+
+  return State::success();
+}
+
+State
+loopTest(bool up, bool &done)
+{
+  auto nr = interp_->retStack_.size();
+
+  if (nr < 2) return State::error("Return stack corrupted");
+
+  const Cell &index = interp_->retStack_[nr - 2];
+  const Cell &limit = interp_->retStack_[nr - 1];
+
+  // native compare of integer counters
+  if (index.isInteger() && limit.isInteger()) {
+    Integer i = index.integer(), l = limit.integer();
+
+    done = (up ? l <= i : l >= i);
+  }
+  else {
+    int cmp;
+
+    if (! Cell::cmp(limit, index, cmp)) return State::lastError();
+
+    done = (up ? cmp <= 0 : cmp >= 0);
+  }
+
+  return State::success();
+}
+
+State
+loopNext()
+{
+  auto nr = interp_->retStack_.size();
+
+  if (nr < 2) return State::error("Return stack corrupted");
+
+  Cell &index = interp_->retStack_[nr - 2];
+
+  if (index.isInteger())
+    index.addInteger(1);
+  else {
+    if (! index.inc(Number::makeInteger(1))) return State::lastError();
+  }
+
+  return State::success();
+}
+
+State
+loopNextBy()
+{
+  Cell incCell;
+
+  if (! popCell(incCell)) return State::lastError();
+
+  auto nr = interp_->retStack_.size();
+
+  if (nr < 2) return State::error("Return stack corrupted");
+
+  Cell &index = interp_->retStack_[nr - 2];
+
+  if      (index.isInteger() && incCell.isInteger())
+    index.addInteger(incCell.integer());
+  else if (incCell.isNumber() || incCell.isBoolean()) {
+    if (! index.inc(incCell.number())) return State::lastError();
+  }
+  else
+    return State::error("must be number");
+
+  return State::success();
+}
+
+State
+loopEnd()
+{
+  if (interp_->retStack_.size() < 2) return State::error("Return stack corrupted");
+
+  interp_->retStack_.pop_back();
+  interp_->retStack_.pop_back();
+
+  return State::success();
+}
+
+// execute instruction and update pc (ups is loop direction for each active DO)
+static inline State
+execInstr(const Code::Instr &instr, int &pc, bool *ups)
+{
+  typedef Code::Instr Instr;
+
+  switch (instr.op) {
+    case Instr::LITERAL_OP: {
+      pushCell(instr.cell);
+
+      ++pc;
+
+      break;
+    }
+    case Instr::VARIABLE_OP: {
+      if (! execVariableInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::EXEC_OP: {
+      if (! execTokenInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::BUILTIN_OP: {
+      if (! execBuiltinInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::BRANCH_OP: {
+      pc = instr.arg;
+
+      break;
+    }
+    case Instr::ZBRANCH_OP: {
+      bool b;
+
+      if (! popBoolean(b)) return State::lastError();
+
+      pc = (! b ? instr.arg : pc + 1);
+
+      break;
+    }
+    case Instr::NZBRANCH_OP: {
+      bool b;
+
+      if (! popBoolean(b)) return State::lastError();
+
+      pc = (b ? instr.arg : pc + 1);
+
+      break;
+    }
+    case Instr::DO_OP: {
+      if (! loopStart(ups[instr.cell.integer()])) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::LOOP_TEST_OP: {
+      bool done;
+
+      if (! loopTest(ups[instr.cell.integer()], done)) return State::lastError();
+
+      pc = (done ? instr.arg : pc + 1);
+
+      break;
+    }
+    case Instr::LOOP_OP: {
+      if (! loopNext()) return State::lastError();
+
+      pc = instr.arg;
+
+      break;
+    }
+    case Instr::PLOOP_OP: {
+      if (! loopNextBy()) return State::lastError();
+
+      pc = instr.arg;
+
+      break;
+    }
+    case Instr::UNLOOP_OP: {
+      if (! loopEnd()) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::LIT_BUILTIN_OP: {
+      if (! execLitBuiltinInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::VAR_FETCH_OP: {
+      if (! execVarFetchInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::VAR_STORE_OP: {
+      if (! execVarStoreInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::SQUARE_OP: {
+      if (! execSquareInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::INT_OP: {
+      if (! execIntInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::REAL_OP: {
+      if (! execRealInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::LIT_INT_OP: {
+      if (! execLitIntInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    case Instr::LIT_REAL_OP: {
+      if (! execLitRealInstr(instr)) return State::lastError();
+
+      ++pc;
+
+      break;
+    }
+    default:
+      assert(false);
+      break;
+  }
+
+  return State::success();
+}
+
+State
+Code::
+exec() const
+{
+  if (fn_)
+    return fn_();
+
+  if (const Native *native = nativeCode())
+    return execNative(native);
+
+  if (interp_->stackCache_ && ! isDebug() && ! isProfile()) {
+    // depth checked once on entry if stack effect known
+    if (effect_.known && int(interp_->stack_.size()) >= effect_.in)
+      return execCached<false>();
+
+    return execCached<true>();
+  }
+
+  // loop direction for each active DO (by nesting depth)
+  bool ups[MAX_LOOP_DEPTH];
+
+  const Instr *instrs = instrs_.data();
+
+  int pc = 0;
+  int n  = int(instrs_.size());
+
+#ifdef CFORTH_TRACE
+  const Instr *prev = nullptr;
+#endif
+
+  while (pc < n) {
+    const Instr &instr = instrs[pc];
+
+#ifdef CFORTH_TRACE
+    if (isProfile()) {
+      profileInstr(prev, &instr);
+
+      prev = &instr;
+    }
+#endif
+
+    if (! execInstr(instr, pc, ups)) return State::lastError();
+  }
+
+  return State::success();
+}
+
+// top two stack cells held in locals of the cached interpreter
+// (cells[n - 1] is top of stack, cells[0] is below it when n is 2).
+// Unchecked cache is only used when code stack effect proves data stack is deep enough.
+template<bool CHECKED>
+struct StackCache {
+  Cell cells[2];
+  int  n { 0 };
+
+  Cell &tos() { return cells[n - 1]; }
+  Cell &nos() { return cells[0]; }
+
+  // cell passed by value as it may be a cached cell
+  void push(Cell cell) {
+    if (n == 2) {
+      interp_->stack_.push_back(cells[0]);
+
+      cells[0] = cells[1];
+      cells[1] = cell;
+    }
+    else
+      cells[n++] = cell;
+  }
+
+  void drop() { --n; }
+
+  // load cells from data stack until m cached
+  bool fill(int m) {
+    while (n < m) {
+      if (CHECKED) {
+        if (interp_->stack_.empty()) return false;
+      }
+      else
+        assert(! interp_->stack_.empty());
+
+      if (n == 1) cells[1] = cells[0];
+
+      cells[0] = interp_->stack_.back();
+
+      interp_->stack_.pop_back();
+
+      ++n;
+    }
+
+    return true;
+  }
+
+  // store cached cells to data stack
+  void flush() {
+    for (int i = 0; i < n; ++i)
+      interp_->stack_.push_back(cells[i]);
+
+    n = 0;
+  }
+};
+
+// float stack only builtins (false if float stack too small)
+static inline bool
+floatOp(int type)
 {
-  TokenP dtoken = (! token->isImmutable() ? token->dup() : token);
+  auto nf = interp_->fstack_.size();
 
-  tokens_.push_back(dtoken);
-}
+  switch (type) {
+    case Builtin::FPLUS_BUILTIN:
+    case Builtin::FMINUS_BUILTIN:
+    case Builtin::FTIMES_BUILTIN:
+    case Builtin::FDIVIDE_BUILTIN: {
+      if (nf < 2) return false;
 
-void
-pushBoolean(bool b)
-{
-  TokenP token = std::make_shared<BooleanToken>(b);
+      double &r1 = interp_->fstack_[nf - 2], r2 = interp_->fstack_[nf - 1];
 
-  pushToken(token);
-}
+      if      (type == Builtin::FPLUS_BUILTIN ) r1 += r2;
+      else if (type == Builtin::FMINUS_BUILTIN) r1 -= r2;
+      else if (type == Builtin::FTIMES_BUILTIN) r1 *= r2;
+      else                                      r1 /= r2;
 
-void
-pushInteger(int i)
-{
-  TokenP token = NumberToken::makeInteger(i);
+      interp_->fstack_.pop_back();
 
-  pushToken(token);
+      return true;
+    }
+    case Builtin::FDUP_BUILTIN:
+      if (nf < 1) return false;
+      interp_->fstack_.push_back(interp_->fstack_.back());
+      return true;
+    case Builtin::FDROP_BUILTIN:
+      if (nf < 1) return false;
+      interp_->fstack_.pop_back();
+      return true;
+    case Builtin::FSWAP_BUILTIN:
+      if (nf < 2) return false;
+      std::swap(interp_->fstack_[nf - 2], interp_->fstack_[nf - 1]);
+      return true;
+    case Builtin::FSQRT_BUILTIN:
+      if (nf < 1) return false;
+      interp_->fstack_.back() = std::sqrt(interp_->fstack_.back());
+      return true;
+    default:
+      return false;
+  }
 }
 
-void
-pushNumber(const Number &n)
+// check builtin is binary operator supported by cachedBinaryOp
+static inline bool
+isCachedBinaryOp(int type)
 {
-  TokenP token = NumberToken::makeNumber(n);
-
-  pushToken(token);
+  switch (type) {
+    case Builtin::PLUS_BUILTIN: case Builtin::MINUS_BUILTIN  : case Builtin::TIMES_BUILTIN:
+    case Builtin::LESS_BUILTIN: case Builtin::EQUAL_BUILTIN  : case Builtin::GREATER_BUILTIN:
+      return true;
+    default:
+      return false;
+  }
 }
 
-State
-peekToken(TokenP &token)
+// arithmetic and compare of number cells (same results as builtins)
+static inline bool
+cachedBinaryOp(int type, const Cell &c1, const Cell &c2, Cell &res)
 {
-  if (tokens_.empty())
-    return State::error("STACK EMPTY");
-
-  token = tokens_.back();
+  if (! c1.isNumber() || ! c2.isNumber())
+    return false;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+  if (c1.isInteger() && c2.isInteger()) {
+    res = intBinaryOp(type, c1, c2);
 
-    std::cout << "Peek: ";
-    token->print(std::cout);
-    std::cout << std::endl;
+    return true;
   }
 
-  return State::success();
+  return realBinaryOp(type, c1, c2, res);
 }
 
+// exec with top of stack cached. Stack words, arithmetic, literals, variable
+// fetch/store and branches work on the cache, other instructions flush it to the
+// data stack and run normally.
+template<bool CHECKED>
 State
-peekToken(int n, TokenP &token)
+Code::
+execCached() const
 {
-  auto nt = tokens_.size();
+  bool ups[MAX_LOOP_DEPTH];
 
-  if (n <= 0) return State::error("Invalid index");
+  const Instr *instrs = instrs_.data();
 
-  if (n > int(nt)) return State::error("Stack too small");
+  int pc = 0;
+  int n  = int(instrs_.size());
 
-  token = tokens_[nt - n];
+  StackCache<CHECKED> cache;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+  while (pc < n) {
+    const Instr &instr = instrs[pc];
 
-    std::cout << "Peek(" << n << ") : ";
-    token->print(std::cout);
-    std::cout << std::endl;
-  }
+    switch (instr.op) {
+      case Instr::LITERAL_OP:
+        cache.push(instr.cell);
+        ++pc;
+        continue;
+      case Instr::VARIABLE_OP: {
+        Variable *var = static_cast<Variable *>(instr.cell.token());
 
-  return State::success();
-}
+        if (var->hasExecTokens()) break;
 
-State
-popToken(TokenP &token)
-{
-  if (tokens_.empty())
-    return State::error("STACK EMPTY");
+        interp_->currentVar_ = var;
 
-  token = tokens_.back();
+        cache.push(Cell::makeInteger(var->addr()));
+        ++pc;
+        continue;
+      }
+      case Instr::VAR_FETCH_OP: {
+        Variable *var = static_cast<Variable *>(instr.cell.token());
 
-  tokens_.pop_back();
+        if (var->hasExecTokens()) break;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+        Cell value = interp_->memory_.get(var->addr());
 
-    std::cout << "Pop: ";
-    token->print(std::cout);
-    std::cout << std::endl;
-  }
+        if (! value.isValid()) break;
 
-  return State::success();
-}
+        interp_->currentVar_ = var;
 
-State
-popToken(int n, TokenP &token)
-{
-  auto nt = tokens_.size();
+        cache.push(value);
+        ++pc;
+        continue;
+      }
+      case Instr::VAR_STORE_OP: {
+        Variable *var = static_cast<Variable *>(instr.cell.token());
 
-  if (n <= 0) return State::error("Invalid index");
+        if (var->hasExecTokens() || ! cache.fill(1)) break;
 
-  if (n > int(nt)) return State::error("Stack too small");
+        if (! interp_->memory_.set(var->addr(), cache.tos())) break;
 
-  token = tokens_[nt - n];
+        interp_->currentVar_ = var;
 
-  for (uint nn1 = uint(nt - n); nn1 < nt; ++nn1)
-    tokens_[nn1] = tokens_[nn1 + 1];
+        cache.drop();
+        ++pc;
+        continue;
+      }
+      case Instr::BUILTIN_OP: {
+        bool done = true;
+
+        switch (instr.arg) {
+          case Builtin::DUP_BUILTIN:
+            if (! cache.fill(1)) { done = false; break; }
+            cache.push(cache.tos());
+            break;
+          case Builtin::DROP_BUILTIN:
+            if (! cache.fill(1)) { done = false; break; }
+            cache.drop();
+            break;
+          case Builtin::SWAP_BUILTIN:
+            if (! cache.fill(2)) { done = false; break; }
+            std::swap(cache.cells[0], cache.cells[1]);
+            break;
+          case Builtin::OVER_BUILTIN:
+            if (! cache.fill(2)) { done = false; break; }
+            cache.push(cache.nos());
+            break;
+          case Builtin::FETCH_BUILTIN: {
+            if (! cache.fill(1) || ! cache.tos().isInteger()) { done = false; break; }
+            Cell value = interp_->memory_.get(cache.tos().integer());
+            if (! value.isValid()) { done = false; break; }
+            cache.tos() = value;
+            break;
+          }
+          case Builtin::STORE_BUILTIN:
+            if (! cache.fill(2) || ! cache.tos().isInteger() ||
+                ! interp_->memory_.set(cache.tos().integer(), cache.nos())) { done = false; break; }
+            cache.drop();
+            cache.drop();
+            break;
+
+          // float words use float stack (and cached data stack cells)
+          case Builtin::FPLUS_BUILTIN: case Builtin::FMINUS_BUILTIN:
+          case Builtin::FTIMES_BUILTIN: case Builtin::FDIVIDE_BUILTIN:
+          case Builtin::FDUP_BUILTIN: case Builtin::FDROP_BUILTIN:
+          case Builtin::FSWAP_BUILTIN: case Builtin::FSQRT_BUILTIN:
+            done = floatOp(instr.arg);
+            break;
+          case Builtin::FFETCH_BUILTIN: {
+            if (! cache.fill(1) || ! cache.tos().isInteger()) { done = false; break; }
+            Cell value = interp_->memory_.get(cache.tos().integer());
+            if (! value.isNumber() && ! value.isBoolean()) { done = false; break; }
+            interp_->fstack_.push_back(value.real());
+            cache.drop();
+            break;
+          }
+          case Builtin::FSTORE_BUILTIN:
+            if (interp_->fstack_.empty() || ! cache.fill(1) || ! cache.tos().isInteger() ||
+                ! interp_->memory_.set(cache.tos().integer(), Cell::makeReal(interp_->fstack_.back()))) {
+              done = false; break; }
+            interp_->fstack_.pop_back();
+            cache.drop();
+            break;
+          case Builtin::FLESS_BUILTIN: {
+            auto nf = interp_->fstack_.size();
+            if (nf < 2) { done = false; break; }
+            bool b = (interp_->fstack_[nf - 2] < interp_->fstack_[nf - 1]);
+            interp_->fstack_.resize(nf - 2);
+            cache.push(Cell::makeBoolean(b));
+            break;
+          }
+          case Builtin::STOF_BUILTIN:
+            if (! cache.fill(1) || (! cache.tos().isNumber() && ! cache.tos().isBoolean())) {
+              done = false; break; }
+            interp_->fstack_.push_back(cache.tos().real());
+            cache.drop();
+            break;
+          case Builtin::FTOS_BUILTIN:
+            if (interp_->fstack_.empty()) { done = false; break; }
+            cache.push(Cell::makeInteger(Integer(interp_->fstack_.back())));
+            interp_->fstack_.pop_back();
+            break;
+          default: {
+            Cell res;
+
+            if (! isCachedBinaryOp(instr.arg) || ! cache.fill(2) ||
+                ! cachedBinaryOp(instr.arg, cache.nos(), cache.tos(), res)) {
+              done = false;
+              break;
+            }
+
+            cache.drop();
+
+            cache.tos() = res;
+
+            break;
+          }
+        }
+
+        if (! done) break;
+
+        ++pc;
+        continue;
+      }
+      case Instr::LIT_BUILTIN_OP: {
+        Cell res;
 
-  tokens_.pop_back();
+        if (! isCachedBinaryOp(instr.arg) || ! cache.fill(1) ||
+            ! cachedBinaryOp(instr.arg, cache.tos(), instr.cell, res))
+          break;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+        cache.tos() = res;
+        ++pc;
+        continue;
+      }
+      case Instr::SQUARE_OP: {
+        if (! cache.fill(1) || ! cache.tos().isNumber()) break;
 
-    std::cout << "Pop(" << n << ") : ";
-    token->print(std::cout);
-    std::cout << std::endl;
-  }
+        Number n = cache.tos().number();
 
-  return State::success();
-}
+        cache.tos() = Cell::makeNumber(Number::times(n, n));
+        ++pc;
+        continue;
+      }
+      case Instr::INT_OP: {
+        if (! cache.fill(2)) break;
 
-State
-popTokens(TokenP &token1, TokenP &token2)
-{
-  if (! popToken(token2)) return State::lastError();
-  if (! popToken(token1)) return State::lastError();
+        Cell res = intBinaryOp(instr.arg, cache.nos(), cache.tos());
 
-  return State::success();
-}
+        cache.drop();
 
-State
-popTokens(TokenP &token1, TokenP &token2, TokenP &token3)
-{
-  if (! popToken(token3)) return State::lastError();
-  if (! popToken(token2)) return State::lastError();
-  if (! popToken(token1)) return State::lastError();
+        cache.tos() = res;
+        ++pc;
+        continue;
+      }
+      case Instr::REAL_OP: {
+        Cell res;
 
-  return State::success();
-}
+        if (! cache.fill(2) || ! realBinaryOp(instr.arg, cache.nos(), cache.tos(), res))
+          break;
 
-State
-popBoolean(bool &b)
-{
-  TokenP token;
+        cache.drop();
 
-  if (! popToken(token)) return State::lastError();
+        cache.tos() = res;
+        ++pc;
+        continue;
+      }
+      case Instr::LIT_INT_OP: {
+        if (! cache.fill(1)) break;
 
-  if      (token->isNumber())
-    b = (NumberToken::fromToken(token)->integer() != 0);
-  else if (token->isBoolean())
-    b = BooleanToken::fromToken(token)->value();
-  else
-    return State::error("must be integer or boolean");
+        cache.tos() = intBinaryOp(instr.arg, cache.tos(), instr.cell);
+        ++pc;
+        continue;
+      }
+      case Instr::LIT_REAL_OP: {
+        Cell res;
 
-  return State::success();
-}
+        if (! cache.fill(1) || ! realBinaryOp(instr.arg, cache.tos(), instr.cell, res))
+          break;
 
-State
-tokenToNumber(TokenP token, Number &n)
-{
-  if (token->isVarBase()) {
-    VarBaseP var = VarBase::fromToken(token);
+        cache.tos() = res;
+        ++pc;
+        continue;
+      }
+      case Instr::ZBRANCH_OP:
+      case Instr::NZBRANCH_OP: {
+        if (! cache.fill(1)) break;
 
-    if (var->isConstant())
-      token = var->value();
-  }
+        const Cell &cell = cache.tos();
 
-  if (! token->isNumber())
-    return State::error("must be number");
+        bool b;
 
-  n = NumberToken::fromToken(token)->number();
+        if      (cell.isNumber ()) b = (cell.integer() != 0);
+        else if (cell.isBoolean()) b = cell.boolean();
+        else break;
 
-  return State::success();
-}
+        cache.drop();
 
-State
-popNumber(Number &n)
-{
-  TokenP token;
+        pc = (b == (instr.op == Instr::NZBRANCH_OP) ? instr.arg : pc + 1);
+        continue;
+      }
+      default:
+        break;
+    }
 
-  if (! popToken(token)) return State::lastError();
+    // not handled by cache (or error) so run with cells on data stack
+    cache.flush();
 
-  if (! tokenToNumber(token, n)) return State::lastError();
+    if (! execInstr(instr, pc, ups)) return State::lastError();
+  }
+
+  cache.flush();
 
   return State::success();
 }
 
-State
-popBoolOrNumber(Number &n)
-{
-  TokenP token;
-
-  if (! popToken(token)) return State::lastError();
+//----------
 
-  if (token->isVarBase()) {
-    VarBaseP var = VarBase::fromToken(token);
+#ifdef CFORTH_JIT
+// Native code for instructions. Each instruction is a direct call to its implementation
+// (core builtins to their non-virtual exec) with control flow compiled to native jumps.
+// Called functions return 0 (or flag) on success, -1 on error. Exceptions (QUIT/ABORT)
+// are caught before they reach native frames and rethrown on return.
+//
+// This is call threading only: no stack cells are held in registers (every call
+// works on the data stack) and the cached stack paths of execCached are not used,
+// so the gain over the interpreter is only the removed instruction dispatch. That is
+// less than the cost of the lost stack cache, so it must be enabled explicitly
+// (setJitThreshold).
+
+// per thread as native code runs on the thread of its interpreter
+thread_local std::exception_ptr nativeException_;
+
+#define NATIVE_CALL(EXPR) \
+  try { return ((EXPR) ? 0 : -1); } \
+  catch (...) { nativeException_ = std::current_exception(); return -1; }
+
+int nativeLiteral (const Code::Instr *instr) { pushCell(instr->cell); return 0; }
+int nativeVariable(const Code::Instr *instr) { NATIVE_CALL(execVariableInstr(*instr)) }
+int nativeExec    (const Code::Instr *instr) { NATIVE_CALL(execTokenInstr   (*instr)) }
+int nativeDo      (const Code::Instr *instr, bool *ups) {
+  NATIVE_CALL(loopStart(ups[instr->cell.integer()])) }
+int nativeLoop    (const Code::Instr *) { return (loopNext  () ? 0 : -1); }
+int nativePLoop   (const Code::Instr *) { return (loopNextBy() ? 0 : -1); }
+int nativeUnloop  (const Code::Instr *) { return (loopEnd   () ? 0 : -1); }
+
+int nativeLitBuiltin(const Code::Instr *instr) { NATIVE_CALL(execLitBuiltinInstr(*instr)) }
+int nativeVarFetch  (const Code::Instr *instr) { NATIVE_CALL(execVarFetchInstr  (*instr)) }
+int nativeVarStore  (const Code::Instr *instr) { NATIVE_CALL(execVarStoreInstr  (*instr)) }
+int nativeSquare    (const Code::Instr *instr) { NATIVE_CALL(execSquareInstr    (*instr)) }
+int nativeInt       (const Code::Instr *instr) { NATIVE_CALL(execIntInstr       (*instr)) }
+int nativeReal      (const Code::Instr *instr) { NATIVE_CALL(execRealInstr      (*instr)) }
+int nativeLitInt    (const Code::Instr *instr) { NATIVE_CALL(execLitIntInstr    (*instr)) }
+int nativeLitReal   (const Code::Instr *instr) { NATIVE_CALL(execLitRealInstr   (*instr)) }
 
-    if (var->isConstant())
-      token = var->value();
-  }
+int
+nativeLoopTest(const Code::Instr *instr, const bool *ups)
+{
+  bool done;
 
-  if      (token->isNumber())
-    n = NumberToken::fromToken(token)->number();
-  else if (token->isBoolean())
-    n = Number::makeBoolean(BooleanToken::fromToken(token)->value());
-  else
-    return State::error("must be integer or boolean");
+  if (! loopTest(ups[instr->cell.integer()], done)) return -1;
 
-  return State::success();
+  return (done ? 1 : 0);
 }
 
-State
-popNumbers(Number &n1, Number &n2)
+int
+nativeFlag(const Code::Instr *)
 {
-  if (! popNumber(n2)) return State::lastError();
-  if (! popNumber(n1)) return State::lastError();
+  bool b;
 
-  return State::success();
+  if (! popBoolean(b)) return -1;
+
+  return (b ? 1 : 0);
 }
 
-State
-popBoolOrNumbers(Number &n1, Number &n2)
+template<typename T>
+int
+nativeBuiltin(const Code::Instr *instr)
 {
-  if (! popBoolOrNumber(n2)) return State::lastError();
-  if (! popBoolOrNumber(n1)) return State::lastError();
+  T *builtin = static_cast<T *>(instr->cell.token());
 
-  return State::success();
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Exec: ";
+    builtin->print(output());
+    output() << std::endl;
+  }
+
+  NATIVE_CALL(builtin->T::exec())
 }
 
-State
-popNumbers(Number &n1, Number &n2, Number &n3)
+#undef NATIVE_CALL
+
+void *
+nativeBuiltinFn(int type)
 {
-  if (! popNumber(n3)) return State::lastError();
-  if (! popNumber(n2)) return State::lastError();
-  if (! popNumber(n1)) return State::lastError();
+#define NATIVE_BUILTIN_FN(ID,N) \
+  case Builtin::N##_BUILTIN: return reinterpret_cast<void *>(&nativeBuiltin<ID##Builtin>);
 
-  return State::success();
+  switch (type) {
+    CORE_BUILTINS(NATIVE_BUILTIN_FN)
+    default: return nullptr;
+  }
+
+#undef NATIVE_BUILTIN_FN
 }
 
-State
-popVarBase(VarBaseP &var)
-{
-  TokenP token;
+// x86-64 (System V) code buffer
+class X64Assembler {
+ public:
+  enum Cond {
+    JE = 0x84,
+    JNE = 0x85,
+    JS = 0x88
+  };
 
-  if (! popToken(token)) return State::lastError();
+ public:
+  X64Assembler(int numLabels) :
+   labels_(numLabels, -1) {
+  }
 
-  if (! token->isVarBase()) return State::error("must be base variable");
+  const std::vector<unsigned char> &bytes() const { return bytes_; }
 
-  var = VarBase::fromToken(token);
+  void setLabel(int label) { labels_[label] = int(bytes_.size()); }
 
-  return State::success();
-}
+  // push rbx; sub rsp, 32; mov rbx, rsp (rbx = loop directions, rsp 16 byte aligned)
+  void prologue() { emit({0x53, 0x48, 0x83, 0xEC, 0x20, 0x48, 0x89, 0xE3}); }
 
-State
-popVarRef(VarBaseP &var)
-{
-  TokenP token;
+  // mov eax, result; add rsp, 32; pop rbx; ret
+  void epilogue(int result) {
+    emit({0xB8}); emit32(result); emit({0x48, 0x83, 0xC4, 0x20, 0x5B, 0xC3});
+  }
 
-  if (! popToken(token)) return State::lastError();
+  // call fn(arg, rbx) with result in eax
+  void call(const void *fn, const void *arg) {
+    emit({0x48, 0xBF}); emit64(reinterpret_cast<uint64_t>(arg)); // mov rdi, arg
+    emit({0x48, 0x89, 0xDE});                                   // mov rsi, rbx
+    emit({0x48, 0xB8}); emit64(reinterpret_cast<uint64_t>(fn));  // mov rax, fn
+    emit({0xFF, 0xD0});                                         // call rax
+  }
 
-  if (! token->isVarRef()) return State::error("must be ref variable");
+  void testEax() { emit({0x85, 0xC0}); }
 
-  var = VarBase::fromToken(token);
+  void jcc(Cond cond, int label) { emit({0x0F, cond}); fixup(label); }
 
-  return State::success();
-}
+  void jmp(int label) { emit({0xE9}); fixup(label); }
 
-State
-popVariable(VariableP &var)
-{
-  TokenP token;
+  bool resolve() {
+    for (const auto &f : fixups_) {
+      int target = labels_[f.second];
 
-  if (! popToken(token)) return State::lastError();
+      if (target < 0) return false;
 
-  if (! token->isVariable()) return State::error("must be variable");
+      int32_t rel = int32_t(target - (f.first + 4));
 
-  var = Variable::fromToken(token);
+      memcpy(&bytes_[f.first], &rel, 4);
+    }
 
-  return State::success();
-}
+    return true;
+  }
 
-State
-popProcedure(ProcedureP &var)
-{
-  TokenP token;
+ private:
+  void emit(std::initializer_list<int> bytes) {
+    for (auto b : bytes)
+      bytes_.push_back(static_cast<unsigned char>(b));
+  }
 
-  if (! popToken(token)) return State::lastError();
+  void emit32(int32_t i) {
+    for (int j = 0; j < 4; ++j) bytes_.push_back(static_cast<unsigned char>(i >> (8*j)));
+  }
 
-  if (! token->isProcedure()) return State::error("must be procedure");
+  void emit64(uint64_t i) {
+    for (int j = 0; j < 8; ++j) bytes_.push_back(static_cast<unsigned char>(i >> (8*j)));
+  }
 
-  var = Procedure::fromToken(token);
+  void fixup(int label) { fixups_.emplace_back(int(bytes_.size()), label); emit32(0); }
 
-  return State::success();
-}
+ private:
+  typedef std::pair<int, int> Fixup;
 
-void
-clearTokens()
-{
-  tokens_.clear();
-}
+  std::vector<unsigned char> bytes_;
+  std::vector<int>           labels_;
+  std::vector<Fixup>         fixups_;
+};
 
-void
-clearRetTokens()
-{
-  retTokens_.clear();
-}
+// executable memory holding native code
+struct Code::Native {
+  typedef int (*Fn)();
 
-void
-clearExecTokens()
-{
-  execTokens_.clear();
-}
+  void  *mem  { nullptr };
+  size_t size { 0 };
+  Fn     fn   { nullptr };
 
-State
-execToken(const TokenP &token)
+ ~Native() { if (mem) munmap(mem, size); }
+};
+
+bool
+Code::
+jit()
 {
-  if (token->isExecutable()) {
-    if (isDebug()) {
-      IgnoreBase ib;
+  if (! valid_ || isNative() || fn_)
+    return false;
 
-      std::cout << "Exec: ";
-      token->print(std::cout);
-      std::cout << std::endl;
-    }
+  int n = int(instrs_.size());
 
-    if (token->isBlock()) {
-      execTokens_.push_back(token);
+  // labels: instructions, end (n) and error (n + 1)
+  X64Assembler as(n + 2);
 
-      State state = token->exec();
+  int endLabel = n, errorLabel = n + 1;
 
-      execTokens_.pop_back();
+  as.prologue();
 
-      return state;
-    }
-    else
-      return token->exec();
-  }
-  else {
-    pushToken(token);
+  for (int i = 0; i < n; ++i) {
+    const Instr &instr = instrs_[i];
 
-    if (token->isVariable()) {
-      currentVar_ = Variable::fromToken(token);
+    as.setLabel(i);
 
-      if (! currentVar_->execTokens())
-        return State::lastError();
-    }
+    switch (instr.op) {
+      case Instr::LITERAL_OP:
+        as.call(reinterpret_cast<void *>(&nativeLiteral), &instr);
+        break;
+      case Instr::VARIABLE_OP:
+        as.call(reinterpret_cast<void *>(&nativeVariable), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::EXEC_OP:
+        as.call(reinterpret_cast<void *>(&nativeExec), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::BUILTIN_OP: {
+        void *fn = nativeBuiltinFn(instr.arg);
 
-    return State::success();
+        if (! fn) return false;
+
+        as.call(fn, &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+
+        break;
+      }
+      case Instr::BRANCH_OP:
+        as.jmp(instr.arg);
+        break;
+      case Instr::ZBRANCH_OP:
+      case Instr::NZBRANCH_OP:
+        as.call(reinterpret_cast<void *>(&nativeFlag), &instr);
+        as.testEax(); as.jcc(X64Assembler::JS, errorLabel);
+        as.jcc(instr.op == Instr::ZBRANCH_OP ? X64Assembler::JE : X64Assembler::JNE, instr.arg);
+        break;
+      case Instr::DO_OP:
+        as.call(reinterpret_cast<void *>(&nativeDo), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::LOOP_TEST_OP:
+        as.call(reinterpret_cast<void *>(&nativeLoopTest), &instr);
+        as.testEax(); as.jcc(X64Assembler::JS, errorLabel);
+        as.jcc(X64Assembler::JNE, instr.arg);
+        break;
+      case Instr::LOOP_OP:
+      case Instr::PLOOP_OP:
+        as.call(reinterpret_cast<void *>(instr.op == Instr::LOOP_OP ?
+                  &nativeLoop : &nativePLoop), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        as.jmp(instr.arg);
+        break;
+      case Instr::UNLOOP_OP:
+        as.call(reinterpret_cast<void *>(&nativeUnloop), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::LIT_BUILTIN_OP:
+        as.call(reinterpret_cast<void *>(&nativeLitBuiltin), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::VAR_FETCH_OP:
+        as.call(reinterpret_cast<void *>(&nativeVarFetch), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::VAR_STORE_OP:
+        as.call(reinterpret_cast<void *>(&nativeVarStore), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::SQUARE_OP:
+        as.call(reinterpret_cast<void *>(&nativeSquare), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::INT_OP:
+        as.call(reinterpret_cast<void *>(&nativeInt), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::REAL_OP:
+        as.call(reinterpret_cast<void *>(&nativeReal), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::LIT_INT_OP:
+        as.call(reinterpret_cast<void *>(&nativeLitInt), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      case Instr::LIT_REAL_OP:
+        as.call(reinterpret_cast<void *>(&nativeLitReal), &instr);
+        as.testEax(); as.jcc(X64Assembler::JNE, errorLabel);
+        break;
+      default:
+        return false;
+    }
   }
-}
 
-State
-cmpOp(int &cmp)
-{
-  Number n1, n2;
+  as.setLabel(endLabel);
+  as.epilogue(0);
 
-  if (! popNumbers(n1, n2)) return State::lastError();
+  as.setLabel(errorLabel);
+  as.epilogue(1);
 
-  cmp = Number::minus(n1, n2).integer();
+  if (! as.resolve())
+    return false;
 
-  return State::success();
-}
+  //---
 
-State
-ucmpOp(int &cmp)
-{
-  Number n1, n2;
+  auto native = std::make_shared<Native>();
 
-  if (! popNumbers(n1, n2)) return State::lastError();
+  size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
 
-  uint i1 = uint(n1.integer());
-  uint i2 = uint(n2.integer());
+  native->size = (as.bytes().size() + pageSize - 1)/pageSize*pageSize;
 
-  if      (i1 > i2) cmp =  1;
-  else if (i1 < i2) cmp = -1;
-  else              cmp =  0;
+  void *mem = mmap(nullptr, native->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-  return State::success();
-}
+  if (mem == MAP_FAILED)
+    return false;
 
-VariableP
-defineVariable(const std::string &name, int i)
-{
-  return defineVariable(name, NumberToken::makeInteger(i));
-}
+  native->mem = mem;
 
-VariableP
-defineVariable(const std::string &name, TokenP token)
-{
-  VariableP var = defineVariable(name);
+  memcpy(mem, as.bytes().data(), as.bytes().size());
 
-  var->addValue(token);
+  if (mprotect(mem, native->size, PROT_READ | PROT_EXEC) != 0)
+    return false;
 
-  return var;
+  native->fn = reinterpret_cast<Native::Fn>(mem);
+
+  native_ = native;
+
+  __atomic_store_n(&nativeCode_, native.get(), __ATOMIC_RELEASE);
+
+  return true;
 }
 
-VariableP
-defineVariable(const std::string &name)
+State
+Code::
+execNative(const Native *native) const
 {
-  VariableP var = std::make_shared<Variable>(name);
+  if (native->fn() == 0)
+    return State::success();
 
-  variables_[name].push_back(var);
+  if (nativeException_) {
+    std::exception_ptr e = nativeException_;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+    nativeException_ = nullptr;
 
-    std::cout << "Define Var: " << name << std::endl;
+    std::rethrow_exception(e);
   }
 
-  return var;
+  return State::lastError();
 }
+#else
+struct Code::Native {
+};
 
 bool
-forgetVariable(const std::string &name)
+Code::
+jit()
 {
-  auto p = variables_.find(name);
+  return false;
+}
 
-  if (p == variables_.end())
-    return false;
+State
+Code::
+execNative(const Native *) const
+{
+  return State::error("No native code");
+}
+#endif
 
-  if (p->second.empty())
-    return false;
+//----------
 
-  p->second.pop_back();
+State
+Procedure::
+exec()
+{
+  if (code_.isValid()) {
+    // compile hot procedures to native code
+    if (interp_->jitThreshold_ > 0 && countCall() == interp_->jitThreshold_)
+      code_.jit();
 
-  if (isDebug()) {
-    IgnoreBase ib;
+    return code_.exec();
+  }
 
-    std::cout << "Forget Var: " << name << std::endl;
+  for (const auto &token : tokens_) {
+    if (! execToken(token))
+      return State::lastError();
   }
 
-  return true;
+  return State::success();
 }
 
-bool
-lookupVariable(const std::string &name, VariableP &var)
+// count call (up to jit threshold). Frozen procedures are shared between instances
+// so are counted atomically and only the call reaching the threshold compiles
+int
+Procedure::
+countCall()
 {
-  auto p = variables_.find(name);
-
-  if (p == variables_.end())
-    return false;
+  int threshold = interp_->jitThreshold_;
 
-  if (p->second.empty())
-    return false;
+  if (! isFrozen())
+    return (numCalls_ < threshold ? ++numCalls_ : 0);
 
-  var = p->second.back();
+  if (__atomic_load_n(&numCalls_, __ATOMIC_RELAXED) >= threshold)
+    return 0;
 
-  return true;
+  return __atomic_add_fetch(&numCalls_, 1, __ATOMIC_RELAXED);
 }
 
-ProcedureP
-defineProcedure(const std::string &name, const TokenArray &tokens)
+void
+Procedure::
+freezeRefs()
 {
-  ProcedureP proc = std::make_shared<Procedure>(name, tokens);
-
-  procedures_[name].push_back(proc);
+  freezeTokens(tokens_);
+}
 
-  if (isDebug()) {
-    IgnoreBase ib;
+//----------
 
-    std::cout << "Define Procedure ";
-    proc->print(std::cout);
-    std::cout << std::endl;
-  }
+void
+NumberToken::
+print(std::ostream &os) const
+{
+  int base = getBase();
 
-  return proc;
+  if (base != 10 && number_.isInteger())
+    os << toBaseString(base, number_.integer());
+  else
+    number_.print(os);
 }
 
-bool
-forgetProcedure(const std::string &name)
-{
-  auto p = procedures_.find(name);
+//----------
 
-  if (p == procedures_.end())
-    return false;
+State
+State::
+error(const char *msg)
+{
+  interp_->lastErrorCode_ = ERROR;
+  interp_->lastErrorText_ = msg;
 
-  if (p->second.empty())
-    return false;
+  return State(ERROR);
+}
 
-  p->second.pop_back();
+State
+State::
+unknownWord(const std::string &word)
+{
+  interp_->lastErrorCode_ = UNKNOWN_WORD;
+  interp_->lastErrorArg_  = word;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+  return State(UNKNOWN_WORD);
+}
 
-    std::cout << "Forget Procedure" << name << std::endl;
-  }
+State
+State::
+openFailed(const std::string &filename)
+{
+  interp_->lastErrorCode_ = OPEN_FAILED;
+  interp_->lastErrorArg_  = filename;
 
-  return true;
+  return State(OPEN_FAILED);
 }
 
-bool
-lookupProcedure(const std::string &name, ProcedureP &proc)
+State
+State::
+lastError()
 {
-  auto p = procedures_.find(name);
-
-  if (p == procedures_.end())
-    return false;
+  return State(interp_->lastErrorCode_);
+}
 
-  if (p->second.empty())
-    return false;
+std::string
+State::
+msg() const
+{
+  switch (code_) {
+    case OK          : return "";
+    case UNKNOWN_WORD: return interp_->lastErrorArg_ + " ?";
+    case OPEN_FAILED : return "Failed to open'" + interp_->lastErrorArg_ + "'";
+    default          : return interp_->lastErrorText_;
+  }
+}
 
-  proc = p->second.back();
+//----------
 
-  return true;
+Cell
+Cell::
+fromToken(const TokenP &token)
+{
+  switch (token->type()) {
+    case Token::BOOLEAN_TOKEN:
+      return makeBoolean(BooleanToken::fromToken(token)->value());
+    case Token::NUMBER_TOKEN:
+      return makeNumber(NumberToken::fromToken(token)->number());
+    case Token::VAR_BASE_TOKEN:
+      return VarBase::fromToken(token)->cell();
+    default:
+      return makeToken(token.get());
+  }
 }
 
-void
-addBlockToken(TokenArray &tokens, const TokenP &token)
-{
-  // auto expand procedure
-  // TODO: option
-  if (token->isProcedure()) {
-    for (auto ptoken : Procedure::fromToken(token)->tokens())
-      tokens.push_back(ptoken);
+TokenP
+Cell::
+toToken() const
+{
+  switch (t_) {
+    case BOOLEAN_CELL:
+      return makeRef<BooleanToken>(boolean());
+    case INTEGER_CELL:
+    case REAL_CELL:
+      return NumberToken::makeNumber(number());
+    case TOKEN_CELL:
+      return TokenP(v_.p);
+    default:
+      return TokenP();
   }
-  // add if not null token
-  else if (! token->isNull())
-    tokens.push_back(token);
 }
 
-VariableP
-getWordVar()
+State
+Cell::
+cmp(const Cell &c1, const Cell &c2, int &res)
 {
-  if (! wordVar_.get())
-    wordVar_ = std::make_shared<Variable>("WORD");
+  if      (c1.isInteger() && c2.isInteger())
+    res = (c1.integer() > c2.integer() ? 1 : (c1.integer() < c2.integer() ? -1 : 0));
+  else if ((c1.isNumber() || c1.isBoolean()) && (c2.isNumber() || c2.isBoolean()))
+    res = Number::cmp(c1.number(), c2.number());
+  else
+    return State::error("cmp not supported");
 
-  return wordVar_;
+  return State::success();
 }
 
-int
-getBase()
+State
+Cell::
+inc(const Number &n)
 {
-  if (ignore_base_) return 10;
+  if      (isInteger() && n.isInteger())
+    addInteger(n.integer());
+  else if (isNumber()) {
+    Number n1 = number();
 
-  int base = 10;
+    n1.inc(n);
 
-  VariableP var;
+    *this = makeNumber(n1);
+  }
+  else
+    return State::error("inc not supported");
 
-  if (! lookupVariable("BASE", var))
-    return base;
+  return State::success();
+}
 
-  if (! var->getInteger(base))
-    return base;
+void
+Cell::
+print(std::ostream &os) const
+{
+  switch (t_) {
+    case BOOLEAN_CELL:
+      os << (boolean() ? "TRUE" : "FALSE");
+      break;
+    case INTEGER_CELL:
+    case REAL_CELL: {
+      int base = getBase();
 
-  base = std::min(std::max(base, 2), 36);
+      if (base != 10 && isInteger())
+        os << toBaseString(base, integer());
+      else
+        number().print(os);
 
-  return base;
+      break;
+    }
+    case TOKEN_CELL:
+      v_.p->print(os);
+      break;
+    default:
+      break;
+  }
 }
 
+//----------
+
 bool
-isBaseChar(int c, int base, int *value)
+Memory::
+allot(Integer n)
 {
-  if (base < 2 || base > int(base_chars.size()))
+  if (here_ + n < 1 || here_ + n > INT_MAX)
     return false;
 
-  int c1 = c;
-
-  if (::islower(c1))
-    c1 = ::toupper(c1);
+  int here = here_;
 
-  std::string::size_type pos = base_chars.find(char(c1));
+  here_ += int(n);
 
-  if (pos == std::string::npos || int(pos) >= base)
-    return false;
+  grow(here_);
 
-  if (value != NULL)
-    *value = int(pos);
+  // newly allocated cells start as integer zero
+  for (int addr = here; addr < here_; ++addr)
+    set(addr, Cell::makeInteger(0));
 
   return true;
 }
 
-State
-toBaseInteger(const std::string &str, int base, long *integer)
+bool
+Memory::
+move(Integer src, Integer dst, Integer n)
 {
-  *integer = 0;
-
-  if (base < 2 || base > int(base_chars.size()))
-    return State::error("Invalid Base");
-
-  uint i   = 0;
-  auto len = str.size();
-
-  while (i < len) {
-    int c = str[i];
+  if (! isValid(src, n) || ! isValid(dst, n))
+    return false;
 
-    int value;
+  copy(int(src), int(dst), int(n));
 
-    if (! isBaseChar(c, base, &value))
-      return State::error("Invalid Char");
+  return true;
+}
 
-    long integer1 = base*(*integer) + value;
+bool
+Memory::
+copyUp(Integer src, Integer dst, Integer n)
+{
+  if (! isValid(src, n) || ! isValid(dst, n))
+    return false;
 
-    if (long((integer1 - long(value))/base) != *integer)
-      return State::error("Overflow");
+  // destination above source inside range: copy in non overlapping chunks of the
+  // distance so each chunk reads cells written by the previous one
+  int d = int(dst - src);
 
-    *integer = integer1;
+  if (d <= 0 || d >= n) {
+    copy(int(src), int(dst), int(n));
 
-    ++i;
+    return true;
   }
 
-  if (*integer > INT_MAX || *integer < INT_MIN)
-    return State::error("Overflow");
+  for (int i = 0; i < n; i += d)
+    copy(int(src) + i, int(dst) + i, std::min(d, int(n) - i));
 
-  return State::success();
+  return true;
 }
 
-std::string
-toBaseString(int base, int integer)
+bool
+Memory::
+copyDown(Integer src, Integer dst, Integer n)
 {
-  if (base < 2 || base > int(base_chars.size()))
-    return "";
+  if (! isValid(src, n) || ! isValid(dst, n))
+    return false;
 
-  std::string str;
+  // destination below source inside range: chunked copy from the top
+  int d = int(src - dst);
 
-  if (integer < 0) {
-    str += '-';
-    integer = -integer;
-  }
+  if (d <= 0 || d >= n) {
+    copy(int(src), int(dst), int(n));
 
-  while (integer >= base) {
-    int n = integer % base;
+    return true;
+  }
 
-    str = base_chars[n] + str;
+  for (int i = int(n); i > 0; i -= d) {
+    int m = std::min(d, i);
 
-    integer /= base;
+    copy(int(src) + i - m, int(dst) + i - m, m);
   }
 
-  str = base_chars[integer] + str;
-
-  return str;
+  return true;
 }
 
-std::string
-toUpper(const std::string &str)
+bool
+Memory::
+fill(Integer addr, Integer n, const Cell &cell)
 {
-  std::string ustr = str;
-
-  auto len = ustr.size();
-
-  for (uint i = 0; i < len; ++i)
-    ustr[i] = char(toupper(ustr[i]));
-
-  return ustr;
-}
-
-//----------
+  if (! isValid(addr, n))
+    return false;
 
-State
-Variable::
-execTokens()
-{
-  if (isDebug() && ! tokens_.empty()) {
-    IgnoreBase ib;
+  // fill in chunks within a page
+  int a = int(addr), e = int(addr + n);
 
-    std::cout << "DOES>";
+  while (a < e) {
+    int i = a & PAGE_MASK;
+    int m = std::min(e - a, PAGE_SIZE - i);
 
-    for (auto token : execTokens_) {
-      std::cout << " ";
+    Page &page = writePage(a >> PAGE_BITS);
 
-      token->print(std::cout);
-    }
+    std::fill_n(&page.values[i], m, cell.v_);
 
-    std::cout << std::endl;
-  }
+    memset(&page.types[i], static_cast<unsigned char>(cell.t_), size_t(m));
 
-  for (auto token : execTokens_) {
-    if (! execToken(token))
-      return State::lastError();
+    a += m;
   }
 
-  return State::success();
+  return true;
 }
 
 void
-Variable::
-setInteger(int i)
+Memory::
+copy(int src, int dst, int n)
 {
-  setValue(NumberToken::makeInteger(i));
-}
+  if (n <= 0 || src == dst)
+    return;
 
-bool
-Variable::
-getInteger(int &i) const
-{
-  i = 0;
+  // copy in chunks within a source and destination page, starting from the end
+  // if the destination is above the source so overlapping cells are read first
+  bool fromEnd = (dst > src);
 
-  if (! value()->isNumber())
-    return false;
+  for (int i = 0; i < n; ) {
+    int s, d, m;
 
-  NumberTokenP number = NumberToken::fromToken(value());
+    if (! fromEnd) {
+      s = src + i;
+      d = dst + i;
+      m = std::min({n - i, PAGE_SIZE - (s & PAGE_MASK), PAGE_SIZE - (d & PAGE_MASK)});
+    }
+    else {
+      int e = n - i;
 
-  i = number->integer();
+      m = std::min({e, ((src + e - 1) & PAGE_MASK) + 1, ((dst + e - 1) & PAGE_MASK) + 1});
+      s = src + e - m;
+      d = dst + e - m;
+    }
 
-  return true;
-}
+    // destination first as it may replace a shared source page
+    Page       &dpage = writePage(d >> PAGE_BITS);
+    const Page &spage = *pages_[s >> PAGE_BITS];
 
-//----------
+    memmove(&dpage.values[d & PAGE_MASK], &spage.values[s & PAGE_MASK],
+            size_t(m)*sizeof(Cell::Value));
+    memmove(&dpage.types [d & PAGE_MASK], &spage.types [s & PAGE_MASK], size_t(m));
 
-State
-Procedure::
-exec()
-{
-  for (auto token : tokens_) {
-    if (! execToken(token))
-      return State::lastError();
+    i += m;
   }
-
-  return State::success();
 }
 
-//----------
-
 void
-NumberToken::
-print(std::ostream &os) const
+Memory::
+changedRanges(const Memory &memory, Ranges &ranges) const
 {
-  int base = getBase();
+  int numPages = int(pages_.size());
 
-  if (base != 10 && number_.isInteger())
-    os << toBaseString(base, number_.integer());
-  else
-    number_.print(os);
-}
-
-//----------
-
-bool
-Token::
-isVariable() const
-{
-  if (! isVarBase()) return false;
+  for (int i = 0; i < numPages; ++i) {
+    if (i < int(memory.pages_.size()) && pages_[i] == memory.pages_[i])
+      continue;
 
-  const VarBase *var = static_cast<const VarBase *>(this);
+    int start = std::max(i << PAGE_BITS, 1);
+    int end   = std::min((i + 1) << PAGE_BITS, size());
 
-  return var->isVariable();
+    if (! ranges.empty() && ranges.back().second == start)
+      ranges.back().second = end;
+    else if (start < end)
+      ranges.emplace_back(start, end);
+  }
 }
 
-bool
-Token::
-isVarRef() const
+void
+Memory::
+grow(int n)
 {
-  if (! isVarBase()) return false;
+  if (n <= size())
+    return;
 
-  const VarBase *var = static_cast<const VarBase *>(this);
+  int numPages = (n + PAGE_SIZE - 1) >> PAGE_BITS;
 
-  return ! var->isConstant();
+  while (int(pages_.size()) < numPages)
+    pages_.push_back(std::make_shared<Page>());
+
+  size_ = n;
 }
 
-//-------------
+//----------
+
 
 // Stack manipulation
 State
 DupBuiltin::
 exec()
 {
-  if (tokens_.empty()) return State::error("STACK EMPTY");
+  if (interp_->stack_.empty()) return State::error("STACK EMPTY");
 
-  TokenP token = tokens_.back();
+  Cell cell = interp_->stack_.back();
 
-  pushDupToken(token);
+  interp_->stack_.push_back(cell);
 
   if (isDebug()) {
     IgnoreBase ib;
-    std::cout << "Dup: "; token->print(std::cout); std::cout << std::endl;
+    output() << "Dup: "; cell.print(output()); output() << std::endl;
   }
 
   return State::success();
@@ -1339,14 +6521,14 @@ State
 DropBuiltin::
 exec()
 {
-  if (tokens_.empty()) return State::error("STACK EMPTY");
+  if (interp_->stack_.empty()) return State::error("STACK EMPTY");
 
   if (isDebug()) {
     IgnoreBase ib;
-    std::cout << "Drop: "; tokens_.back()->print(std::cout); std::cout << std::endl;
+    output() << "Drop: "; interp_->stack_.back().print(output()); output() << std::endl;
   }
 
-  tokens_.pop_back();
+  interp_->stack_.pop_back();
 
   return State::success();
 }
@@ -1355,17 +6537,17 @@ State
 SwapBuiltin::
 exec()
 {
-  auto n = tokens_.size();
+  auto n = interp_->stack_.size();
 
   if (n < 2) return State::error("STACK EMPTY");
 
   if (isDebug()) {
     IgnoreBase ib;
-    std::cout << "Swap: "; tokens_[n - 1]->print(std::cout);
-    std::cout << " "; tokens_[n - 2]->print(std::cout); std::cout << std::endl;
+    output() << "Swap: "; interp_->stack_[n - 1].print(output());
+    output() << " "; interp_->stack_[n - 2].print(output()); output() << std::endl;
   }
 
-  std::swap(tokens_[n - 1], tokens_[n - 2]);
+  std::swap(interp_->stack_[n - 1], interp_->stack_[n - 2]);
 
   return State::success();
 }
@@ -1374,17 +6556,17 @@ State
 OverBuiltin::
 exec()
 {
-  auto nt = tokens_.size();
+  auto nt = interp_->stack_.size();
 
   if (nt < 2) return State::error("STACK UNDERFLOW");
 
-  TokenP token = tokens_[nt - 2];
+  Cell cell = interp_->stack_[nt - 2];
 
-  pushDupToken(token);
+  interp_->stack_.push_back(cell);
 
   if (isDebug()) {
     IgnoreBase ib;
-    std::cout << "Over: "; token->print(std::cout); std::cout << std::endl;
+    output() << "Over: "; cell.print(output()); output() << std::endl;
   }
 
   return State::success();
@@ -1394,20 +6576,20 @@ State
 RotBuiltin::
 exec()
 {
-  auto nt = tokens_.size();
+  auto nt = interp_->stack_.size();
 
   if (nt < 3) return State::error("STACK UNDERFLOW");
 
   // 1 2 3 -> 2 3 1
-  TokenP token = tokens_[nt - 3];
+  Cell cell = interp_->stack_[nt - 3];
 
-  tokens_[nt - 3] = tokens_[nt - 2];
-  tokens_[nt - 2] = tokens_[nt - 1];
-  tokens_[nt - 1] = token;
+  interp_->stack_[nt - 3] = interp_->stack_[nt - 2];
+  interp_->stack_[nt - 2] = interp_->stack_[nt - 1];
+  interp_->stack_[nt - 1] = cell;
 
   if (isDebug()) {
     IgnoreBase ib;
-    std::cout << "Rot: "; token->print(std::cout); std::cout << std::endl;
+    output() << "Rot: "; cell.print(output()); output() << std::endl;
   }
 
   return State::success();
@@ -1423,13 +6605,13 @@ exec()
 
   if (! n.isInteger()) return State::error("Must be integer");
 
-  int i = n.integer();
+  Integer i = n.integer();
 
-  TokenP token;
+  Cell cell;
 
-  if (! peekToken(i, token)) return State::lastError();
+  if (! peekCell(i, cell)) return State::lastError();
 
-  pushDupToken(token);
+  interp_->stack_.push_back(cell);
 
   return State::success();
 }
@@ -1444,27 +6626,24 @@ exec()
 
   if (! n.isInteger()) return State::error("Must be integer");
 
-  int i = n.integer();
+  Integer i = n.integer();
 
-  auto nt = tokens_.size();
+  auto nt = interp_->stack_.size();
 
-  if (i > int(nt)) return State::error("STACK UNDERFLOW");
+  if (i <= 0 || i > Integer(nt)) return State::error("STACK UNDERFLOW");
 
-  TokenP token = tokens_[nt - i];
+  Cell cell = interp_->stack_[nt - i];
 
-  for (uint n1 = uint(nt - i); n1 < nt; ++n1)
-    tokens_[n1] = tokens_[n1 + 1];
+  interp_->stack_.erase(interp_->stack_.begin() + (nt - i));
 
-  tokens_.pop_back();
-
-  tokens_.push_back(token);
+  interp_->stack_.push_back(cell);
 
   if (isDebug()) {
     IgnoreBase ib;
 
-    std::cout << "Roll(" << i << ") : ";
-    token->print(std::cout);
-    std::cout << std::endl;
+    output() << "Roll(" << i << ") : ";
+    cell.print(output());
+    output() << std::endl;
   }
 
   return State::success();
@@ -1488,7 +6667,7 @@ State
 DepthBuiltin::
 exec()
 {
-  pushInteger(int(tokens_.size()));
+  pushInteger(int(interp_->stack_.size()));
 
   return State::success();
 }
@@ -1497,11 +6676,11 @@ State
 PopRetBuiltin::
 exec()
 {
-  TokenP token;
+  Cell cell;
 
-  if (! popToken(token)) return State::lastError();
+  if (! popCell(cell)) return State::lastError();
 
-  retTokens_.push_back(token);
+  interp_->retStack_.push_back(cell);
 
   return State::success();
 }
@@ -1510,13 +6689,13 @@ State
 PushRetBuiltin::
 exec()
 {
-  if (retTokens_.empty()) return State::error("STACK EMPTY");
+  if (interp_->retStack_.empty()) return State::error("STACK EMPTY");
 
-  TokenP token = retTokens_.back();
+  Cell cell = interp_->retStack_.back();
 
-  retTokens_.pop_back();
+  interp_->retStack_.pop_back();
 
-  pushToken(token);
+  pushCell(cell);
 
   return State::success();
 }
@@ -1525,11 +6704,9 @@ State
 CopyRetBuiltin::
 exec()
 {
-  if (retTokens_.empty()) return State::error("STACK EMPTY");
-
-  TokenP token = retTokens_.back();
+  if (interp_->retStack_.empty()) return State::error("STACK EMPTY");
 
-  pushToken(token);
+  pushCell(interp_->retStack_.back());
 
   return State::success();
 }
@@ -1609,451 +6786,710 @@ State
 PlusBuiltin::
 exec()
 {
-  auto nt = tokens_.size();
+  Number n1, n2;
 
-  if (nt < 2) return State::error("STACK UNDERFLOW");
+  if (! popNumbers(n1, n2)) return State::lastError();
 
-  if      (tokens_[nt - 2]->isVarRef()) {
-    Number n;
+  pushNumber(Number::plus(n1, n2));
 
-    if (! popNumber(n)) return State::lastError();
+  return State::success();
+}
 
-    VarBaseP var;
+State
+MinusBuiltin::
+exec()
+{
+  Number n1, n2;
 
-    if (! popVarRef(var)) return State::lastError();
+  if (! popNumbers(n1, n2)) return State::lastError();
 
-    pushToken(var->indexVar(var, n.integer()));
-  }
-  else if (tokens_[nt - 1]->isVarRef()) {
-    VarBaseP var;
+  pushNumber(Number::minus(n1, n2));
 
-    if (! popVarRef(var)) return State::lastError();
+  return State::success();
+}
 
-    Number n;
+State
+TimesBuiltin::
+exec()
+{
+  Number n1, n2;
 
-    if (! popNumber(n)) return State::lastError();
+  if (! popNumbers(n1, n2)) return State::lastError();
 
-    pushToken(var->indexVar(var, n.integer()));
-  }
-  else {
-    Number n1, n2;
+  pushNumber(Number::times(n1, n2));
 
-    if (! popNumbers(n1, n2)) return State::lastError();
+  return State::success();
+}
 
-    pushNumber(Number::plus(n1, n2));
-  }
+State
+DivideBuiltin::
+exec()
+{
+  Number n1, n2;
+
+  if (! popNumbers(n1, n2)) return State::lastError();
+
+  pushNumber(Number::divide(n1, n2));
 
   return State::success();
 }
 
 State
-MinusBuiltin::
+ModBuiltin::
 exec()
 {
-  auto nt = tokens_.size();
+  Number n1, n2;
 
-  if (nt < 2) return State::error("STACK UNDERFLOW");
+  if (! popNumbers(n1, n2)) return State::lastError();
+
+  pushNumber(Number::mod(n1, n2));
 
-  if      (tokens_[nt - 2]->isVarRef()) {
-    Number n;
+  return State::success();
+}
+
+State
+DModBuiltin::
+exec()
+{
+  Number n1, n2;
 
-    if (! popNumber(n)) return State::lastError();
+  if (! popNumbers(n1, n2)) return State::lastError();
 
-    VarBaseP var;
+  pushNumber(Number::mod   (n1, n2));
+  pushNumber(Number::divide(n1, n2));
 
-    if (! popVarRef(var)) return State::lastError();
+  return State::success();
+}
 
-    pushToken(var->indexVar(var, -n.integer()));
-  }
-  else if (tokens_[nt - 1]->isVarRef()) {
-    VarBaseP var;
+State
+Plus1Builtin::
+exec()
+{
+  Number n;
 
-    if (! popVarRef(var)) return State::lastError();
+  if (! popNumber(n)) return State::lastError();
 
-    Number n;
+  pushNumber(Number::plus(n, Number::makeInteger(1)));
 
-    if (! popNumber(n)) return State::lastError();
+  return State::success();
+}
 
-    pushToken(var->indexVar(var, -n.integer()));
-  }
-  else {
-    Number n1, n2;
+State
+Plus2Builtin::
+exec()
+{
+  Number n;
+
+  if (! popNumber(n)) return State::lastError();
+
+  pushNumber(Number::plus(n, Number::makeInteger(2)));
 
-    if (! popNumbers(n1, n2)) return State::lastError();
+  return State::success();
+}
+
+State
+MulDivBuiltin::
+exec()
+{
+  Number n1, n2, n3;
 
-    pushNumber(Number::minus(n1, n2));
+  if (! popNumbers(n1, n2, n3)) return State::lastError();
+
+  // double cell intermediate product for integers
+  if (n1.isInteger() && n2.isInteger() && n3.isInteger()) {
+    if (n3.integer() == 0) return State::error("DIVIDE BY ZERO");
+
+    pushInteger(Integer(DInteger(n1.integer())*n2.integer()/n3.integer()));
   }
+  else
+    pushNumber(Number::divide(Number::times(n1, n2), n3));
 
   return State::success();
 }
 
 State
-TimesBuiltin::
+MulDModBuiltin::
+exec()
+{
+  Number n1, n2, n3;
+
+  if (! popNumbers(n1, n2, n3)) return State::lastError();
+
+  if (! n1.isInteger() || ! n2.isInteger() || ! n3.isInteger())
+    return State::error("Must be integer");
+
+  if (n3.integer() == 0) return State::error("DIVIDE BY ZERO");
+
+  DInteger d = DInteger(n1.integer())*n2.integer();
+
+  pushInteger(Integer(d % n3.integer()));
+  pushInteger(Integer(d / n3.integer()));
+
+  return State::success();
+}
+
+State
+UTimesBuiltin::
 exec()
 {
   Number n1, n2;
 
   if (! popNumbers(n1, n2)) return State::lastError();
 
-  pushNumber(Number::times(n1, n2));
+  if (! n1.isInteger() || ! n2.isInteger()) return State::error("Must be integer");
+
+  pushDouble(DInteger(UDInteger(UInteger(n1.integer()))*UInteger(n2.integer())));
 
   return State::success();
 }
 
 State
-DivideBuiltin::
+UDModBuiltin::
+exec()
+{
+  Number n;
+
+  if (! popNumber(n)) return State::lastError();
+
+  if (! n.isInteger()) return State::error("Must be integer");
+
+  DInteger d;
+
+  if (! popDouble(d)) return State::lastError();
+
+  UInteger u = UInteger(n.integer());
+
+  if (u == 0) return State::error("DIVIDE BY ZERO");
+
+  UDInteger ud = UDInteger(d);
+
+  pushInteger(Integer(UInteger(ud % u)));
+  pushInteger(Integer(UInteger(ud / u)));
+
+  return State::success();
+}
+
+State
+DPlusBuiltin::
 exec()
 {
+  DInteger d1, d2;
+
+  if (! popDouble(d2)) return State::lastError();
+  if (! popDouble(d1)) return State::lastError();
+
+  // wrap on overflow like single cell arithmetic
+  pushDouble(DInteger(UDInteger(d1) + UDInteger(d2)));
+
+  return State::success();
+}
+
+State
+MaxBuiltin::
+exec()
+{
+  // TODO: use token1->cmp(token2) ???
   Number n1, n2;
 
   if (! popNumbers(n1, n2)) return State::lastError();
 
-  pushNumber(Number::divide(n1, n2));
+  pushNumber(Number::max(n1, n2));
 
   return State::success();
 }
 
 State
-ModBuiltin::
+MinBuiltin::
 exec()
 {
+  // TODO: use token1->cmp(token2) ???
   Number n1, n2;
 
   if (! popNumbers(n1, n2)) return State::lastError();
 
-  pushNumber(Number::mod(n1, n2));
+  pushNumber(Number::min(n1, n2));
+
+  return State::success();
+}
+
+State
+AbsBuiltin::
+exec()
+{
+  Number n;
+
+  if (! popNumber(n)) return State::lastError();
+
+  pushNumber(n.abs());
+
+  return State::success();
+}
+
+State
+NegateBuiltin::
+exec()
+{
+  Number n;
+
+  if (! popNumber(n)) return State::lastError();
+
+  pushNumber(n.neg());
+
+  return State::success();
+}
+
+State
+DNegateBuiltin::
+exec()
+{
+  DInteger d;
+
+  if (! popDouble(d)) return State::lastError();
+
+  pushDouble(DInteger(-UDInteger(d)));
+
+  return State::success();
+}
+
+State
+AndBuiltin::
+exec()
+{
+  Number n1, n2;
+
+  if (! popBoolOrNumbers(n1, n2)) return State::lastError();
+
+  pushNumber(Number::And(n1, n2));
+
+  return State::success();
+}
+
+State
+OrBuiltin::
+exec()
+{
+  Number n1, n2;
+
+  if (! popBoolOrNumbers(n1, n2)) return State::lastError();
+
+  pushNumber(Number::Or(n1, n2));
+
+  return State::success();
+}
+
+State
+XorBuiltin::
+exec()
+{
+  Number n1, n2;
+
+  if (! popBoolOrNumbers(n1, n2)) return State::lastError();
+
+  pushNumber(Number::Xor(n1, n2));
+
+  return State::success();
+}
+
+// Memory
+State
+FetchBuiltin::
+exec()
+{
+  if (interp_->stack_.empty()) return State::error("STACK UNDERFLOW");
+
+  Cell cell = interp_->stack_.back();
+
+  interp_->stack_.pop_back();
+
+  if (! cell.isInteger()) return State::error("Not a variable");
+
+  Cell value = interp_->memory_.get(cell.integer());
+
+  if (! value.isValid()) return State::error("invalid variable");
+
+  interp_->stack_.push_back(value);
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Fetch ";
+    cell.print(output());
+    output() << " = ";
+    value.print(output());
+    output() << std::endl;
+  }
+
+  return State::success();
+}
+
+State
+StoreBuiltin::
+exec()
+{
+  auto nt = interp_->stack_.size();
+
+  if (nt < 2) return State::error("STACK UNDERFLOW");
+
+  Cell cell1 = interp_->stack_[nt - 1];
+  Cell cell2 = interp_->stack_[nt - 2];
+
+  interp_->stack_.pop_back();
+  interp_->stack_.pop_back();
+
+  if (! cell1.isInteger()) return State::error("Not a variable");
+
+  if (! interp_->memory_.set(cell1.integer(), cell2)) return State::error("invalid variable");
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Store ";
+    cell1.print(output());
+    output() << " = ";
+    cell2.print(output());
+    output() << std::endl;
+  }
 
   return State::success();
 }
 
 State
-DModBuiltin::
+PFetchBuiltin::
 exec()
 {
-  Number n1, n2;
+  int addr;
 
-  if (! popNumbers(n1, n2)) return State::lastError();
+  if (! popAddress(addr)) return State::lastError();
 
-  pushNumber(Number::mod   (n1, n2));
-  pushNumber(Number::divide(n1, n2));
+  interp_->memory_.get(addr).print(output());
+
+  output() << " ";
 
   return State::success();
 }
 
 State
-Plus1Builtin::
+AddStoreBuiltin::
 exec()
 {
-  if (tokens_.empty()) return State::error("STACK UNDERFLOW");
+  int addr;
 
-  TokenP token = tokens_.back();
+  if (! popAddress(addr)) return State::lastError();
 
-  tokens_.pop_back();
+  Number n;
 
-  if      (token->isVarRef()) {
-    VarBaseP var = VarBase::fromToken(token);
+  if (! popNumber(n)) return State::lastError();
 
-    pushToken(var->indexVar(var, 1));
-  }
-  else {
-    Number n;
+  Cell cell = interp_->memory_.get(addr);
 
-    if (! tokenToNumber(token, n)) return State::lastError();
+  if (! cell.isNumber()) return State::error("var must be number");
 
-    pushNumber(Number::plus(n, Number::makeInteger(1)));
+  interp_->memory_.set(addr, Cell::makeNumber(Number::plus(cell.number(), n)));
+
+  if (isDebug()) {
+    IgnoreBase ib;
+
+    output() << "Set " << addr << " = ";
+    n.print(output());
+    output() << std::endl;
   }
 
   return State::success();
 }
 
 State
-Plus2Builtin::
+MoveBuiltin::
 exec()
 {
-  if (tokens_.empty()) return State::error("STACK UNDERFLOW");
-
-  TokenP token = tokens_.back();
+  Number n;
 
-  tokens_.pop_back();
+  if (! popNumber(n)) return State::lastError();
 
-  if      (token->isVarRef()) {
-    VarBaseP var = VarBase::fromToken(token);
+  int addr1, addr2;
 
-    pushToken(var->indexVar(var, 2));
-  }
-  else {
-    Number n;
+  if (! popAddress(addr2)) return State::lastError();
+  if (! popAddress(addr1)) return State::lastError();
 
-    if (! tokenToNumber(token, n)) return State::lastError();
+  if (n.integer() <= 0)
+    return State::success();
 
-    pushNumber(Number::plus(n, Number::makeInteger(2)));
-  }
+  if (! interp_->memory_.move(addr1, addr2, n.integer()))
+    return State::error("invalid address range");
 
   return State::success();
 }
 
 State
-MulDivBuiltin::
+CMoveBuiltin::
 exec()
 {
-  Number n1, n2, n3;
-
-  if (! popNumbers(n1, n2, n3)) return State::lastError();
+  Number n;
 
-  pushNumber(Number::divide(Number::times(n1, n2), n3));
+  if (! popNumber(n)) return State::lastError();
 
-  return State::success();
-}
+  int addr1, addr2;
 
-State
-MaxBuiltin::
-exec()
-{
-  // TODO: use token1->cmp(token2) ???
-  Number n1, n2;
+  if (! popAddress(addr2)) return State::lastError();
+  if (! popAddress(addr1)) return State::lastError();
 
-  if (! popNumbers(n1, n2)) return State::lastError();
+  if (n.integer() <= 0)
+    return State::success();
 
-  pushNumber(Number::max(n1, n2));
+  if (! interp_->memory_.copyUp(addr1, addr2, n.integer()))
+    return State::error("invalid address range");
 
   return State::success();
 }
 
 State
-MinBuiltin::
+CMoveUpBuiltin::
 exec()
 {
-  // TODO: use token1->cmp(token2) ???
-  Number n1, n2;
+  Number n;
 
-  if (! popNumbers(n1, n2)) return State::lastError();
+  if (! popNumber(n)) return State::lastError();
 
-  pushNumber(Number::min(n1, n2));
+  int addr1, addr2;
+
+  if (! popAddress(addr2)) return State::lastError();
+  if (! popAddress(addr1)) return State::lastError();
+
+  if (n.integer() <= 0)
+    return State::success();
+
+  if (! interp_->memory_.copyDown(addr1, addr2, n.integer()))
+    return State::error("invalid address range");
 
   return State::success();
 }
 
 State
-AbsBuiltin::
+FillBuiltin::
 exec()
 {
+  Cell cell;
+
+  if (! popCell(cell)) return State::lastError();
+
   Number n;
 
   if (! popNumber(n)) return State::lastError();
 
-  pushNumber(n.abs());
+  int addr;
+
+  if (! popAddress(addr)) return State::lastError();
+
+  if (n.integer() <= 0)
+    return State::success();
+
+  if (! interp_->memory_.fill(addr, n.integer(), cell))
+    return State::error("invalid address range");
 
   return State::success();
 }
 
 State
-NegateBuiltin::
+EraseBuiltin::
 exec()
 {
   Number n;
 
   if (! popNumber(n)) return State::lastError();
 
-  pushNumber(n.neg());
+  int addr;
+
+  if (! popAddress(addr)) return State::lastError();
+
+  if (n.integer() <= 0)
+    return State::success();
+
+  if (! interp_->memory_.fill(addr, n.integer(), Cell::makeInteger(0)))
+    return State::error("invalid address range");
 
   return State::success();
 }
 
+// Floating point
 State
-AndBuiltin::
+FPlusBuiltin::
 exec()
 {
-  Number n1, n2;
+  double r1, r2;
 
-  if (! popBoolOrNumbers(n1, n2)) return State::lastError();
+  if (! popFloats(r1, r2)) return State::lastError();
 
-  pushNumber(Number::And(n1, n2));
+  interp_->fstack_.push_back(r1 + r2);
 
   return State::success();
 }
 
 State
-OrBuiltin::
+FMinusBuiltin::
 exec()
 {
-  Number n1, n2;
+  double r1, r2;
 
-  if (! popBoolOrNumbers(n1, n2)) return State::lastError();
+  if (! popFloats(r1, r2)) return State::lastError();
 
-  pushNumber(Number::Or(n1, n2));
+  interp_->fstack_.push_back(r1 - r2);
 
   return State::success();
 }
 
 State
-XorBuiltin::
+FTimesBuiltin::
 exec()
 {
-  Number n1, n2;
+  double r1, r2;
 
-  if (! popBoolOrNumbers(n1, n2)) return State::lastError();
+  if (! popFloats(r1, r2)) return State::lastError();
 
-  pushNumber(Number::Xor(n1, n2));
+  interp_->fstack_.push_back(r1 * r2);
 
   return State::success();
 }
 
-// Memory
 State
-FetchBuiltin::
+FDivideBuiltin::
 exec()
 {
-  if (tokens_.empty()) return State::error("STACK UNDERFLOW");
+  double r1, r2;
 
-  TokenP token = tokens_.back();
+  if (! popFloats(r1, r2)) return State::lastError();
 
-  tokens_.pop_back();
+  interp_->fstack_.push_back(r1 / r2);
 
-  if (! token->isVarRef()) return State::error("Not a variable");
-
-  VarBaseP var = VarBase::fromToken(token);
+  return State::success();
+}
 
-  token = var->value();
+State
+FFetchBuiltin::
+exec()
+{
+  int addr;
 
-  if (! token.get()) return State::error("invalid variable");
+  if (! popAddress(addr)) return State::lastError();
 
-  tokens_.push_back(token);
+  Cell cell = interp_->memory_.get(addr);
 
-  if (isDebug()) {
-    IgnoreBase ib;
+  if (! cell.isNumber() && ! cell.isBoolean()) return State::error("must be number");
 
-    std::cout << "Fetch ";
-    var->print(std::cout);
-    std::cout << " = ";
-    token->print(std::cout);
-    std::cout << std::endl;
-  }
+  interp_->fstack_.push_back(cell.real());
 
   return State::success();
 }
 
 State
-StoreBuiltin::
+FStoreBuiltin::
 exec()
 {
-  auto nt = tokens_.size();
+  int addr;
 
-  if (nt < 2) return State::error("STACK UNDERFLOW");
-
-  TokenP token1 = tokens_[nt - 1];
-  TokenP token2 = tokens_[nt - 2];
-
-  tokens_.pop_back();
-  tokens_.pop_back();
-
-  if (! token1->isVarRef()) return State::error("Not a variable");
+  if (! popAddress(addr)) return State::lastError();
 
-  VarBaseP var = VarBase::fromToken(token1);
+  double r;
 
-  if (! var->setValue(token2)) return State::error("invalid variable");
+  if (! popFloat(r)) return State::lastError();
 
-  if (isDebug()) {
-    IgnoreBase ib;
-
-    std::cout << "Store ";
-    var->print(std::cout);
-    std::cout << " = ";
-    token2->print(std::cout);
-    std::cout << std::endl;
-  }
+  interp_->memory_.set(addr, Cell::makeReal(r));
 
   return State::success();
 }
 
 State
-PFetchBuiltin::
+FDupBuiltin::
 exec()
 {
-  VarBaseP var;
-
-  if (! popVarRef(var)) return State::lastError();
+  if (interp_->fstack_.empty()) return State::error("FLOAT STACK EMPTY");
 
-  TokenP token = var->value();
+  interp_->fstack_.push_back(interp_->fstack_.back());
 
-  if (! token.get()) return State::error("invalid variable");
+  return State::success();
+}
 
-  token->print(std::cout);
+State
+FDropBuiltin::
+exec()
+{
+  if (interp_->fstack_.empty()) return State::error("FLOAT STACK EMPTY");
 
-  std::cout << " ";
+  interp_->fstack_.pop_back();
 
   return State::success();
 }
 
 State
-AddStoreBuiltin::
+FSwapBuiltin::
 exec()
 {
-  VariableP var;
+  auto nf = interp_->fstack_.size();
 
-  if (! popVariable(var)) return State::lastError();
+  if (nf < 2) return State::error("FLOAT STACK EMPTY");
 
-  Number n;
-
-  if (! popNumber(n)) return State::lastError();
+  std::swap(interp_->fstack_[nf - 2], interp_->fstack_[nf - 1]);
 
-  TokenP token = var->value();
+  return State::success();
+}
 
-  if (! token.get()) return State::error("invalid variable");
+State
+FSqrtBuiltin::
+exec()
+{
+  if (interp_->fstack_.empty()) return State::error("FLOAT STACK EMPTY");
 
-  if (! token->isNumber()) return State::error("var must be number");
+  interp_->fstack_.back() = std::sqrt(interp_->fstack_.back());
 
-  Number vn = NumberToken::fromToken(token)->number();
+  return State::success();
+}
 
-  var->setValue(NumberToken::makeNumber(Number::plus(vn, n)));
+State
+FLessBuiltin::
+exec()
+{
+  double r1, r2;
 
-  if (isDebug()) {
-    IgnoreBase ib;
+  if (! popFloats(r1, r2)) return State::lastError();
 
-    std::cout << "Set " << var->name() << " = ";
-    n.print(std::cout);
-    std::cout << std::endl;
-  }
+  pushBoolean(r1 < r2);
 
   return State::success();
 }
 
 State
-MoveBuiltin::
+SToFBuiltin::
 exec()
 {
   Number n;
 
   if (! popNumber(n)) return State::lastError();
 
-  VarBaseP var1, var2;
-
-  if (! popVarRef(var2)) return State::lastError();
-  if (! popVarRef(var1)) return State::lastError();
-
-  for (int i = 0; i < n.integer(); ++i)
-    var2->setIndValue(i, var1->indValue(i));
+  interp_->fstack_.push_back(n.real());
 
   return State::success();
 }
 
 State
-FillBuiltin::
+FToSBuiltin::
 exec()
 {
-  TokenP token;
+  double r;
 
-  if (! popToken(token)) return State::lastError();
+  if (! popFloat(r)) return State::lastError();
 
-  Number n;
+  pushInteger(Integer(r));
 
-  if (! popNumber(n)) return State::lastError();
+  return State::success();
+}
 
-  VarBaseP var;
+State
+FPrintBuiltin::
+exec()
+{
+  double r;
 
-  if (! popVarRef(var)) return State::lastError();
+  if (! popFloat(r)) return State::lastError();
 
-  for (int i = 0; i < n.integer(); ++i)
-    var->setIndValue(i, token);
+  output() << r << " ";
 
   return State::success();
 }
@@ -2063,31 +7499,29 @@ State
 DoBuiltin::
 exec()
 {
-  TokenP startToken, endToken;
-
-  if (! popTokens(endToken, startToken)) return State::lastError();
+  Cell startCell, endCell;
 
-  // push end and start on return stack
-  startToken = startToken->dup();
+  if (! popCells(endCell, startCell)) return State::lastError();
 
-  retTokens_.push_back(startToken);
-  retTokens_.push_back(endToken  );
+  // push start (loop index) and end on return stack
+  interp_->retStack_.push_back(startCell);
+  interp_->retStack_.push_back(endCell  );
 
-  if (! exec1(startToken, endToken)) return State::lastError();
+  if (! exec1(interp_->retStack_.size() - 2)) return State::lastError();
 
-  retTokens_.pop_back();
-  retTokens_.pop_back();
+  interp_->retStack_.pop_back();
+  interp_->retStack_.pop_back();
 
   return State::success();
 }
 
 State
 DoBuiltin::
-exec1(TokenP &startToken, TokenP &endToken)
+exec1(size_t pos)
 {
   int cmp;
 
-  if (! endToken->cmp(startToken, cmp)) return State::lastError();
+  if (! Cell::cmp(interp_->retStack_[pos + 1], interp_->retStack_[pos], cmp)) return State::lastError();
 
   bool up = (cmp > 0);
 
@@ -2097,11 +7531,13 @@ exec1(TokenP &startToken, TokenP &endToken)
   tokens_.leave = false;
 
   for (;;) {
-    if (! endToken->cmp(startToken, cmp)) return State::lastError();
+    if (pos + 1 >= interp_->retStack_.size()) return State::error("Return stack corrupted");
+
+    if (! Cell::cmp(interp_->retStack_[pos + 1], interp_->retStack_[pos], cmp)) return State::lastError();
 
     if (up ? cmp <= 0 : cmp >= 0) break;
 
-    for (auto token : tokens_.tokens) {
+    for (const auto &token : tokens_.tokens) {
       if (! execToken(token))
         return State::lastError();
 
@@ -2120,7 +7556,9 @@ exec1(TokenP &startToken, TokenP &endToken)
       inc = n;
     }
 
-    if (! startToken->inc(inc)) return State::lastError();
+    if (pos + 1 >= interp_->retStack_.size()) return State::error("Return stack corrupted");
+
+    if (! interp_->retStack_[pos].inc(inc)) return State::lastError();
   }
 
   return State::success();
@@ -2163,7 +7601,7 @@ print(std::ostream &os) const
 {
   os << "DO ";
 
-  for (auto token : tokens_.tokens) {
+  for (const auto &token : tokens_.tokens) {
     token->print(os);
 
     os << " ";
@@ -2179,11 +7617,11 @@ State
 IBuiltin::
 exec()
 {
-  auto n = retTokens_.size();
+  auto n = interp_->retStack_.size();
 
   if (n < 2) return State::error("Not in DO");
 
-  pushToken(retTokens_[n - 2]);
+  pushCell(interp_->retStack_[n - 2]);
 
   return State::success();
 }
@@ -2192,11 +7630,11 @@ State
 JBuiltin::
 exec()
 {
-  auto n = retTokens_.size();
+  auto n = interp_->retStack_.size();
 
   if (n < 4) return State::error("Not in double nested DO");
 
-  pushToken(retTokens_[n - 4]);
+  pushCell(interp_->retStack_[n - 4]);
 
   return State::success();
 }
@@ -2205,22 +7643,22 @@ State
 LeaveBuiltin::
 exec()
 {
-  for (int n = int(execTokens_.size()) - 1; n >= 0; --n) {
-    TokenP execToken = execTokens_[n];
+  for (int n = int(interp_->execTokens_.size()) - 1; n >= 0; --n) {
+    TokenP execToken = interp_->execTokens_[n];
 
     if (! execToken->isBuiltin()) continue;
 
     BuiltinP builtin = Builtin::fromToken(execToken);
 
     if      (builtin->builtinType() == Builtin::DO_BUILTIN) {
-      DoBuiltinP doBuiltin = std::static_pointer_cast<DoBuiltin>(builtin);
+      DoBuiltinP doBuiltin = refCast<DoBuiltin>(builtin);
 
       doBuiltin->getValue().leave = true;
 
       return State::success();
     }
     else if (builtin->builtinType() == Builtin::BEGIN_BUILTIN) {
-      BeginBuiltinP beginBuiltin = std::static_pointer_cast<BeginBuiltin>(builtin);
+      BeginBuiltinP beginBuiltin = refCast<BeginBuiltin>(builtin);
 
       beginBuiltin->getValue().leave = true;
 
@@ -2240,13 +7678,13 @@ exec()
   if (! popBoolean(b)) return State::lastError();
 
   if (b) {
-    for (auto token : tokens_.ifTokens) {
+    for (const auto &token : tokens_.ifTokens) {
       if (! execToken(token))
         return State::lastError();
     }
   }
   else {
-    for (auto token : tokens_.elseTokens) {
+    for (const auto &token : tokens_.elseTokens) {
       if (! execToken(token))
         return State::lastError();
     }
@@ -2297,7 +7735,7 @@ print(std::ostream &os) const
 {
   os << "IF ";
 
-  for (auto token : tokens_.ifTokens) {
+  for (const auto &token : tokens_.ifTokens) {
     token->print(os);
 
     os << " ";
@@ -2306,7 +7744,7 @@ print(std::ostream &os) const
   if (! tokens_.elseTokens.empty()) {
     os << "ELSE ";
 
-    for (auto token : tokens_.elseTokens) {
+    for (const auto &token : tokens_.elseTokens) {
       token->print(os);
 
       os << " ";
@@ -2324,7 +7762,7 @@ exec()
 
   if (tokens_.is_until) {
     for (;;) {
-      for (auto token : tokens_.tokens) {
+      for (const auto &token : tokens_.tokens) {
         if (! execToken(token))
           return State::lastError();
 
@@ -2346,7 +7784,7 @@ exec()
   }
   else {
     for (;;) {
-      for (auto token : tokens_.whileTokens) {
+      for (const auto &token : tokens_.whileTokens) {
         if (! execToken(token))
           return State::lastError();
 
@@ -2365,7 +7803,7 @@ exec()
       if (b)
         break;
 
-      for (auto token : tokens_.tokens) {
+      for (const auto &token : tokens_.tokens) {
         if (! execToken(token))
           return State::lastError();
 
@@ -2438,7 +7876,7 @@ print(std::ostream &os) const
   os << "BEGIN ";
 
   if (tokens_.is_until) {
-    for (auto token : tokens_.tokens) {
+    for (const auto &token : tokens_.tokens) {
       token->print(os);
 
       os << " ";
@@ -2447,7 +7885,7 @@ print(std::ostream &os) const
     os << "UNTIL";
   }
   else {
-    for (auto token : tokens_.whileTokens) {
+    for (const auto &token : tokens_.whileTokens) {
       token->print(os);
 
       os << " ";
@@ -2455,7 +7893,7 @@ print(std::ostream &os) const
 
     os << "WHILE";
 
-    for (auto token : tokens_.tokens) {
+    for (const auto &token : tokens_.tokens) {
       token->print(os);
 
       os << " ";
@@ -2475,7 +7913,7 @@ exec()
   if (! popNumber(n))
     return State::lastError();
 
-  std::cout << char(n.integer());
+  output() << char(n.integer());
 
   return State::success();
 }
@@ -2484,7 +7922,7 @@ State
 PrintToBuiltin::
 exec()
 {
-  std::cout << text_;
+  output() << text_;
 
   return State::success();
 }
@@ -2496,13 +7934,13 @@ readModifier()
   if (! fillBuffer())
     return State::error("Missing char");
 
-  text_ = line_.getChar();
+  text_ = interp_->line_.getChar();
 
-  while (line_.isValid() && ! line_.isChar('"'))
-    text_ += line_.getChar();
+  while (interp_->line_.isValid() && ! interp_->line_.isChar('"'))
+    text_ += interp_->line_.getChar();
 
-  if (line_.isChar('"'))
-    line_.skipChar();
+  if (interp_->line_.isChar('"'))
+    interp_->line_.skipChar();
 
   return State::success();
 }
@@ -2524,15 +7962,15 @@ exec()
 
   if (! popNumber(n)) return State::lastError();
 
-  VarBaseP var;
+  int addr;
 
-  if (! popVarRef(var)) return State::lastError();
+  if (! popAddress(addr)) return State::lastError();
 
   for (int i = 0; i < n.integer(); ++i) {
-    TokenP token = var->indValue(i);
+    Cell cell = interp_->memory_.get(addr + i);
 
-    if (token->isNumber())
-      std::cout << char(NumberToken::fromToken(token)->integer());
+    if (cell.isNumber())
+      output() << char(cell.integer());
   }
 
   return State::success();
@@ -2544,6 +7982,10 @@ exec()
 {
   char c = char(getch());
 
+  foldSource(std::string(1, c));
+
+  setLoadImpure();
+
   pushInteger(c);
 
   return State::success();
@@ -2557,19 +7999,27 @@ exec()
 
   if (! popNumber(n)) return State::lastError();
 
-  VarBaseP var;
+  int addr;
 
-  if (! popVarRef(var)) return State::lastError();
+  if (! popAddress(addr)) return State::lastError();
+
+  std::string str;
 
   for (int i = 0; i < n.integer(); ++i) {
     char c = char(fgetc(stdin));
 
+    str += c;
+
     if (c == '\n')
       break;
 
-    var->setIndValue(i, NumberToken::makeInteger(c));
+    interp_->memory_.set(addr + i, Cell::makeInteger(c));
   }
 
+  foldSource(str);
+
+  setLoadImpure();
+
   return State::success();
 }
 
@@ -2590,7 +8040,11 @@ exec()
     str += c;
   }
 
-  line_.insert(str);
+  foldSource(str);
+
+  setLoadImpure();
+
+  interp_->line_.insert(str);
 
   return State::success();
 }
@@ -2599,8 +8053,6 @@ State
 WordBuiltin::
 exec()
 {
-  wordVar_ = getWordVar();
-
   Number n;
 
   if (! popNumber(n)) return State::lastError();
@@ -2612,28 +8064,29 @@ exec()
 
   std::string str;
 
-  str += line_.getChar();
+  str += interp_->line_.getChar();
 
-  while (line_.isValid() && ! line_.isChar(lastC))
-    str += line_.getChar();
+  while (interp_->line_.isValid() && ! interp_->line_.isChar(lastC))
+    str += interp_->line_.getChar();
 
-  if (line_.isChar(lastC))
-    line_.getChar();
+  if (interp_->line_.isChar(lastC))
+    interp_->line_.getChar();
 
   if (isDebug())
-    std::cout << "Word: '" << str << "'" << std::endl;
+    output() << "Word: '" << str << "'" << std::endl;
 
-  auto len = str.size();
+  // counted string at HERE (transient, not allocated)
+  int len  = int(str.size());
+  int addr = interp_->memory_.here();
 
-  if (wordVar_->length() < int(len + 1))
-    wordVar_->allot(int(len + 1 - wordVar_->length()));
+  interp_->memory_.reserve(len + 1);
 
-  wordVar_->setIndValue(0, NumberToken::makeInteger(int(len)));
+  interp_->memory_.set(addr, Cell::makeInteger(len));
 
-  for (size_t i = 1; i <= len; ++i)
-    wordVar_->setIndValue(int(i), NumberToken::makeInteger(str[i - 1]));
+  for (int i = 1; i <= len; ++i)
+    interp_->memory_.set(addr + i, Cell::makeInteger(str[i - 1]));
 
-  pushToken(wordVar_);
+  pushInteger(addr);
 
   return State::success();
 }
@@ -2642,13 +8095,13 @@ State
 CountBuiltin::
 exec()
 {
-  VarBaseP var;
+  int addr;
 
-  if (! popVarRef(var)) return State::lastError();
+  if (! popAddress(addr)) return State::lastError();
 
-  pushToken(var->indexVar(var, 1));
+  pushInteger(addr + 1);
 
-  pushToken(var->indValue(0));
+  pushCell(interp_->memory_.get(addr));
 
   return State::success();
 }
@@ -2661,25 +8114,25 @@ exec()
 
   if (! popNumber(n)) return State::lastError();
 
-  VarBaseP var;
+  int addr;
 
-  if (! popVarRef(var)) return State::lastError();
+  if (! popAddress(addr)) return State::lastError();
 
-  int i = n.integer() - 1;
+  Integer i = n.integer() - 1;
 
   while (i >= 0) {
-    TokenP token = var->indValue(i);
+    Cell cell = interp_->memory_.get(addr + i);
 
-    if (! token->isNumber())
+    if (! cell.isNumber())
       break;
 
-    if (! isspace(char(NumberToken::fromToken(token)->integer())))
+    if (! isspace(char(cell.integer())))
       break;
 
     --i;
   }
 
-  pushToken(var);
+  pushInteger(addr);
 
   pushNumber(Number::makeInteger(i + 1));
 
@@ -2691,10 +8144,10 @@ State
 DecimalBuiltin::
 exec()
 {
-  VariableP var;
-
-  if (! lookupVariable("BASE", var))
-    var = defineVariable("BASE", 10);
+  if (! interp_->baseVar_)
+    interp_->baseVar_ = defineVariable("BASE", 10).get();
+  else
+    interp_->baseVar_->setInteger(10);
 
   return State::success();
 }
@@ -2703,24 +8156,17 @@ State
 PrintBuiltin::
 exec()
 {
-  TokenP token;
+  Cell cell;
 
-  if (! popToken(token)) {
-    std::cout << "0" << std::endl;
+  if (! popCell(cell)) {
+    output() << "0" << std::endl;
 
     return State::lastError();
   }
 
-  if (token->isVariable()) {
-    VariableP var = Variable::fromToken(token);
-
-    if (var->isConstant())
-      token = var->value();
-  }
-
-  token->print(std::cout);
+  cell.print(output());
 
-  std::cout << " ";
+  output() << " ";
 
   return State::success();
 }
@@ -2729,12 +8175,12 @@ State
 PStackBuiltin::
 exec()
 {
-  auto nt = tokens_.size();
+  auto nt = interp_->stack_.size();
 
   for (size_t i = 0; i < nt; ++i) {
-    if (i > 0) std::cout << " ";
+    if (i > 0) output() << " ";
 
-    tokens_[i]->print(std::cout);
+    interp_->stack_[i].print(output());
   }
 
   return State::success();
@@ -2745,7 +8191,7 @@ State
 LoadBuiltin::
 exec()
 {
-  if (! parseFile(filename_.c_str()))
+  if (! loadFile(filename_.c_str()))
     return State::success();
 
   return State::success();
@@ -2775,6 +8221,68 @@ print(std::ostream &os) const
   os << "LOAD \"" << filename_ << "\"";
 }
 
+State
+SaveImageBuiltin::
+exec()
+{
+  return saveImage(filename_.c_str());
+}
+
+State
+SaveImageBuiltin::
+readModifier()
+{
+  if (! fillBuffer())
+    return State::error("Missing char");
+
+  Word filename;
+
+  if (! readWord(filename))
+    return State::error("Missing word");
+
+  filename_ = filename.value();
+
+  return State::success();
+}
+
+void
+SaveImageBuiltin::
+print(std::ostream &os) const
+{
+  os << "SAVE-IMAGE \"" << filename_ << "\"";
+}
+
+State
+LoadImageBuiltin::
+exec()
+{
+  return loadImage(filename_.c_str());
+}
+
+State
+LoadImageBuiltin::
+readModifier()
+{
+  if (! fillBuffer())
+    return State::error("Missing char");
+
+  Word filename;
+
+  if (! readWord(filename))
+    return State::error("Missing word");
+
+  filename_ = filename.value();
+
+  return State::success();
+}
+
+void
+LoadImageBuiltin::
+print(std::ostream &os) const
+{
+  os << "LOAD-IMAGE \"" << filename_ << "\"";
+}
+
 // Defining Words
 State
 DefineBuiltin::
@@ -2820,7 +8328,7 @@ exec()
   if (! readWord(word))
     return State::error("Missing word");
 
-  currentVar_ = defineVariable(word.value(), 0);
+  interp_->currentVar_ = defineVariable(word.value(), 0).get();
 
   return State::success();
 }
@@ -2829,18 +8337,16 @@ State
 ConstantBuiltin::
 exec()
 {
-  TokenP token;
+  Cell cell;
 
-  if (! popToken(token)) return State::lastError();
+  if (! popCell(cell)) return State::lastError();
 
   Word word;
 
   if (! readWord(word))
     return State::error("Missing word");
 
-  VariableP var = defineVariable(word.value(), token);
-
-  var->setConstant(true);
+  defineConstant(word.value(), cell);
 
   return State::success();
 }
@@ -2854,7 +8360,7 @@ exec()
   if (! readWord(word))
     return State::error("Missing word");
 
-  currentVar_ = defineVariable(word.value());
+  interp_->currentVar_ = defineVariable(word.value()).get();
 
   return State::success();
 }
@@ -2863,34 +8369,54 @@ State
 CommaBuiltin::
 exec()
 {
-  if (tokens_.empty()) return State::error("STACK EMPTY");
+  if (interp_->stack_.empty()) return State::error("STACK EMPTY");
 
-  TokenP token = tokens_.back();
+  Cell cell = interp_->stack_.back();
 
-  tokens_.pop_back();
+  interp_->stack_.pop_back();
 
-  if (! currentVar_.get()) return State::error("No current variable");
+  interp_->memory_.allot(1);
 
-  currentVar_->addValue(token);
+  interp_->memory_.set(interp_->memory_.here() - 1, cell);
 
   if (isDebug()) {
-    currentVar_->print(std::cout);
-    std::cout << " , ";
-    token->print(std::cout);
-    std::cout << std::endl;
+    output() << interp_->memory_.here() - 1 << " , ";
+    cell.print(output());
+    output() << std::endl;
   }
 
   return State::success();
 }
 
+State
+setDoesFunction(CodeFn fn)
+{
+  if (! interp_->currentVar_)
+    return State::error("No current variable");
+
+  if (interp_->currentVar_->isFrozen())
+    return State::error("Frozen variable");
+
+  recordChange(interp_->currentVar_);
+
+  interp_->currentVar_->setExecFunction(fn);
+
+  return State::success();
+}
+
 State
 DoesBuiltin::
 exec()
 {
-  if (! currentVar_.get())
+  if (! interp_->currentVar_)
     return State::error("No current variable");
 
-  currentVar_->setExecTokens(tokens_);
+  if (interp_->currentVar_->isFrozen())
+    return State::error("Frozen variable");
+
+  recordChange(interp_->currentVar_);
+
+  interp_->currentVar_->setExecTokens(tokens_);
 
   return State::success();
 }
@@ -2905,7 +8431,7 @@ readModifier()
     if (! fillBuffer())
       return State::error("Missing char");
 
-    int pos = line_.pos();
+    int pos = interp_->line_.pos();
 
     Word word;
 
@@ -2913,7 +8439,7 @@ readModifier()
       return State::error("Missing word");
 
     if (word == ";") {
-      line_.setPos(pos);
+      interp_->line_.setPos(pos);
       break;
     }
 
@@ -2934,7 +8460,7 @@ print(std::ostream &os) const
 {
   os << "DOES> ";
 
-  for (auto token : tokens_) {
+  for (const auto &token : tokens_) {
     token->print(os);
 
     os << " ";
@@ -2950,15 +8476,21 @@ exec()
   if (! readWord(word))
     return State::error("Missing word");
 
-  VariableP  var;
-  ProcedureP proc;
+  TokenP token;
+
+  if (! lookupWord(word.value(), token))
+    return State::error("Unknown word");
+
+  // shared base definitions can not be removed
+  if (token->isFrozen())
+    return State::error("Frozen word");
 
-  if      (lookupVariable(word.value(), var)) {
-    if (forgetVariable(word.value()))
+  if      (token->isVariable()) {
+    if (! forgetVariable(word.value()))
       return State::error("Unknown variable");
   }
-  else if (lookupProcedure(word.value(), proc)) {
-    if (forgetProcedure(word.value()))
+  else if (token->isProcedure()) {
+    if (! forgetProcedure(word.value()))
       return State::error("Unknown procedure");
   }
   else
@@ -2976,10 +8508,8 @@ exec()
 
   if (! popNumber(n)) return State::lastError();
 
-  if (! currentVar_.get())
-    return State::error("No current variable");
-
-  currentVar_->allot(n.integer());
+  if (! interp_->memory_.allot(n.integer()))
+    return State::error("invalid allot");
 
   return State::success();
 }
@@ -2999,13 +8529,13 @@ readModifier()
   if (! fillBuffer())
     return State::error("Missing char");
 
-  text_ = line_.getChar();
+  text_ = interp_->line_.getChar();
 
-  while (line_.isValid() && ! line_.isChar(')'))
-    text_ += line_.getChar();
+  while (interp_->line_.isValid() && ! interp_->line_.isChar(')'))
+    text_ += interp_->line_.getChar();
 
-  if (line_.isChar(')'))
-    line_.skipChar();
+  if (interp_->line_.isChar(')'))
+    interp_->line_.skipChar();
 
   return State::success();
 }
@@ -3023,9 +8553,7 @@ State
 HereBuiltin::
 exec()
 {
-  wordVar_ = getWordVar();
-
-  pushToken(wordVar_);
+  pushInteger(interp_->memory_.here());
 
   return State::success();
 }
@@ -3037,6 +8565,7 @@ exec()
   clearRetTokens ();
   clearExecTokens();
   clearTokens    ();
+  clearFloats    ();
 
   throw abortSignal();
 
@@ -3068,4 +8597,28 @@ exec()
   return State::success();
 }
 
+State
+EffectBuiltin::
+exec()
+{
+  Word word;
+
+  if (! readWord(word))
+    return State::error("Missing word");
+
+  TokenP token;
+
+  if (! lookupWord(word.value(), token))
+    return State::error("Unknown word");
+
+  StackEffect effect;
+
+  if (tokenEffect(token.get(), effect))
+    output() << "( " << effect.in << " -- " << effect.out << " ) ";
+  else
+    output() << "( ? ) ";
+
+  return State::success();
+}
+
 }
@@ -0,0 +1,659 @@
+#include <CForth.h>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+
+// Ahead of time translator. Runs forth files with the normal parser to build the
+// dictionary and data space, then writes a C++ file with one function per colon
+// definition (and DOES> body) which recreates that state when linked with libCForth.
+
+using namespace CForth;
+
+class Translator {
+ public:
+  Translator(const TokenArray &oldDefs, int baseHere) :
+   baseHere_(baseHere) {
+    for (const auto &token : oldDefs)
+      oldDefs_.insert(token.get());
+  }
+
+  bool translate();
+
+  void write(std::ostream &os, bool init, const std::string &mainWord) const;
+
+  const std::string &errorMsg() const { return errorMsg_; }
+
+ private:
+  typedef std::map<const Token *, int> TokenIds;
+  typedef std::map<int, int>           VarDoes;
+
+  int addProcedure(Procedure *proc);
+  int addVariable (Variable  *var);
+  int addBuiltin  (Builtin   *builtin);
+  int addDoes     (const TokenArray &tokens);
+
+  bool translateCode(const Code &code, std::ostream &os);
+
+  bool translateExec(Token *token, std::ostream &os);
+
+  bool cellStr(const Cell &cell, std::string &str) const;
+
+  bool error(const std::string &msg) { errorMsg_ = msg; return false; }
+
+  static std::string quote(const std::string &str);
+
+ private:
+  struct Function {
+    std::string comment;
+    std::string body;
+  };
+
+  typedef std::vector<Function>    Functions;
+
+  std::set<const Token *> oldDefs_;
+  int                     baseHere_;
+  TokenArray              newDefs_;
+  TokenIds                procIds_, varIds_, builtinIds_;
+  std::vector<Procedure*> procs_;
+  std::vector<Variable *> vars_;
+  std::vector<Builtin  *> builtins_;
+  Functions               procFns_, doesFns_;
+  VarDoes                 varDoes_;
+  std::string             errorMsg_;
+};
+
+bool
+Translator::
+translate()
+{
+  TokenArray defs;
+
+  definitions(defs);
+
+  for (const auto &token : defs) {
+    if (oldDefs_.find(token.get()) == oldDefs_.end())
+      newDefs_.push_back(token);
+  }
+
+  for (const auto &token : newDefs_) {
+    if      (token->isProcedure()) {
+      if (addProcedure(static_cast<Procedure *>(token.get())) < 0)
+        return false;
+    }
+    else if (token->isVariable()) {
+      if (addVariable(static_cast<Variable *>(token.get())) < 0)
+        return false;
+    }
+  }
+
+  // DOES> code of variables defined while running files
+  for (size_t i = 0; i < vars_.size(); ++i) {
+    Variable *var = vars_[i];
+
+    if (oldDefs_.find(var) != oldDefs_.end() || ! var->hasExecTokens())
+      continue;
+
+    int id = addDoes(var->execTokenArray());
+
+    if (id < 0)
+      return error("Failed to translate DOES> code of " + var->name() + ": " + errorMsg_);
+
+    varDoes_[int(i)] = id;
+  }
+
+  // procedures and DOES> bodies are added as they are referenced
+  for (size_t i = 0; i < procs_.size(); ++i) {
+    std::ostringstream os;
+
+    if (! translateCode(procs_[i]->code(), os))
+      return error("Failed to translate " + procs_[i]->name() + ": " + errorMsg_);
+
+    procFns_[i].body = os.str();
+  }
+
+  return true;
+}
+
+int
+Translator::
+addProcedure(Procedure *proc)
+{
+  auto p = procIds_.find(proc);
+
+  if (p != procIds_.end())
+    return (*p).second;
+
+  if (! proc->code().isValid()) {
+    error("Procedure " + proc->name() + " has no compiled code");
+    return -1;
+  }
+
+  int id = int(procs_.size());
+
+  procIds_[proc] = id;
+
+  procs_.push_back(proc);
+
+  procFns_.push_back(Function());
+
+  procFns_.back().comment = ": " + proc->name();
+
+  return id;
+}
+
+int
+Translator::
+addVariable(Variable *var)
+{
+  auto p = varIds_.find(var);
+
+  if (p != varIds_.end())
+    return (*p).second;
+
+  int id = int(vars_.size());
+
+  varIds_[var] = id;
+
+  vars_.push_back(var);
+
+  return id;
+}
+
+int
+Translator::
+addBuiltin(Builtin *builtin)
+{
+  auto p = builtinIds_.find(builtin);
+
+  if (p != builtinIds_.end())
+    return (*p).second;
+
+  int id = int(builtins_.size());
+
+  builtinIds_[builtin] = id;
+
+  builtins_.push_back(builtin);
+
+  return id;
+}
+
+int
+Translator::
+addDoes(const TokenArray &tokens)
+{
+  Code code;
+
+  if (! code.compile(tokens)) {
+    error("Failed to compile DOES> code");
+    return -1;
+  }
+
+  int id = int(doesFns_.size());
+
+  doesFns_.push_back(Function());
+
+  std::ostringstream os;
+
+  if (! translateCode(code, os))
+    return -1;
+
+  doesFns_[id].comment = "DOES>";
+  doesFns_[id].body    = os.str();
+
+  return id;
+}
+
+bool
+Translator::
+translateCode(const Code &code, std::ostream &os)
+{
+  typedef Code::Instr Instr;
+
+  const auto &instrs = code.instrs();
+
+  int n = int(instrs.size());
+
+  // only emit labels which are jumped to
+  std::set<int> labels;
+
+  for (const auto &instr : instrs) {
+    switch (instr.op) {
+      case Instr::BRANCH_OP: case Instr::ZBRANCH_OP: case Instr::NZBRANCH_OP:
+      case Instr::LOOP_TEST_OP: case Instr::LOOP_OP: case Instr::PLOOP_OP:
+        labels.insert(instr.arg);
+        break;
+      default:
+        break;
+    }
+  }
+
+  os << "  bool ups[Code::MAX_LOOP_DEPTH], b, done;\n\n";
+  os << "  (void) ups; (void) b; (void) done;\n\n";
+
+  static const char *check = " return State::lastError();\n";
+
+  for (int i = 0; i <= n; ++i) {
+    if (labels.find(i) != labels.end())
+      os << " L" << i << ":\n";
+
+    if (i == n)
+      break;
+
+    const Instr &instr = instrs[i];
+
+    switch (instr.op) {
+      case Instr::LITERAL_OP: {
+        std::string str;
+
+        if (! cellStr(instr.cell, str))
+          return error("Unsupported literal");
+
+        os << "  pushCell(" << str << ");\n";
+
+        break;
+      }
+      case Instr::VARIABLE_OP: {
+        int id = addVariable(static_cast<Variable *>(instr.cell.token()));
+
+        os << "  if (! execVariable(v" << id << "))" << check;
+
+        break;
+      }
+      case Instr::EXEC_OP:
+      case Instr::BUILTIN_OP:
+      case Instr::INT_OP:
+      case Instr::REAL_OP: {
+        if (! translateExec(instr.cell.token(), os))
+          return false;
+
+        break;
+      }
+      case Instr::BRANCH_OP:
+        os << "  goto L" << instr.arg << ";\n";
+        break;
+      case Instr::ZBRANCH_OP:
+      case Instr::NZBRANCH_OP:
+        os << "  if (! popBoolean(b))" << check;
+        os << "  if (" << (instr.op == Instr::ZBRANCH_OP ? "! b" : "b") <<
+              ") goto L" << instr.arg << ";\n";
+        break;
+      case Instr::DO_OP:
+        os << "  if (! loopStart(ups[" << instr.cell.integer() << "]))" << check;
+        break;
+      case Instr::LOOP_TEST_OP:
+        os << "  if (! loopTest(ups[" << instr.cell.integer() << "], done))" << check;
+        os << "  if (done) goto L" << instr.arg << ";\n";
+        break;
+      case Instr::LOOP_OP:
+        os << "  if (! loopNext())" << check;
+        os << "  goto L" << instr.arg << ";\n";
+        break;
+      case Instr::PLOOP_OP:
+        os << "  if (! loopNextBy())" << check;
+        os << "  goto L" << instr.arg << ";\n";
+        break;
+      case Instr::UNLOOP_OP:
+        os << "  if (! loopEnd())" << check;
+        break;
+      default:
+        return error("Unsupported instruction");
+    }
+  }
+
+  os << "  return State::success();\n";
+
+  return true;
+}
+
+bool
+Translator::
+translateExec(Token *token, std::ostream &os)
+{
+  static const char *check = " return State::lastError();\n";
+
+  if      (token->isProcedure()) {
+    int id = addProcedure(static_cast<Procedure *>(token));
+
+    if (id < 0) return false;
+
+    os << "  if (! p" << id << "())" << check;
+  }
+  else if (token->isBuiltin()) {
+    Builtin *builtin = static_cast<Builtin *>(token);
+
+    if (builtin->builtinType() == Builtin::DOES_BUILTIN) {
+      int id = addDoes(static_cast<DoesBuiltin *>(builtin)->getValue());
+
+      if (id < 0) return false;
+
+      os << "  if (! setDoesFunction(&d" << id << "))" << check;
+    }
+    else {
+      if (builtin->hasModifier() &&
+          builtin->builtinType() != Builtin::PRINTTO_BUILTIN &&
+          builtin->builtinType() != Builtin::LOAD_BUILTIN &&
+          builtin->builtinType() != Builtin::SAVE_IMAGE_BUILTIN &&
+          builtin->builtinType() != Builtin::LOAD_IMAGE_BUILTIN)
+        return error("Unsupported word " + builtin->name());
+
+      int id = addBuiltin(builtin);
+
+      os << "  if (! b" << id << "->exec())" << check;
+    }
+  }
+  else
+    return error("Unsupported token");
+
+  return true;
+}
+
+bool
+Translator::
+cellStr(const Cell &cell, std::string &str) const
+{
+  std::ostringstream os;
+
+  os.precision(17);
+
+  if      (cell.isBoolean())
+    os << "Cell::makeBoolean(" << (cell.boolean() ? "true" : "false") << ")";
+  else if (cell.isInteger()) {
+    // most negative value has no literal form
+    if (cell.integer() == INT64_MIN)
+      os << "Cell::makeInteger(INT64_MIN)";
+    else
+      os << "Cell::makeInteger(INT64_C(" << cell.integer() << "))";
+  }
+  else if (cell.isReal())
+    os << "Cell::makeReal(" << std::scientific << cell.real() << ")";
+  else
+    return false;
+
+  str = os.str();
+
+  return true;
+}
+
+void
+Translator::
+write(std::ostream &os, bool init, const std::string &mainWord) const
+{
+  os << "// generated by CForthCompile\n";
+  os << "#include <CForth.h>\n\n";
+  os << "using namespace CForth;\n\n";
+  os << "namespace {\n\n";
+
+  for (size_t i = 0; i < vars_.size(); ++i)
+    os << "Variable *v" << i << "; // " << vars_[i]->name() << "\n";
+
+  for (size_t i = 0; i < builtins_.size(); ++i)
+    os << "Token *b" << i << "; // " << builtins_[i]->name() << "\n";
+
+  os << "\n";
+
+  for (size_t i = 0; i < procs_.size(); ++i)
+    os << "State p" << i << "();\n";
+
+  for (size_t i = 0; i < doesFns_.size(); ++i)
+    os << "State d" << i << "();\n";
+
+  for (size_t i = 0; i < procs_.size(); ++i)
+    os << "\n// " << procFns_[i].comment << "\nState\np" << i << "()\n{\n" <<
+          procFns_[i].body << "}\n";
+
+  for (size_t i = 0; i < doesFns_.size(); ++i)
+    os << "\n// " << doesFns_[i].comment << "\nState\nd" << i << "()\n{\n" <<
+          doesFns_[i].body << "}\n";
+
+  os << "\n}\n\n";
+
+  //---
+
+  os << "namespace CForthCompiled {\n\n";
+  os << "// recreate translated words and data space (must directly follow init)\n";
+  os << "State\ninstall()\n{\n";
+  os << "  static std::vector<TokenP> tokens;\n\n";
+
+  os << "  Memory &mem = memory();\n\n";
+  os << "  if (mem.here() != " << baseHere_ << ") return State::error(\"Data space in use\");\n\n";
+
+  // data space as runs of equal cells
+  Memory &mem = memory();
+
+  int here = mem.here();
+
+  if (here > baseHere_)
+    os << "  mem.allot(" << here - baseHere_ << ");\n\n";
+
+  os << "  struct Run { int addr, n; Cell cell; };\n\n";
+  os << "  static const Run runs[] = {\n";
+
+  int numRuns = 0;
+
+  for (int addr = 1; addr < here; ) {
+    Cell cell = mem.get(addr);
+
+    int n = 1;
+
+    while (addr + n < here) {
+      Cell cell1 = mem.get(addr + n);
+
+      int cmp;
+
+      if (cell1.type() != cell.type() || ! Cell::cmp(cell1, cell, cmp) || cmp != 0)
+        break;
+
+      ++n;
+    }
+
+    std::string str;
+
+    if (cellStr(cell, str)) {
+      os << "    { " << addr << ", " << n << ", " << str << " },\n";
+
+      ++numRuns;
+    }
+    else
+      std::cerr << "Warning: data space cell " << addr << " not saved" << std::endl;
+
+    addr += n;
+  }
+
+  if (numRuns == 0)
+    os << "    { 0, 0, Cell() },\n";
+
+  os << "  };\n\n";
+  os << "  for (const auto &run : runs)\n";
+  os << "    if (run.n) mem.fill(run.addr, run.n, run.cell);\n\n";
+
+  // variables (old ones already exist)
+  for (size_t i = 0; i < vars_.size(); ++i) {
+    Variable *var = vars_[i];
+
+    if (oldDefs_.find(var) != oldDefs_.end()) {
+      os << "  { VariableP var; if (! lookupVariable(\"" << var->name() <<
+            "\", var)) return State::error(\"Missing variable\"); v" << i << " = var.get(); }\n";
+      continue;
+    }
+
+    os << "  { auto var = makeRef<Variable>(\"" << var->name() << "\", " <<
+          var->addr() << "); tokens.push_back(var); v" << i << " = var.get(); }\n";
+
+    std::string str;
+
+    if (var->isConstant()) {
+      if (! cellStr(var->value(), str))
+        std::cerr << "Warning: constant " << var->name() << " not saved" << std::endl;
+      else
+        os << "  v" << i << "->setConstant(" << str << ");\n";
+    }
+  }
+
+  // builtins
+  for (size_t i = 0; i < builtins_.size(); ++i) {
+    Builtin *builtin = builtins_[i];
+
+    if      (builtin->builtinType() == Builtin::PRINTTO_BUILTIN)
+      os << "  tokens.push_back(makeRef<PrintToBuiltin>(std::string(" <<
+            quote(static_cast<PrintToBuiltin *>(builtin)->getValue()) << ")));\n";
+    else if (builtin->builtinType() == Builtin::LOAD_BUILTIN)
+      os << "  tokens.push_back(makeRef<LoadBuiltin>(std::string(" <<
+            quote(static_cast<LoadBuiltin *>(builtin)->getValue()) << ")));\n";
+    else if (builtin->builtinType() == Builtin::SAVE_IMAGE_BUILTIN)
+      os << "  tokens.push_back(makeRef<SaveImageBuiltin>(std::string(" <<
+            quote(static_cast<SaveImageBuiltin *>(builtin)->getValue()) << ")));\n";
+    else if (builtin->builtinType() == Builtin::LOAD_IMAGE_BUILTIN)
+      os << "  tokens.push_back(makeRef<LoadImageBuiltin>(std::string(" <<
+            quote(static_cast<LoadImageBuiltin *>(builtin)->getValue()) << ")));\n";
+    else {
+      os << "  { BuiltinP builtin; if (! lookupBuiltin(\"" << builtin->name() <<
+            "\", builtin)) return State::error(\"Missing builtin\"); tokens.push_back(builtin); }\n";
+    }
+
+    os << "  b" << i << " = tokens.back().get();\n";
+  }
+
+  os << "\n";
+
+  // procedures
+  std::map<const Procedure *, int> procTokens;
+
+  for (size_t i = 0; i < procs_.size(); ++i) {
+    os << "  tokens.push_back(makeRef<Procedure>(\"" << procs_[i]->name() <<
+          "\", &p" << i << "));\n";
+
+    procTokens[procs_[i]] = int(i);
+
+    os << "  TokenP pt" << i << " = tokens.back();\n";
+  }
+
+  os << "\n";
+
+  // DOES> code of variables
+  for (const auto &vd : varDoes_)
+    os << "  v" << vd.first << "->setExecFunction(&d" << vd.second << ");\n";
+
+  os << "\n";
+
+  // define in dictionary (same order so redefinitions and FORGET behave the same)
+  for (const auto &token : newDefs_) {
+    if      (token->isProcedure()) {
+      int id = procTokens[static_cast<Procedure *>(token.get())];
+
+      os << "  defineToken(\"" << static_cast<Procedure *>(token.get())->name() <<
+            "\", pt" << id << ");\n";
+    }
+    else if (token->isVariable()) {
+      auto p = varIds_.find(token.get());
+
+      os << "  defineToken(\"" << static_cast<Variable *>(token.get())->name() <<
+            "\", TokenP(v" << (*p).second << "));\n";
+    }
+  }
+
+  os << "\n  return State::success();\n}\n\n}\n";
+
+  //---
+
+  if (mainWord != "") {
+    os << "\nint\nmain(int, char **)\n{\n";
+
+    if (init)
+      os << "  init();\n\n";
+
+    os << "  if (! CForthCompiled::install() || ! parseLine(std::string(" <<
+          quote(mainWord) << "))) {\n";
+    os << "    std::cerr << State::lastError().msg() << std::endl;\n";
+    os << "    return 1;\n";
+    os << "  }\n\n";
+    os << "  return 0;\n}\n";
+  }
+}
+
+std::string
+Translator::
+quote(const std::string &str)
+{
+  std::string str1 = "\"";
+
+  for (auto c : str) {
+    if      (c == '"' || c == '\\') { str1 += '\\'; str1 += c; }
+    else if (c == '\n')             str1 += "\\n";
+    else                            str1 += c;
+  }
+
+  return str1 + "\"";
+}
+
+//------
+
+int
+main(int argc, char **argv)
+{
+  bool init = true;
+
+  std::string outFile, mainWord;
+
+  std::vector<std::string> filenames;
+
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if      (strcmp(argv[i], "-no_init") == 0)
+        init = false;
+      else if (strcmp(argv[i], "-o") == 0 && i < argc - 1)
+        outFile = argv[++i];
+      else if (strcmp(argv[i], "-main") == 0 && i < argc - 1)
+        mainWord = argv[++i];
+      else if (strcmp(argv[i], "-h") == 0 ||
+               strcmp(argv[i], "-help") == 0) {
+        std::cerr << "CForthCompile [-no_init] [-o <file.cpp>] [-main <word>] [-h|-help] "
+                     "<filenames>" << std::endl;
+        exit(1);
+      }
+      else
+        std::cerr << "Invalid arg: " << argv[i] << std::endl;
+    }
+    else
+      filenames.push_back(argv[i]);
+  }
+
+  // native code would replace instructions needed for translation and
+  // superinstructions are left to the C++ compiler
+  CForth::setJitThreshold(0);
+  CForth::setSuperInstructions(false);
+
+  if (init)
+    CForth::init();
+
+  TokenArray oldDefs;
+
+  CForth::definitions(oldDefs);
+
+  Translator translator(oldDefs, CForth::memory().here());
+
+  // run files (their output goes to stderr so generated code can go to stdout)
+  std::streambuf *coutBuf = std::cout.rdbuf(std::cerr.rdbuf());
+
+  for (const auto &filename : filenames) {
+    if (! CForth::parseFile(filename.c_str()))
+      std::cerr << CForth::State::lastError().msg() << std::endl;
+  }
+
+  std::cout.rdbuf(coutBuf);
+
+  if (! translator.translate()) {
+    std::cerr << translator.errorMsg() << std::endl;
+    exit(1);
+  }
+
+  if (outFile != "") {
+    std::ofstream os(outFile);
+
+    translator.write(os, init, mainWord);
+  }
+  else
+    translator.write(std::cout, init, mainWord);
+
+  return 0;
+}
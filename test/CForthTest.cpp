@@ -1,25 +1,79 @@
 #include <CForth.h>
 #include <CReadLine.h>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct Options {
+  bool debug    = false;
+  bool init     = true;
+  bool jit      = false;
+  bool optimize = true;
+  bool super    = true;
+  bool cache    = true;
+  bool profile  = false;
+
+  std::string image;
+  std::string loadCache;
+};
+
+void setOptions(const Options &options);
+void loadInit(const Options &options);
 
 void processFile(const std::string &filename);
+void processFiles(const std::vector<std::string> &filenames, const Options &options,
+                  int numJobs);
+
+void benchDispatch();
+void benchState();
 
 int
 main(int argc, char **argv)
 {
-  bool debug = false;
-  bool init  = true;
+  Options options;
+
+  bool bench_dispatch = false;
+  bool bench_state    = false;
+  int  numJobs        = 0;
 
   std::vector<std::string> filenames;
 
   for (int i = 1; i < argc; ++i) {
     if (argv[i][0] == '-') {
       if      (strcmp(argv[i], "-debug") == 0)
-        debug = true;
+        options.debug = true;
       else if (strcmp(argv[i], "-no_init") == 0)
-        init = false;
+        options.init = false;
+      else if (strcmp(argv[i], "-bench_dispatch") == 0)
+        bench_dispatch = true;
+      else if (strcmp(argv[i], "-bench_state") == 0)
+        bench_state = true;
+      else if (strcmp(argv[i], "-jit") == 0)
+        options.jit = true;
+      else if (strcmp(argv[i], "-no_jit") == 0)
+        options.jit = false;
+      else if (strcmp(argv[i], "-no_opt") == 0)
+        options.optimize = false;
+      else if (strcmp(argv[i], "-no_super") == 0)
+        options.super = false;
+      else if (strcmp(argv[i], "-no_cache") == 0)
+        options.cache = false;
+      else if (strcmp(argv[i], "-profile") == 0)
+        options.profile = true;
+      else if (strcmp(argv[i], "-jobs") == 0 && i < argc - 1)
+        numJobs = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-image") == 0 && i < argc - 1)
+        options.image = argv[++i];
+      else if (strcmp(argv[i], "-load_cache") == 0 && i < argc - 1)
+        options.loadCache = argv[++i];
       else if (strcmp(argv[i], "-h") == 0 ||
                strcmp(argv[i], "-help") == 0) {
-        std::cerr << "CForthTest [-debug] [-noinit] [-h|-help] <filenames>" << std::endl;
+        std::cerr << "CForthTest [-debug] [-noinit] [-bench_dispatch] [-bench_state] "
+                     "[-jit] [-no_jit] [-no_opt] [-no_super] "
+                     "[-no_cache] [-profile] [-jobs <n>] [-image <file>] [-load_cache <dir>] [-h|-help] <filenames>" << std::endl;
         exit(1);
       }
       else
@@ -29,16 +83,44 @@ main(int argc, char **argv)
       filenames.push_back(argv[i]);
   }
 
-  CForth::setDebug(debug);
+#ifndef CFORTH_TRACE
+  // profile counts interpreted instructions (needs trace build)
+  if (options.profile) {
+    std::cerr << "-profile needs CForthTraceTest" << std::endl;
+    options.profile = false;
+  }
+#endif
 
-  if (init)
-    CForth::init();
+  // each job runs in its own interpreter (profile counts are per interpreter)
+  if (numJobs > 0 && ! filenames.empty() && ! bench_dispatch && ! bench_state) {
+    processFiles(filenames, options, numJobs);
+    return 0;
+  }
+
+  setOptions(options);
+
+  loadInit(options);
+
+  if (bench_dispatch) {
+    benchDispatch();
+    return 0;
+  }
+
+  if (bench_state) {
+    benchState();
+    return 0;
+  }
 
   if (! filenames.empty()) {
     uint num_files = filenames.size();
 
     for (uint i = 0; i < num_files; ++i)
       processFile(filenames[i]);
+
+#ifdef CFORTH_TRACE
+    if (options.profile)
+      CForth::printProfile(std::cerr);
+#endif
   }
   else {
     CReadLine readline;
@@ -60,10 +142,251 @@ main(int argc, char **argv)
   return 0;
 }
 
+// apply options to current interpreter
+void
+setOptions(const Options &options)
+{
+  CForth::setDebug(options.debug);
+
+  // native code for procedures called 100 times (off by default)
+  CForth::setJitThreshold(options.jit ? 100 : 0);
+
+  CForth::setOptimize(options.optimize);
+  CForth::setSuperInstructions(options.super);
+  CForth::setStackCache(options.cache);
+
+  CForth::setLoadCache(options.loadCache);
+
+#ifdef CFORTH_TRACE
+  if (options.profile) {
+    CForth::setJitThreshold(0);
+    CForth::setProfile(true);
+  }
+#endif
+}
+
+// load image saved with SAVE-IMAGE instead of running init file
+void
+loadInit(const Options &options)
+{
+  if (! options.image.empty()) {
+    if (! CForth::loadImage(options.image.c_str()))
+      std::cerr << CForth::State::lastError().msg() << std::endl;
+  }
+  else if (options.init)
+    CForth::init();
+}
+
+// files are loaded (as LOAD) so unchanged files can be replayed from load cache
 void
 processFile(const std::string &filename)
 {
-  if (! CForth::parseFile(filename.c_str())) {
+  if (! CForth::loadFile(filename.c_str())) {
     std::cerr << CForth::State::lastError().msg() << std::endl;
   }
 }
+
+// evaluate each file in a new interpreter on a pool of worker threads. Output of
+// each file is buffered and written in file order as soon as it (and all files
+// before it) have finished, so output matches running the files one at a time
+// with separate interpreters.
+void
+processFiles(const std::vector<std::string> &filenames, const Options &options, int numJobs)
+{
+  struct Result {
+    std::string output;
+    std::string error;
+    bool        done { false };
+  };
+
+  auto numFiles = filenames.size();
+
+  std::vector<Result>     results(numFiles);
+  std::atomic<size_t>     next(0);
+  std::mutex              mutex;
+  std::condition_variable cond;
+
+  // settings and init file (or image) are loaded once into a frozen base shared by all jobs
+  CForth::Interpreter::BaseP base;
+
+  {
+    CForth::Interpreter loader;
+
+    CForth::Interpreter::setCurrent(&loader);
+
+    setOptions(options);
+
+    loadInit(options);
+
+    base = loader.freeze();
+  }
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < numFiles; i = next++) {
+      std::ostringstream os;
+      std::string        error;
+
+      {
+        CForth::Interpreter interp(base);
+
+        CForth::Interpreter::setCurrent(&interp);
+
+        CForth::setOutput(os);
+
+        if (! interp.loadFile(filenames[i].c_str()))
+          error = CForth::State::lastError().msg();
+
+#ifdef CFORTH_TRACE
+        if (options.profile)
+          CForth::printProfile(os);
+#endif
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+
+      results[i].output = os.str();
+      results[i].error  = error;
+      results[i].done   = true;
+
+      cond.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < std::min(numJobs, int(numFiles)); ++i)
+    threads.emplace_back(worker);
+
+  for (size_t i = 0; i < numFiles; ++i) {
+    Result result;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      cond.wait(lock, [&]() { return results[i].done; });
+
+      std::swap(result, results[i]);
+    }
+
+    std::cout << result.output << std::flush;
+
+    if (! result.error.empty())
+      std::cerr << result.error << std::endl;
+  }
+
+  for (auto &thread : threads)
+    thread.join();
+}
+
+// time same word compiled with virtual and switch builtin dispatch
+void
+benchDispatch()
+{
+  static const char *defStr =
+    ": BENCH 1000000 0 DO 1 2 + 3 * DUP * DROP I 5 OVER OVER SWAP - ROT + * DROP LOOP ;";
+
+  struct Mode {
+    CForth::DispatchMode mode;
+    const char          *name;
+  };
+
+  Mode modes[] = {
+    { CForth::VIRTUAL_DISPATCH, "virtual" },
+    { CForth::SWITCH_DISPATCH , "switch"  }
+  };
+
+  for (const auto &mode : modes) {
+    CForth::setDispatchMode(mode.mode);
+
+    if (! CForth::parseLine(std::string(defStr))) {
+      std::cerr << CForth::State::lastError().msg() << std::endl;
+      return;
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    if (! CForth::parseLine(std::string("BENCH")))
+      std::cerr << CForth::State::lastError().msg() << std::endl;
+
+    auto t2 = std::chrono::steady_clock::now();
+
+    double ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+    std::cout << mode.name << " dispatch: " << ms << "ms" << std::endl;
+  }
+}
+
+//------
+
+namespace {
+
+// previous State layout (validity plus message string) for synthetic comparison
+// outside the interpreter
+struct StringState {
+  bool        valid;
+  std::string msg;
+
+  static StringState success() { return StringState{true, ""}; }
+};
+
+__attribute__((noinline)) StringState stringStateOp(int i) {
+  if (i < 0) return StringState{false, "STACK UNDERFLOW"};
+
+  return StringState::success();
+}
+
+__attribute__((noinline)) CForth::State codeStateOp(int i) {
+  if (i < 0) return CForth::State::error("STACK UNDERFLOW");
+
+  return CForth::State::success();
+}
+
+}
+
+// time success path of string based state against error code state in a trivial
+// function (synthetic, not the interpreter), then per op cost of interpreter loop
+// with current State. For interpreter before/after run the same BENCH word in
+// builds with each State.
+void
+benchState()
+{
+  const int n = 10000000;
+
+  auto timeOp = [&](const char *name, bool (*op)(int)) {
+    int nok = 0;
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < n; ++i)
+      nok += op(i);
+
+    auto t2 = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(t2 - t1).count()/n;
+
+    std::cout << name << ": " << ns << "ns/op (" << nok << ")" << std::endl;
+  };
+
+  timeOp("synthetic string state", [](int i) { return stringStateOp(i).valid; });
+  timeOp("synthetic code state  ", [](int i) { return codeStateOp(i).valid(); });
+
+  // 16 words per loop iteration plus loop overhead
+  static const char *defStr =
+    ": BENCH 1000000 0 DO 1 2 + 3 * DUP * DROP I 5 OVER OVER SWAP - ROT + * DROP LOOP ;";
+
+  if (! CForth::parseLine(std::string(defStr))) {
+    std::cerr << CForth::State::lastError().msg() << std::endl;
+    return;
+  }
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  if (! CForth::parseLine(std::string("BENCH")))
+    std::cerr << CForth::State::lastError().msg() << std::endl;
+
+  auto t2 = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(t2 - t1).count()/(16*1000000.0);
+
+  std::cout << "interpreter : " << ns << "ns/op" << std::endl;
+}